@@ -0,0 +1,31 @@
+add_executable( bench_${PROJECT_NAME} )
+
+target_sources( bench_${PROJECT_NAME}
+    PRIVATE
+    ${CMAKE_CURRENT_LIST_DIR}/bench.cpp
+    ${SERVER_SOURCES}
+)
+
+target_include_directories( bench_${PROJECT_NAME}
+    PRIVATE
+    ${SERVER_INCLUDES}
+)
+
+target_compile_definitions( bench_${PROJECT_NAME}
+    PRIVATE
+    ${SERVER_DEFINITIONS}
+)
+
+target_compile_features( bench_${PROJECT_NAME}
+    PRIVATE
+    cxx_std_20
+)
+
+target_link_libraries( bench_${PROJECT_NAME}
+    PRIVATE
+    ${SERVER_LIBS}
+)
+
+if( TARGET embedded_assets )
+    add_dependencies( bench_${PROJECT_NAME} embedded_assets )
+endif()
@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <latch>
+#include <random>
+#include <string_view>
+#include <thread>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+#include "logging.h"
+#include "metrics.h"
+#include "server.h"
+
+/* Capacity benchmark: starts the server on a temporary database and drives it with
+ * simulated chat clients, each doing what chat.js does with short polling.
+ *
+ *   bench_server [--users N] [--duration S] [--rate MSG_PER_S] [--poll-interval MS]
+ *                [--online-interval MS] [--port PORT] [--output FILE]
+ *
+ * The report is JSON on stdout (and in FILE), latencies are in milliseconds.
+ */
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+    using Json = nlohmann::json;
+
+    struct Options
+    {
+        int users = 32;
+        std::chrono::seconds duration {10};
+        // Messages per second per user
+        double rate = 0.5;
+        std::chrono::milliseconds pollInterval {1000};
+        std::chrono::milliseconds onlineInterval {5000};
+        int port = 18080;
+        std::string output;
+    };
+
+    enum Endpoint : size_t
+    {
+        kLogin,
+        kHistory,
+        kPost,
+        kPollNew,
+        kOnline,
+        kStats,
+        kEndpoints
+    };
+
+    constexpr std::array<std::string_view, kEndpoints> kEndpointNames = {
+        "POST /api/auth/login",
+        "GET /api/messages",
+        "POST /api/messages",
+        "GET /api/messages/new",
+        "GET /api/users/online",
+        "GET /api/stats",
+    };
+
+    // Tries of register and login each while the auth pool answers 503
+    constexpr int kSetupAttempts = 20;
+
+    struct Results
+    {
+        std::array<Histogram, kEndpoints> latency;
+        std::array<std::atomic<uint64_t>, kEndpoints> errors {};
+    };
+
+    auto parseOptions( int argc, char *argv[], Options &options ) -> bool
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string_view arg(argv[i]);
+
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            std::string value = argv[++i];
+
+            if (arg == "--users")
+            {
+                options.users = std::max(1, std::stoi(value));
+            }
+            else if (arg == "--duration")
+            {
+                options.duration = std::chrono::seconds(std::stoi(value));
+            }
+            else if (arg == "--rate")
+            {
+                options.rate = std::stod(value);
+            }
+            else if (arg == "--poll-interval")
+            {
+                options.pollInterval = std::chrono::milliseconds(std::stoi(value));
+            }
+            else if (arg == "--online-interval")
+            {
+                options.onlineInterval = std::chrono::milliseconds(std::stoi(value));
+            }
+            else if (arg == "--port")
+            {
+                options.port = std::stoi(value);
+            }
+            else if (arg == "--output")
+            {
+                options.output = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template <typename Call>
+    auto timed( Results &results, const Endpoint endpoint, Call &&call ) -> httplib::Result
+    {
+        auto start = Clock::now();
+        auto result = call();
+
+        results.latency[endpoint].record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        if (!result || result->status >= 400)
+        {
+            results.errors[endpoint].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return result;
+    }
+
+    class SimulatedUser final
+    {
+    public:
+        SimulatedUser( const Options &options, const int index, Results &results ) :
+            _options(options), _results(results), _client("127.0.0.1", options.port),
+            _login("bench_" + std::to_string(index)), _random(index) {}
+
+        // Registers, logs in and loads the first page like the chat page does on open
+        auto setup( void ) -> bool
+        {
+            _client.set_keep_alive(true);
+
+            Json user = {
+                {"login", _login},
+                {"password", "bench_password"},
+                {"first_name", "Bench"},
+                {"last_name", "User"}
+            };
+
+            auto registered = _retryBusy([&] {
+                return _client.Post("/api/auth/register", user.dump(), "application/json");
+            });
+
+            if (!registered || registered->status != httplib::StatusCode::OK_200)
+            {
+                spdlog::warn("{} could not register: {}", _login,
+                             registered ? std::to_string(registered->status) : httplib::to_string(registered.error()));
+                return false;
+            }
+
+            Json credentials = {
+                {"login", _login},
+                {"password", "bench_password"}
+            };
+            auto login = _retryBusy([&] {
+                return timed(_results, kLogin, [&] {
+                    return _client.Post("/api/auth/login", credentials.dump(), "application/json");
+                });
+            });
+
+            if (!login || login->status != httplib::StatusCode::OK_200)
+            {
+                return false;
+            }
+
+            _headers = {{"Authorization-Token", Json::parse(login->body)["auth_token"].get<std::string>()}};
+
+            auto history = timed(_results, kHistory, [&] {
+                return _client.Get("/api/messages?limit=50", _headers);
+            });
+
+            if (history && history->status == httplib::StatusCode::OK_200)
+            {
+                _readMessages(history->body);
+            }
+
+            return true;
+        }
+
+        void run( const Clock::time_point deadline )
+        {
+            auto now = Clock::now();
+            auto postInterval = _options.rate > 0 ?
+                std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / _options.rate)) :
+                Clock::duration::max();
+
+            // Random phase, otherwise every user would hit the server in the same millisecond
+            auto nextPost = _options.rate > 0 ? now + _jitter(postInterval) : Clock::time_point::max();
+            auto nextPoll = now + _jitter(_options.pollInterval);
+            auto nextOnline = now + _jitter(_options.onlineInterval);
+            int posted = 0;
+
+            while (true)
+            {
+                auto next = std::min({nextPost, nextPoll, nextOnline});
+
+                if (next >= deadline)
+                {
+                    return;
+                }
+                std::this_thread::sleep_until(next);
+
+                if (next == nextPost)
+                {
+                    Json message = {
+                        {"message_text", _login + " says " + std::to_string(posted++)}
+                    };
+
+                    timed(_results, kPost, [&] {
+                        return _client.Post("/api/messages", _headers, message.dump(), "application/json");
+                    });
+                    nextPost += postInterval;
+                }
+                else if (next == nextPoll)
+                {
+                    auto result = timed(_results, kPollNew, [&] {
+                        return _client.Get("/api/messages/new?after_id=" + std::to_string(_lastMessageId), _headers);
+                    });
+
+                    if (result && result->status == httplib::StatusCode::OK_200)
+                    {
+                        _readMessages(result->body);
+                    }
+                    nextPoll += _options.pollInterval;
+                }
+                else
+                {
+                    std::string query = _onlineVersion ? "?since_version=" + std::to_string(_onlineVersion) : "";
+                    auto result = timed(_results, kOnline, [&] {
+                        return _client.Get("/api/users/online" + query, _headers);
+                    });
+
+                    if (result && result->status == httplib::StatusCode::OK_200)
+                    {
+                        _onlineVersion = Json::parse(result->body).value("version", _onlineVersion);
+                    }
+
+                    timed(_results, kStats, [&] {
+                        return _client.Get("/api/stats", _headers);
+                    });
+                    nextOnline += _options.onlineInterval;
+                }
+            }
+        }
+
+    private:
+        const Options &_options;
+        Results &_results;
+        httplib::Client _client;
+        httplib::Headers _headers;
+        std::string _login;
+        std::mt19937_64 _random;
+        int _lastMessageId {};
+        uint64_t _onlineVersion {};
+
+        // Auth answers 503 with Retry-After while its pool is full, so waits like chat.js does and asks again
+        template <typename Call>
+        auto _retryBusy( Call &&call ) -> httplib::Result
+        {
+            for (int attempt = 1; ; attempt++)
+            {
+                auto result = call();
+
+                if (!result || result->status != httplib::StatusCode::ServiceUnavailable_503 ||
+                    attempt == kSetupAttempts)
+                {
+                    return result;
+                }
+
+                int retryAfter = 1;
+
+                try
+                {
+                    retryAfter = std::max(1, std::stoi(result->get_header_value("Retry-After", "1")));
+                }
+                catch ( const std::exception & )
+                {
+                }
+
+                // Spread out, otherwise every rejected user would come back in the same millisecond
+                std::this_thread::sleep_for(std::chrono::seconds(retryAfter) + _jitter(std::chrono::seconds(retryAfter)));
+            }
+        }
+
+        auto _jitter( const Clock::duration interval ) -> Clock::duration
+        {
+            return Clock::duration(std::uniform_int_distribution<Clock::rep>(0, interval.count())(_random));
+        }
+
+        void _readMessages( const std::string &body )
+        {
+            auto page = Json::parse(body, nullptr, false);
+
+            if (page.is_discarded() || !page.contains("messages"))
+            {
+                return;
+            }
+
+            for (const auto &message : page["messages"])
+            {
+                _lastMessageId = std::max(_lastMessageId, message.value("id", 0));
+            }
+        }
+    };
+
+    auto makeReport( const Options &options, const Results &results, const double setupSeconds,
+                     const double runSeconds ) -> Json
+    {
+        Json endpoints = Json::array();
+        uint64_t totalRequests = 0;
+        uint64_t totalErrors = 0;
+
+        auto toMs = []( const uint64_t nanoseconds ) {
+            return static_cast<double>(nanoseconds) / 1e6;
+        };
+
+        for (size_t i = 0; i < kEndpoints; i++)
+        {
+            auto snapshot = results.latency[i].getSnapshot();
+            uint64_t errors = results.errors[i].load();
+            // Logins all happen before the measured window
+            double seconds = i == kLogin || i == kHistory ? setupSeconds : runSeconds;
+
+            totalRequests += snapshot.count;
+            totalErrors += errors;
+
+            endpoints.push_back({
+                {"endpoint", kEndpointNames[i]},
+                {"requests", snapshot.count},
+                {"errors", errors},
+                {"throughput_rps", seconds > 0 ? snapshot.count / seconds : 0.0},
+                {"latency_ms", {
+                    {"mean", snapshot.count ? toMs(snapshot.sum / snapshot.count) : 0.0},
+                    {"p50", toMs(snapshot.getPercentile(0.5))},
+                    {"p99", toMs(snapshot.getPercentile(0.99))},
+                    {"p999", toMs(snapshot.getPercentile(0.999))},
+                    {"max", toMs(snapshot.getPercentile(1.0))}
+                }}
+            });
+        }
+
+        return {
+            {"config", {
+                {"users", options.users},
+                {"duration_s", options.duration.count()},
+                {"rate_per_user", options.rate},
+                {"poll_interval_ms", options.pollInterval.count()},
+                {"online_interval_ms", options.onlineInterval.count()},
+                {"threads", std::thread::hardware_concurrency()}
+            }},
+            {"setup_s", setupSeconds},
+            {"run_s", runSeconds},
+            {"endpoints", endpoints},
+            {"total", {
+                {"requests", totalRequests},
+                {"errors", totalErrors}
+            }}
+        };
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    Options options;
+
+    try
+    {
+        if (!parseOptions(argc, argv, options))
+        {
+            std::cerr << "Usage: " << argv[0] << " [--users N] [--duration S] [--rate MSG_PER_S] "
+                      << "[--poll-interval MS] [--online-interval MS] [--port PORT] [--output FILE]\n";
+            return EXIT_FAILURE;
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        std::cerr << "Invalid option value: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // Per-request logs would measure the console, not the server
+    Logging::init(spdlog::level::warn);
+
+    auto dbPath = std::filesystem::temp_directory_path() /
+        ("chat_bench_" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + ".db");
+    int code = EXIT_SUCCESS;
+
+    {
+        Server server("127.0.0.1", options.port, dbPath.string());
+        std::thread serverThread([&server] {
+            try
+            {
+                server.run();
+            }
+            catch ( const std::exception &e )
+            {
+                spdlog::critical("{}", e.what());
+                server.stop();
+            }
+        });
+
+        if (server.waitUntilReady())
+        {
+            auto results = std::make_unique<Results>();
+            std::vector<std::unique_ptr<SimulatedUser>> users;
+            std::vector<std::thread> threads;
+            std::latch ready(options.users + 1);
+            std::latch start(1);
+            std::atomic<int> failed {};
+            Clock::time_point deadline;
+
+            for (int i = 0; i < options.users; i++)
+            {
+                users.push_back(std::make_unique<SimulatedUser>(options, i, *results));
+            }
+
+            auto setupStart = Clock::now();
+
+            for (auto &user : users)
+            {
+                threads.emplace_back([&, user = user.get()] {
+                    bool isReady = user->setup();
+
+                    ready.arrive_and_wait();
+                    start.wait();
+                    if (isReady)
+                    {
+                        user->run(deadline);
+                    }
+                    else
+                    {
+                        failed++;
+                    }
+                });
+            }
+
+            // Users start together once all of them are logged in
+            ready.arrive_and_wait();
+
+            auto setupEnd = Clock::now();
+
+            deadline = setupEnd + options.duration;
+            start.count_down();
+
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+
+            auto runEnd = Clock::now();
+            auto report = makeReport(options, *results,
+                                     std::chrono::duration<double>(setupEnd - setupStart).count(),
+                                     std::chrono::duration<double>(runEnd - setupEnd).count());
+
+            report["failed_users"] = failed.load();
+
+            std::cout << report.dump(2) << std::endl;
+            if (!options.output.empty())
+            {
+                std::ofstream(options.output) << report.dump(2) << "\n";
+            }
+
+            code = failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        else
+        {
+            spdlog::critical("Server did not start on port {}", options.port);
+            code = EXIT_FAILURE;
+        }
+
+        server.stop();
+        serverThread.join();
+    }
+
+    for (const char *suffix : {"", "-wal", "-shm"})
+    {
+        std::error_code ec;
+
+        std::filesystem::remove(dbPath.string() + suffix, ec);
+    }
+
+    Logging::shutdown();
+    return code;
+}
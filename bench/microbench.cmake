@@ -0,0 +1,38 @@
+CPMAddPackage( NAME benchmark
+    GIT_REPOSITORY "https://github.com/google/benchmark.git"
+    GIT_TAG v1.9.4
+    OPTIONS "BENCHMARK_ENABLE_TESTING OFF" "BENCHMARK_ENABLE_GTEST_TESTS OFF" "BENCHMARK_ENABLE_INSTALL OFF"
+)
+
+add_executable( microbench_${PROJECT_NAME} )
+
+target_sources( microbench_${PROJECT_NAME}
+    PRIVATE
+    ${CMAKE_CURRENT_LIST_DIR}/microbench.cpp
+    ${SERVER_SOURCES}
+)
+
+target_include_directories( microbench_${PROJECT_NAME}
+    PRIVATE
+    ${SERVER_INCLUDES}
+)
+
+target_compile_definitions( microbench_${PROJECT_NAME}
+    PRIVATE
+    ${SERVER_DEFINITIONS}
+)
+
+target_compile_features( microbench_${PROJECT_NAME}
+    PRIVATE
+    cxx_std_20
+)
+
+target_link_libraries( microbench_${PROJECT_NAME}
+    PRIVATE
+    benchmark::benchmark_main
+    ${SERVER_LIBS}
+)
+
+if( TARGET embedded_assets )
+    add_dependencies( microbench_${PROJECT_NAME} embedded_assets )
+endif()
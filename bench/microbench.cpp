@@ -0,0 +1,200 @@
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "database.h"
+#include "password.h"
+#include "response_converter.h"
+#include "sha256.h"
+
+/* Micro-benchmarks for the functions on the request path.
+ * Database cases run against a file per table size in the temp directory, filled once per run.
+ */
+
+namespace
+{
+    constexpr int kPageSize = 100;
+
+    auto makeDatabase( const int messages ) -> std::unique_ptr<Database>
+    {
+        auto path = std::filesystem::temp_directory_path() / ("chat_microbench_" + std::to_string(messages) + ".db");
+        auto db = std::make_unique<Database>(path.string());
+        User user;
+
+        db->clear();
+        user.login = "bencher";
+        user.password = "qwert";
+        user.firstName = "Bench";
+        user.lastName = "User";
+        db->addUser(user);
+
+        int userId = db->getUserByLogin("bencher").value().id;
+        std::vector<std::future<std::pair<MessagePtr, Database::Error>>> pending;
+
+        // Queued all at once so the writer stores them in large batches
+        pending.reserve(messages);
+        for (int i = 0; i < messages; i++)
+        {
+            pending.push_back(db->queueMessage(userId, "Message number " + std::to_string(i)));
+        }
+        for (auto &result : pending)
+        {
+            result.wait();
+        }
+
+        return db;
+    }
+
+    auto makePage( void ) -> std::vector<MessagePtr>
+    {
+        std::vector<MessagePtr> page;
+
+        for (int i = 0; i < kPageSize; i++)
+        {
+            auto msg = std::make_shared<MessageJson>();
+
+            msg->id = i + 1;
+            msg->userId = 1;
+            msg->roomId = 1;
+            msg->messageText = "Message number " + std::to_string(i) + ", long enough to look like a real one";
+            msg->timestamp = "2025-01-01 12:00:00";
+            msg->user = User {1, "bencher", "", "Bench", "User", true};
+            msg->json = msg->toJson().dump();
+            page.push_back(std::move(msg));
+        }
+
+        return page;
+    }
+}
+
+static void BM_SHA256( benchmark::State &state )
+{
+    std::string data(state.range(0), 'x');
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(SHA256(data));
+    }
+
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SHA256)->RangeMultiplier(8)->Range(8, 64 << 10);
+
+// One login worth of hashing per iteration count, to size --kdf-iterations against --auth-workers
+static void BM_PasswordHash( benchmark::State &state )
+{
+    const uint8_t salt[Password::kSaltBytes] = {};
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Password::hash("bench_password", salt, sizeof(salt), state.range(0)));
+    }
+}
+BENCHMARK(BM_PasswordHash)->Arg(10000)->Arg(100000)->Arg(600000)->Unit(benchmark::kMillisecond);
+
+static void BM_GetUserByToken( benchmark::State &state )
+{
+    auto db = makeDatabase(0);
+    auto [token, err] = db->loginUser("bencher", "qwert");
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(db->getUserByToken(token.token));
+    }
+}
+BENCHMARK(BM_GetUserByToken);
+
+// Misses the session cache and goes to SQL every time
+static void BM_GetUserByUnknownToken( benchmark::State &state )
+{
+    auto db = makeDatabase(0);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(db->getUserByToken("no-such-token"));
+    }
+}
+BENCHMARK(BM_GetUserByUnknownToken);
+
+// Every call waits for its own commit, so this is the latency of one post
+static void BM_SendMessage( benchmark::State &state )
+{
+    auto db = makeDatabase(0);
+    int userId = db->getUserByLogin("bencher").value().id;
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(db->sendMessage(userId, "Benchmark message"));
+    }
+}
+BENCHMARK(BM_SendMessage)->UseRealTime();
+
+static void BM_GetLastMessages( benchmark::State &state )
+{
+    auto db = makeDatabase(state.range(0));
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(db->getLastMessages(kPageSize));
+    }
+
+    state.SetItemsProcessed(state.iterations() * kPageSize);
+}
+BENCHMARK(BM_GetLastMessages)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// Second argument is how far behind the newest message the reader is
+static void BM_GetMessagesAfter( benchmark::State &state )
+{
+    auto db = makeDatabase(state.range(0));
+    int afterId = std::max(0, db->getLastMessageId() - static_cast<int>(state.range(1)));
+    size_t items = 0;
+
+    for (auto _ : state)
+    {
+        auto messages = db->getMessagesAfter(afterId, kPageSize);
+
+        items += messages.size();
+        benchmark::DoNotOptimize(messages);
+    }
+
+    state.SetItemsProcessed(items);
+}
+BENCHMARK(BM_GetMessagesAfter)->ArgsProduct({{1000, 10000, 100000}, {10, 5000}});
+
+static void BM_MessagesToJson( benchmark::State &state )
+{
+    auto page = makePage();
+
+    for (auto _ : state)
+    {
+        nlohmann::json messages = nlohmann::json::array();
+
+        for (const auto &msg : page)
+        {
+            messages.push_back(msg->toJson());
+        }
+
+        benchmark::DoNotOptimize(nlohmann::json {{"messages", messages}, {"total_count", page.size()}}.dump());
+    }
+
+    state.SetItemsProcessed(state.iterations() * kPageSize);
+}
+BENCHMARK(BM_MessagesToJson);
+
+// Same page built from the json kept with every message
+static void BM_MessagesPage( benchmark::State &state )
+{
+    auto page = makePage();
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(ResponseConverter::toMessagesPage(page));
+    }
+
+    state.SetItemsProcessed(state.iterations() * kPageSize);
+}
+BENCHMARK(BM_MessagesPage);
@@ -0,0 +1,27 @@
+# Turns every file under INPUT_DIR into a byte array in OUTPUT_FILE.
+# Run as: cmake -DINPUT_DIR=<dir> -DOUTPUT_FILE=<file.cpp> -P embed_assets.cmake
+
+file( GLOB_RECURSE ASSET_FILES RELATIVE ${INPUT_DIR} ${INPUT_DIR}/* )
+list( SORT ASSET_FILES )
+
+set( ASSET_ARRAYS "" )
+set( ASSET_TABLE "" )
+set( ASSET_INDEX 0 )
+
+foreach( ASSET_FILE ${ASSET_FILES} )
+    file( READ ${INPUT_DIR}/${ASSET_FILE} ASSET_HEX HEX )
+    string( REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," ASSET_BYTES "${ASSET_HEX}" )
+
+    # Trailing zero keeps empty files a valid array, it is not part of the data
+    string( APPEND ASSET_ARRAYS "    const unsigned char asset${ASSET_INDEX}[] = {${ASSET_BYTES}0x00};\n" )
+    string( APPEND ASSET_TABLE "        {\"${ASSET_FILE}\", {reinterpret_cast<const char *>(asset${ASSET_INDEX}), sizeof(asset${ASSET_INDEX}) - 1}},\n" )
+
+    math( EXPR ASSET_INDEX "${ASSET_INDEX} + 1" )
+endforeach()
+
+set( ASSET_SOURCE "// Generated by cmake/embed_assets.cmake, do not edit\n\n#include \"embedded_assets.h\"\n\nnamespace\n{\n" )
+string( APPEND ASSET_SOURCE "${ASSET_ARRAYS}\n    const EmbeddedAsset assets[] = {\n${ASSET_TABLE}    };\n}\n\n" )
+string( APPEND ASSET_SOURCE "auto getEmbeddedAssets( void ) -> std::span<const EmbeddedAsset>\n{\n    return assets;\n}\n" )
+
+# Leave the file alone when nothing changed, so dependents are not rebuilt
+file( CONFIGURE OUTPUT ${OUTPUT_FILE} CONTENT "${ASSET_SOURCE}" @ONLY )
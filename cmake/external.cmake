@@ -23,6 +23,11 @@ CPMAddPackage( NAME nlohmann_json
     GIT_TAG v3.12.0
 )
 
+# Message search is an FTS5 index, which the SQLite bundled with SQLiteCpp leaves out by default
+if( TARGET sqlite3 )
+    target_compile_definitions( sqlite3 PRIVATE SQLITE_ENABLE_FTS5 )
+endif()
+
 list( APPEND SERVER_LIBS
     httplib
     SQLiteCpp
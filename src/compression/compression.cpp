@@ -0,0 +1,216 @@
+#include <cctype>
+#include <optional>
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+#include <brotli/encode.h>
+#endif
+
+#include "compression.h"
+
+namespace
+{
+    auto trim( std::string_view str ) -> std::string_view
+    {
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+        {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
+
+    auto isSameToken( std::string_view lhs, std::string_view rhs ) -> bool
+    {
+        if (lhs.size() != rhs.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < lhs.size(); i++)
+        {
+            if (std::tolower(static_cast<unsigned char>(lhs[i])) != std::tolower(static_cast<unsigned char>(rhs[i])))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Only the q=0 case matters here, everything else counts as acceptable
+    auto isRefused( std::string_view params ) -> bool
+    {
+        while (!params.empty())
+        {
+            size_t next = params.find(';');
+            auto param = trim(params.substr(0, next));
+
+            params = next == std::string_view::npos ? std::string_view {} : params.substr(next + 1);
+
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+            {
+                // q is at most "0.000", so zero is any mix of '0' and '.'
+                return param.substr(2).find_first_not_of("0.") == std::string_view::npos;
+            }
+        }
+        return false;
+    }
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+    // 15 window bits + 16 selects the gzip wrapper, plain 15 the zlib one HTTP calls deflate
+    auto zlib( std::string_view data, const int level, const int windowBits ) -> std::string
+    {
+        z_stream stream {};
+
+        if (deflateInit2(&stream, level < 0 ? Z_BEST_COMPRESSION : level, Z_DEFLATED, windowBits, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return {};
+        }
+
+        std::string out(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = reinterpret_cast<Bytef *>(out.data());
+        stream.avail_out = static_cast<uInt>(out.size());
+
+        int status = deflate(&stream, Z_FINISH);
+
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        return status == Z_STREAM_END ? out : std::string {};
+    }
+#endif
+
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+    auto brotli( std::string_view data, const int level ) -> std::string
+    {
+        size_t size = BrotliEncoderMaxCompressedSize(data.size());
+
+        if (size == 0)
+        {
+            return {};
+        }
+
+        std::string out(size, '\0');
+
+        if (!BrotliEncoderCompress(level < 0 ? BROTLI_MAX_QUALITY : level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                   data.size(), reinterpret_cast<const uint8_t *>(data.data()),
+                                   &size, reinterpret_cast<uint8_t *>(out.data())))
+        {
+            return {};
+        }
+
+        out.resize(size);
+        return out;
+    }
+#endif
+}
+
+auto Compression::isSupported( const Encoding encoding ) -> bool
+{
+    switch (encoding)
+    {
+    case Encoding::kIdentity:
+        return true;
+    case Encoding::kGzip:
+    case Encoding::kDeflate:
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+        return true;
+#else
+        return false;
+#endif
+    case Encoding::kBrotli:
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+auto Compression::getName( const Encoding encoding ) -> std::string_view
+{
+    switch (encoding)
+    {
+    case Encoding::kGzip:
+        return "gzip";
+    case Encoding::kDeflate:
+        return "deflate";
+    case Encoding::kBrotli:
+        return "br";
+    default:
+        return "identity";
+    }
+}
+
+auto Compression::compress( std::string_view data, const Encoding encoding, const int level ) -> std::string
+{
+    switch (encoding)
+    {
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+    case Encoding::kGzip:
+        return zlib(data, level, 15 + 16);
+    case Encoding::kDeflate:
+        return zlib(data, level, 15);
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+    case Encoding::kBrotli:
+        return brotli(data, level);
+#endif
+    default:
+        return {};
+    }
+}
+
+auto Compression::isAccepted( std::string_view acceptEncoding, const Encoding encoding ) -> bool
+{
+    const auto name = getName(encoding);
+    // The coding's own entry wins over "*" wherever the two are in the list (RFC 9110, 12.5.3)
+    std::optional<bool> listed;
+    std::optional<bool> wildcard;
+
+    while (!acceptEncoding.empty())
+    {
+        size_t next = acceptEncoding.find(',');
+        auto item = acceptEncoding.substr(0, next);
+
+        acceptEncoding = next == std::string_view::npos ? std::string_view {} : acceptEncoding.substr(next + 1);
+
+        size_t params = item.find(';');
+        auto coding = trim(item.substr(0, params));
+        bool isAllowed = !isRefused(params == std::string_view::npos ? std::string_view {} : item.substr(params + 1));
+
+        if (isSameToken(coding, name))
+        {
+            listed = isAllowed;
+        }
+        else if (coding == "*")
+        {
+            wildcard = isAllowed;
+        }
+    }
+
+    return listed.value_or(wildcard.value_or(false));
+}
+
+auto Compression::choose( std::string_view acceptEncoding ) -> Encoding
+{
+    for (auto encoding : {Encoding::kBrotli, Encoding::kGzip, Encoding::kDeflate})
+    {
+        if (isSupported(encoding) && isAccepted(acceptEncoding, encoding))
+        {
+            return encoding;
+        }
+    }
+    return Encoding::kIdentity;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/* Content codings shared by static assets and API responses.
+ * Codecs follow cpp-httplib's build: gzip and deflate need CPPHTTPLIB_ZLIB_SUPPORT,
+ * brotli needs CPPHTTPLIB_BROTLI_SUPPORT, otherwise compress() gives up.
+ */
+class Compression final
+{
+public:
+    enum struct Encoding
+    {
+        kIdentity,
+        kGzip,
+        kDeflate,
+        kBrotli,
+    };
+
+    static auto isSupported( const Encoding encoding ) -> bool;
+    static auto getName( const Encoding encoding ) -> std::string_view;
+
+    // Empty result means the codec is missing or failed, caller keeps the plain body
+    static auto compress( std::string_view data, const Encoding encoding, const int level = -1 ) -> std::string;
+
+    // Whether Accept-Encoding lists the coding (or '*') without q=0
+    static auto isAccepted( std::string_view acceptEncoding, const Encoding encoding ) -> bool;
+    // Smallest output first: br, gzip, deflate, identity when the client takes none of them
+    static auto choose( std::string_view acceptEncoding ) -> Encoding;
+};
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include <spdlog/spdlog.h>
+
+#include "config.h"
+
+namespace
+{
+    enum struct Kind
+    {
+        kString,
+        kInteger,
+        kBool
+    };
+
+    struct Option
+    {
+        // Path in the config file, as a JSON pointer
+        std::string_view key;
+        std::string_view flag;
+        Kind kind;
+        void (*set)( ServerConfig &config, const nlohmann::json &value );
+    };
+
+    template <typename T>
+    auto toCount( const nlohmann::json &value ) -> T
+    {
+        if (value.get<int64_t>() < 0)
+        {
+            throw std::invalid_argument("must not be negative");
+        }
+        return value.get<T>();
+    }
+
+    const std::array<Option, 21> kOptions = {{
+        {"/host", "--host", Kind::kString, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.host = value.get<std::string>();
+        }},
+        {"/port", "--port", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.port = value.get<int>();
+        }},
+        {"/database", "--db", Kind::kString, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.database = value.get<std::string>();
+        }},
+        {"/dev", "--dev", Kind::kBool, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.devMode = value.get<bool>();
+        }},
+        {"/log_level", "--log-level", Kind::kString, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.logLevel = value.get<std::string>();
+        }},
+        {"/http/threads", "--threads", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.threads = toCount<size_t>(value);
+        }},
+        {"/http/max_queued_requests", "--max-queued", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.maxQueuedRequests = toCount<size_t>(value);
+        }},
+        {"/http/max_streams", "--max-streams", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.maxStreams = toCount<size_t>(value);
+        }},
+        {"/http/keep_alive_max_count", "--keep-alive-max", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.keepAliveMaxCount = toCount<size_t>(value);
+        }},
+        {"/http/keep_alive_timeout_s", "--keep-alive-timeout", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.keepAliveTimeout = std::chrono::seconds(toCount<int64_t>(value));
+        }},
+        {"/http/read_timeout_s", "--read-timeout", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.readTimeout = std::chrono::seconds(toCount<int64_t>(value));
+        }},
+        {"/http/write_timeout_s", "--write-timeout", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.writeTimeout = std::chrono::seconds(toCount<int64_t>(value));
+        }},
+        {"/http/max_body_bytes", "--max-body", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.maxBodySize = toCount<size_t>(value);
+        }},
+        {"/http/compression_level", "--compress-level", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.compressionLevel = toCount<int>(value);
+        }},
+        {"/http/compression_min_bytes", "--compress-min-bytes", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.compressionMinBytes = toCount<size_t>(value);
+        }},
+        {"/sqlite/cache_kib", "--sqlite-cache", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.sqliteCacheKiB = toCount<int64_t>(value);
+        }},
+        {"/sqlite/mmap_bytes", "--sqlite-mmap", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.sqliteMmapSize = toCount<int64_t>(value);
+        }},
+        {"/auth/workers", "--auth-workers", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.authWorkers = toCount<size_t>(value);
+        }},
+        {"/auth/queue", "--auth-queue", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            config.authQueue = toCount<size_t>(value);
+        }},
+        {"/auth/kdf_iterations", "--kdf-iterations", Kind::kInteger, []( ServerConfig &config, const nlohmann::json &value ) {
+            if (value.get<int64_t>() > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::invalid_argument("is too large");
+            }
+            config.kdfIterations = toCount<uint32_t>(value);
+        }},
+        // Handled before the other flags, only here so the file can not set it
+        {"", "--config", Kind::kString, nullptr},
+    }};
+
+    auto isKind( const nlohmann::json &value, const Kind kind ) -> bool
+    {
+        switch (kind)
+        {
+        case Kind::kString:
+            return value.is_string();
+        case Kind::kInteger:
+            return value.is_number_integer();
+        case Kind::kBool:
+        default:
+            return value.is_boolean();
+        }
+    }
+
+    void setOption( ServerConfig &config, const Option &option, const nlohmann::json &value, std::string_view name )
+    {
+        if (!isKind(value, option.kind))
+        {
+            throw std::invalid_argument("Config option '" + std::string(name) + "' has a wrong type!");
+        }
+
+        try
+        {
+            option.set(config, value);
+        }
+        catch ( const std::exception &e )
+        {
+            throw std::invalid_argument("Config option '" + std::string(name) + "' " + e.what() + "!");
+        }
+    }
+
+    auto parseFlagValue( const Option &option, const std::string &text ) -> nlohmann::json
+    {
+        if (option.kind == Kind::kString)
+        {
+            return text;
+        }
+
+        size_t parsed = 0;
+        int64_t number = 0;
+
+        try
+        {
+            number = std::stoll(text, &parsed);
+        }
+        catch ( const std::exception & )
+        {
+            parsed = 0;
+        }
+
+        if (parsed == 0 || parsed != text.size())
+        {
+            throw std::invalid_argument("Option " + std::string(option.flag) + " expects a number, got '" + text + "'!");
+        }
+
+        return number;
+    }
+}
+
+auto ServerConfig::fromArgs( int argc, char *argv[] ) -> ServerConfig
+{
+    ServerConfig config;
+
+    if (const char *level = std::getenv("SPDLOG_LEVEL"); level != nullptr)
+    {
+        config.logLevel = level;
+    }
+
+    // The file goes first so flags override it wherever they are
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string_view(argv[i]) != "--config")
+        {
+            continue;
+        }
+        if (++i >= argc)
+        {
+            throw std::invalid_argument("Option --config expects a file!");
+        }
+
+        std::ifstream file(argv[i]);
+
+        if (!file)
+        {
+            throw std::invalid_argument("Can not open config file '" + std::string(argv[i]) + "'!");
+        }
+
+        auto json = nlohmann::json::parse(file, nullptr, false);
+
+        if (json.is_discarded() || !json.is_object())
+        {
+            throw std::invalid_argument("Config file '" + std::string(argv[i]) + "' is not a JSON object!");
+        }
+
+        config.apply(json);
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view flag(argv[i]);
+        auto it = std::find_if(kOptions.begin(), kOptions.end(), [&]( const Option &option ) {
+            return option.flag == flag;
+        });
+
+        if (it == kOptions.end())
+        {
+            throw std::invalid_argument("Unknown option " + std::string(flag) + "!");
+        }
+
+        if (it->kind == Kind::kBool)
+        {
+            setOption(config, *it, true, flag);
+            continue;
+        }
+        if (++i >= argc)
+        {
+            throw std::invalid_argument("Option " + std::string(flag) + " expects a value!");
+        }
+        if (it->set != nullptr)
+        {
+            setOption(config, *it, parseFlagValue(*it, argv[i]), flag);
+        }
+    }
+
+    config.validate();
+    return config;
+}
+
+void ServerConfig::apply( const nlohmann::json &json )
+{
+    auto flat = json.flatten();
+
+    for (const auto &[key, value] : flat.items())
+    {
+        auto it = std::find_if(kOptions.begin(), kOptions.end(), [&]( const Option &option ) {
+            return option.set != nullptr && option.key == key;
+        });
+
+        if (it == kOptions.end())
+        {
+            throw std::invalid_argument("Unknown config option '" + key + "'!");
+        }
+
+        setOption(*this, *it, value, key);
+    }
+}
+
+void ServerConfig::validate( void ) const
+{
+    auto check = []( const bool isValid, const std::string &message ) {
+        if (!isValid)
+        {
+            throw std::invalid_argument(message);
+        }
+    };
+
+    check(!host.empty(), "Host must not be empty!");
+    check(port > 0 && port < 65536, "Port must be in [1, 65535]!");
+    check(!database.empty(), "Database file must not be empty!");
+    check(spdlog::level::from_str(logLevel) != spdlog::level::off || logLevel == "off",
+          "Unknown log level '" + logLevel + "'!");
+    check(threads >= 1 && threads <= 1024, "Thread count must be in [1, 1024]!");
+    check(maxStreams >= 1 && maxStreams <= 4096, "Max streams must be in [1, 4096]!");
+    check(keepAliveMaxCount >= 1, "Keep-alive max count must be at least 1!");
+    check(keepAliveTimeout.count() >= 1, "Keep-alive timeout must be at least 1 second!");
+    check(readTimeout.count() >= 1 && writeTimeout.count() >= 1, "Read and write timeouts must be at least 1 second!");
+    check(maxBodySize >= 1024, "Max body size must be at least 1024 bytes!");
+    check(compressionLevel >= 0 && compressionLevel <= 9, "Compression level must be in [0, 9]!");
+    check(authWorkers >= 1 && authWorkers <= threads, "Auth workers must be in [1, threads]!");
+    check(kdfIterations >= Password::kMinIterations,
+          "KDF iterations must be at least " + std::to_string(Password::kMinIterations) + "!");
+}
+
+auto ServerConfig::toJson( void ) const -> nlohmann::json
+{
+    return {
+        {"host", host},
+        {"port", port},
+        {"database", database},
+        {"dev", devMode},
+        {"log_level", logLevel},
+        {"http", {
+            {"threads", threads},
+            {"max_queued_requests", maxQueuedRequests},
+            {"max_streams", maxStreams},
+            {"keep_alive_max_count", keepAliveMaxCount},
+            {"keep_alive_timeout_s", keepAliveTimeout.count()},
+            {"read_timeout_s", readTimeout.count()},
+            {"write_timeout_s", writeTimeout.count()},
+            {"max_body_bytes", maxBodySize},
+            {"compression_level", compressionLevel},
+            {"compression_min_bytes", compressionMinBytes}
+        }},
+        {"sqlite", {
+            {"cache_kib", sqliteCacheKiB},
+            {"mmap_bytes", sqliteMmapSize}
+        }},
+        {"auth", {
+            {"workers", authWorkers},
+            {"queue", authQueue},
+            {"kdf_iterations", kdfIterations}
+        }}
+    };
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+#include "password.h"
+
+/* Everything main() used to hardcode. Built from defaults, then SPDLOG_LEVEL,
+ * then the --config JSON file, then the other command line flags:
+ *
+ *   server [--config FILE] [--host HOST] [--port PORT] [--db FILE] [--dev] [--log-level LEVEL]
+ *          [--threads N] [--max-queued N] [--max-streams N] [--keep-alive-max N] [--keep-alive-timeout S]
+ *          [--read-timeout S] [--write-timeout S] [--max-body BYTES]
+ *          [--compress-level N] [--compress-min-bytes BYTES]
+ *          [--sqlite-cache KIB] [--sqlite-mmap BYTES]
+ *          [--auth-workers N] [--auth-queue N] [--kdf-iterations N]
+ *
+ * The file uses the keys of toJson(), e.g. {"port": 8080, "http": {"threads": 16}}.
+ */
+struct ServerConfig
+{
+    std::string host = "0.0.0.0";
+    int port = 8080;
+    std::string database = "chat.db";
+    // Re-read public files on change instead of serving the startup copy
+    bool devMode = false;
+    std::string logLevel = "info";
+
+    // httplib workers, also the number of SQLite readers
+    size_t threads = CPPHTTPLIB_THREAD_POOL_COUNT;
+    // Accepted connections waiting for a worker, 0 means no limit
+    size_t maxQueuedRequests = 0;
+    // Event streams and parked long polls, each one holds an extra worker while it lasts
+    size_t maxStreams = 256;
+    size_t keepAliveMaxCount = CPPHTTPLIB_KEEPALIVE_MAX_COUNT;
+    std::chrono::seconds keepAliveTimeout {CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND};
+    std::chrono::seconds readTimeout {CPPHTTPLIB_SERVER_READ_TIMEOUT_SECOND};
+    std::chrono::seconds writeTimeout {CPPHTTPLIB_SERVER_WRITE_TIMEOUT_SECOND};
+    size_t maxBodySize = 1 << 20;
+    // JSON responses from this size on are compressed with br/gzip/deflate, level 0 turns it off
+    int compressionLevel = 5;
+    size_t compressionMinBytes = 1024;
+
+    // Per connection page cache and memory map
+    int64_t sqliteCacheKiB = 2000;
+    int64_t sqliteMmapSize = 0;
+
+    // Login and registration run on their own pool, beyond workers + queue they get 503 right away
+    size_t authWorkers = 2;
+    size_t authQueue = 4;
+    uint32_t kdfIterations = Password::kDefaultIterations;
+
+    // Throws std::invalid_argument naming the offending option
+    static auto fromArgs( int argc, char *argv[] ) -> ServerConfig;
+
+    void apply( const nlohmann::json &json );
+    void validate( void ) const;
+    auto toJson( void ) const -> nlohmann::json;
+};
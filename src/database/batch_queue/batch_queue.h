@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/* Bounded multi-producer queue drained in batches by a single consumer.
+ * Producers block while the queue is full. The consumer takes everything
+ * that is ready, then waits up to maxLatency for the batch to fill up.
+ */
+template <typename T>
+class BatchQueue final
+{
+public:
+    explicit BatchQueue( const size_t capacity = 4096 ) : _capacity(std::max<size_t>(capacity, 1)) {}
+
+    auto push( T item ) -> bool
+    {
+        std::unique_lock lock(_mutex);
+
+        _notFull.wait(lock, [&] {return _stopped || _items.size() < _capacity;});
+        if (_stopped)
+        {
+            return false;
+        }
+
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    // False only when the queue is shut down and nothing is left in it
+    auto popBatch( std::vector<T> &batch, const size_t maxBatch, const std::chrono::microseconds maxLatency ) -> bool
+    {
+        std::unique_lock lock(_mutex);
+
+        _notEmpty.wait(lock, [&] {return _stopped || !_items.empty();});
+        if (_items.empty())
+        {
+            return false;
+        }
+
+        if (_items.size() < maxBatch && maxLatency.count() > 0)
+        {
+            _notEmpty.wait_for(lock, maxLatency, [&] {return _stopped || _items.size() >= maxBatch;});
+        }
+
+        size_t count = std::min(maxBatch, _items.size());
+
+        for (size_t i = 0; i < count; i++)
+        {
+            batch.push_back(std::move(_items.front()));
+            _items.pop_front();
+        }
+
+        _notFull.notify_all();
+        return true;
+    }
+
+    void shutdown( void )
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+    }
+
+    auto getSize( void ) const -> size_t
+    {
+        std::lock_guard lock(_mutex);
+        return _items.size();
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::deque<T> _items;
+    size_t _capacity;
+    bool _stopped {};
+};
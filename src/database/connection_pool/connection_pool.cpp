@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <utility>
+
+#include "connection_pool.h"
+
+Connection::Connection( const std::string &name, const int flags, const int busyTimeoutMs ) :
+    db(name, flags, busyTimeoutMs), statements(db) {}
+
+ConnectionPool::Lease::Lease( ConnectionPool &pool, Connection &connection ) :
+    _pool(&pool), _connection(&connection) {}
+
+ConnectionPool::Lease::Lease( Lease &&other ) noexcept :
+    _pool(other._pool), _connection(std::exchange(other._connection, nullptr)) {}
+
+ConnectionPool::Lease::~Lease( void )
+{
+    if (_connection)
+    {
+        _pool->_release(*_connection);
+    }
+}
+
+auto ConnectionPool::Lease::operator ->( void ) const -> Connection *
+{
+    return _connection;
+}
+
+ConnectionPool::ConnectionPool( const std::string &name, const size_t size, const int busyTimeoutMs,
+                                const std::string &setupSql )
+{
+    for (size_t i = 0; i < std::max<size_t>(size, 1); i++)
+    {
+        _connections.push_back(std::make_unique<Connection>(name, SQLite::OPEN_READONLY, busyTimeoutMs));
+        if (!setupSql.empty())
+        {
+            _connections.back()->db.exec(setupSql);
+        }
+        _free.push_back(_connections.back().get());
+    }
+}
+
+auto ConnectionPool::acquire( void ) -> Lease
+{
+    std::unique_lock lock(_mutex);
+
+    _cv.wait(lock, [&] {return !_free.empty();});
+
+    Connection *connection = _free.back();
+
+    _free.pop_back();
+    return Lease(*this, *connection);
+}
+
+void ConnectionPool::_release( Connection &connection )
+{
+    {
+        std::lock_guard lock(_mutex);
+        _free.push_back(&connection);
+    }
+    _cv.notify_one();
+}
+
+auto ConnectionPool::getSize( void ) const -> size_t
+{
+    return _connections.size();
+}
+
+auto ConnectionPool::getStatementStats( void ) const -> StatementCache::Stats
+{
+    StatementCache::Stats total {};
+
+    for (const auto &connection : _connections)
+    {
+        auto stats = connection->statements.getStats();
+
+        total.prepared += stats.prepared;
+        total.reused += stats.reused;
+        total.size += stats.size;
+    }
+
+    return total;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "statement_cache.h"
+
+struct Connection
+{
+    SQLite::Database db;
+    StatementCache statements;
+
+    Connection( const std::string &name, const int flags, const int busyTimeoutMs );
+};
+
+/* Fixed set of read-only connections.
+ * A thread checks one out for a single Database call, so with as many
+ * connections as worker threads every worker effectively owns one.
+ * Never acquire a second lease while holding one.
+ */
+class ConnectionPool final
+{
+public:
+    class Lease final
+    {
+    public:
+        Lease( ConnectionPool &pool, Connection &connection );
+        Lease( Lease &&other ) noexcept;
+        Lease( const Lease & ) = delete;
+        ~Lease( void );
+
+        auto operator ->( void ) const -> Connection *;
+
+    private:
+        ConnectionPool *_pool;
+        Connection *_connection;
+    };
+
+    // setupSql runs on every connection once it is opened, e.g. per connection pragmas
+    ConnectionPool( const std::string &name, const size_t size, const int busyTimeoutMs, const std::string &setupSql = "" );
+
+    auto acquire( void ) -> Lease;
+
+    auto getSize( void ) const -> size_t;
+    auto getStatementStats( void ) const -> StatementCache::Stats;
+
+private:
+    std::vector<std::unique_ptr<Connection>> _connections;
+    std::vector<Connection *> _free;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+
+    void _release( Connection &connection );
+};
@@ -1,18 +1,182 @@
+#include <cerrno>
+#include <cstring>
+#include <limits>
 #include <random>
 
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
 #include <sqlite3.h>
 
 #include "database.h"
 #include "sha256.h"
 
-Database::Database( const std::string &name ) : 
-    _db(name, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)
+namespace
+{
+    void fillFromSystem( uint8_t *data, size_t size )
+    {
+#ifdef __linux__
+        while (size > 0)
+        {
+            ssize_t read = getrandom(data, size, 0);
+
+            if (read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("getrandom failed: ") + std::strerror(errno));
+            }
+            data += read;
+            size -= static_cast<size_t>(read);
+        }
+#else
+        // OS CSPRNG on the other platforms we build for (rand_s on Windows)
+        thread_local std::random_device device;
+
+        for (size_t i = 0; i < size; i += sizeof(unsigned int))
+        {
+            unsigned int value = device();
+
+            std::memcpy(data + i, &value, std::min(sizeof(value), size - i));
+        }
+#endif
+    }
+
+    // Refilled from the OS a page at a time, so most tokens cost no system call
+    void fillRandom( uint8_t *data, const size_t size )
+    {
+        thread_local std::array<uint8_t, 4096> pool;
+        thread_local size_t used = pool.size();
+
+        if (size > pool.size())
+        {
+            fillFromSystem(data, size);
+            return;
+        }
+        if (pool.size() - used < size)
+        {
+            fillFromSystem(pool.data(), pool.size());
+            used = 0;
+        }
+
+        std::memcpy(data, pool.data() + used, size);
+        // Handed out bytes must not stay around for anyone to read later
+        std::memset(pool.data() + used, 0, size);
+        used += size;
+    }
+
+    // Same order as Database::Query
+    constexpr std::array<std::string_view, 16> kQueryNames = {
+        "addUser", "findToken", "addToken", "loginUser", "logoutUser", "updatePassword", "getAllUsers",
+        "getUserByLogin", "getUserById", "writeMessages", "queryMessages", "flushPresence", "rooms", "loadRoom",
+        "searchMessages", "backfillSearch",
+    };
+
+    constexpr size_t kMaxSearchTerms = 16;
+
+    auto isSpace( const char c ) -> bool
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Every word is quoted, so nothing the user types is FTS5 syntax. The last one is a prefix for typing
+    auto toMatchQuery( std::string_view text ) -> std::string
+    {
+        std::string match;
+        size_t terms = 0;
+        size_t i = 0;
+
+        while (terms < kMaxSearchTerms)
+        {
+            while (i < text.size() && isSpace(text[i]))
+            {
+                i++;
+            }
+            if (i == text.size())
+            {
+                break;
+            }
+
+            if (!match.empty())
+            {
+                match += ' ';
+            }
+            match += '"';
+            for (; i < text.size() && !isSpace(text[i]); i++)
+            {
+                if (text[i] == '"')
+                {
+                    match += '"';
+                }
+                match += text[i];
+            }
+            match += '"';
+            terms++;
+        }
+
+        if (!match.empty())
+        {
+            match += '*';
+        }
+        return match;
+    }
+
+    // Pages walk (room_id, id) from the cursor, so a page costs the same at any depth and in any room
+    constexpr std::string_view kMessagesBeforeSql = R"(
+            SELECT m.*, u.login as login,
+            u.first_name as first_name, u.last_name as last_name
+            FROM messages m 
+            LEFT JOIN users u ON m.user_id = u.id 
+            WHERE m.room_id = ? AND m.id < ?
+            ORDER BY m.id DESC
+            LIMIT ?
+        )";
+
+    constexpr std::string_view kMessagesAfterSql = R"(
+            SELECT m.*, u.login as login,
+            u.first_name as first_name, u.last_name as last_name
+            FROM messages m 
+            LEFT JOIN users u ON m.user_id = u.id 
+            WHERE m.room_id = ? AND m.id > ?
+            ORDER BY m.id
+            LIMIT ?
+        )";
+
+    // Unknown room ids are remembered for a while, so probing them does not cost a query each time
+    constexpr std::chrono::seconds kMissingRoomTtl {1};
+    constexpr size_t kMissingRoomsMax = 4096;
+}
+
+Database::Database( const std::string &name, const DatabaseOptions &options ) : 
+    _writer(name, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE, options.busyTimeoutMs),
+    _recentMessages(std::max<size_t>(options.recentMessages, 1)),
+    _roomRecentMessages(std::max<size_t>(options.roomRecentMessages, 1)), _roomLoaded(options.roomLoaded),
+    _passwordIterations(std::max<uint32_t>(options.passwordIterations, 1)),
+    _pending(options.writeQueue),
+    _maxBatch(std::max<size_t>(options.maxBatch, 1)), _maxBatchLatency(options.maxBatchLatency)
 {
+    static_assert(kQueryNames.size() == static_cast<size_t>(Query::kCount));
+
+    for (size_t i = 0; i < _timings.size(); i++)
+    {
+        _timings[i] = &_metrics.addTimer(kQueryNames[i]);
+    }
+
+    std::string connectionSql = "PRAGMA cache_size = -" + std::to_string(options.cacheSizeKiB) + ";" +
+                                "PRAGMA mmap_size = " + std::to_string(options.mmapSize) + ";";
+
     try
     {
-        _db.exec("PRAGMA foreign_keys = ON;");
+        // WAL lets readers work next to the single writer instead of waiting for it
+        _writer.db.exec("PRAGMA journal_mode = WAL;");
+        _writer.db.exec("PRAGMA synchronous = NORMAL;");
+        _writer.db.exec("PRAGMA foreign_keys = ON;");
+        _writer.db.exec(connectionSql);
 
-        _db.exec(R"(
+        _writer.db.exec(R"(
                 CREATE TABLE IF NOT EXISTS users (
                 id INTEGER PRIMARY KEY AUTOINCREMENT,
                 login TEXT UNIQUE NOT NULL,
@@ -22,72 +186,200 @@ Database::Database( const std::string &name ) :
                 is_online BOOLEAN
             ))");
 
-        _db.exec("UPDATE users SET is_online = false");
+        _writer.db.exec("UPDATE users SET is_online = false");
+
+        _writer.db.exec(R"(
+                CREATE TABLE IF NOT EXISTS rooms (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                name TEXT UNIQUE NOT NULL,
+                owner_id INTEGER,
+                created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+                FOREIGN KEY (owner_id) REFERENCES users(id) ON DELETE SET NULL
+            ))");
+
+        _writer.db.exec("INSERT OR IGNORE INTO rooms (id, name) VALUES (" + std::to_string(kGeneralRoom) + ", 'general')");
+
+        _writer.db.exec(R"(
+                CREATE TABLE IF NOT EXISTS room_members (
+                room_id INTEGER NOT NULL,
+                user_id INTEGER NOT NULL,
+                joined_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+                PRIMARY KEY (room_id, user_id),
+                FOREIGN KEY (room_id) REFERENCES rooms(id) ON DELETE CASCADE,
+                FOREIGN KEY (user_id) REFERENCES users(id) ON DELETE CASCADE
+            ) WITHOUT ROWID)");
 
-        _db.exec(R"(
+        _writer.db.exec("CREATE INDEX IF NOT EXISTS idx_room_members_user_id ON room_members(user_id)");
+
+        // room_id has no foreign key, ALTER TABLE can not add one to the tables made before rooms.
+        // deleteRoom removes the messages itself
+        _writer.db.exec(R"(
                 CREATE TABLE IF NOT EXISTS messages (
                 id INTEGER PRIMARY KEY AUTOINCREMENT,
                 user_id INTEGER NOT NULL,
                 message_text TEXT NOT NULL,
                 timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+                room_id INTEGER NOT NULL DEFAULT 1,
                 FOREIGN KEY (user_id) REFERENCES users(id) ON DELETE CASCADE
             ))");
 
-        _db.exec(R"(DROP TABLE IF EXISTS auth_tokens)");
+        // Messages from before rooms all go to the general one
+        if (_writer.db.execAndGet("SELECT COUNT(*) FROM pragma_table_info('messages') WHERE name = 'room_id'").getInt() == 0)
+        {
+            _writer.db.exec("ALTER TABLE messages ADD COLUMN room_id INTEGER NOT NULL DEFAULT 1");
+        }
+
+        // Message pages walk (room_id, id), user_id is only for cascades from users
+        _writer.db.exec("CREATE INDEX IF NOT EXISTS idx_messages_room_id ON messages(room_id, id)");
+        _writer.db.exec("CREATE INDEX IF NOT EXISTS idx_messages_user_id ON messages(user_id)");
+
+        _setupSearch();
+
+        _writer.db.exec(R"(DROP TABLE IF EXISTS auth_tokens)");
 
-        _db.exec(R"(
+        _writer.db.exec(R"(
                 CREATE TABLE IF NOT EXISTS auth_tokens (
-                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                token_hash BLOB PRIMARY KEY NOT NULL,
                 user_id INTEGER NOT NULL,
-                token TEXT UNIQUE NOT NULL,
                 FOREIGN KEY (user_id) REFERENCES users(id) ON DELETE CASCADE
-            ))");
+            ) WITHOUT ROWID)");
+
+        _writer.db.exec("CREATE INDEX IF NOT EXISTS idx_auth_tokens_user_id ON auth_tokens(user_id)");
+
+        _usersCount = _writer.db.execAndGet("SELECT COUNT(*) FROM users").getInt();
+        _messagesCount = _writer.db.execAndGet("SELECT COUNT(*) FROM messages").getInt();
 
         spdlog::trace("Database and tables are created or opened successfully!");
     } 
     catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Create SQLite error: ") + e.what());
+        spdlog::error("Create SQLite error: {}", e.what());
+    }
+
+    // Readers are opened only when the schema and journal mode are in place
+    _readers = std::make_unique<ConnectionPool>(name, options.readers, options.busyTimeoutMs, connectionSql);
+
+    _rooms[kGeneralRoom] = _makeGeneralRoom();
+
+    _presenceFlusher = std::jthread([this, interval = options.presenceFlush]( std::stop_token stop ) {
+        std::unique_lock lock(_flushMutex);
+
+        while (!_flushCv.wait_for(lock, stop, interval, [] {return false;}) && !stop.stop_requested())
+        {
+            flushPresence();
+        }
+    });
+
+    if (_isSearchEnabled && _searchIndexedThrough < _searchBacklogEnd)
+    {
+        _searchBackfiller = std::jthread([this, chunk = std::max<size_t>(options.searchBackfillChunk, 1),
+                                          pause = options.searchBackfillPause]( std::stop_token stop ) {
+            std::unique_lock lock(_backfillMutex);
+
+            spdlog::info("Indexing messages up to {} for search", _searchBacklogEnd.load());
+            while (!stop.stop_requested() && backfillSearch(chunk))
+            {
+                // Every chunk lets go of the write lock, the pause gives posts a fair chance at it
+                _backfillCv.wait_for(lock, stop, pause, [] {return false;});
+            }
+        });
     }
+
+    _messageWriter = std::jthread([this] {
+        std::vector<PendingMessage> batch;
+
+        while (_pending.popBatch(batch, _maxBatch, _maxBatchLatency))
+        {
+            _writeMessages(batch);
+            batch.clear();
+        }
+    });
 }
 
-auto Database::generateToken( const int len ) -> std::string
+void Database::_setupSearch( void )
 {
-    const std::string characters = 
-        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-    
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<> distribution(0, characters.size() - 1);
-    
-    std::string token;
+    try
+    {
+        // Created together with its backlog, so a crash in between can not lose the old messages
+        SQLite::Transaction transaction(_writer.db);
+        bool isNew = _writer.db.execAndGet("SELECT COUNT(*) FROM sqlite_master WHERE name = 'messages_fts'").getInt() == 0;
+
+        // External content: the index keeps only terms, text and snippets are read from messages
+        _writer.db.exec(R"(
+                CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5(
+                message_text,
+                content = 'messages',
+                content_rowid = 'id',
+                tokenize = 'unicode61 remove_diacritics 2'
+            ))");
+
+        _writer.db.exec(R"(
+                CREATE TABLE IF NOT EXISTS search_backfill (
+                id INTEGER PRIMARY KEY CHECK (id = 1),
+                indexed_through INTEGER NOT NULL,
+                backlog_end INTEGER NOT NULL
+            ))");
 
-    for (int i = 0; i < len; i++) 
+        // Messages from now on are indexed as they are written, the ones already stored by backfillSearch
+        if (isNew)
+        {
+            _writer.db.exec(R"(
+                INSERT OR REPLACE INTO search_backfill (id, indexed_through, backlog_end)
+                SELECT 1, 0, MAX(id) FROM messages HAVING MAX(id) IS NOT NULL
+            )");
+        }
+
+        SQLite::Statement state(_writer.db, "SELECT indexed_through, backlog_end FROM search_backfill");
+
+        if (state.executeStep())
+        {
+            _searchIndexedThrough = state.getColumn(0).getInt();
+            _searchBacklogEnd = state.getColumn(1).getInt();
+        }
+        state.reset();
+
+        transaction.commit();
+        _isSearchEnabled = true;
+    }
+    catch ( const std::exception &e )
     {
-        token += characters[distribution(generator)];
+        spdlog::warn("Message search is off, SQLite has no FTS5: {}", e.what());
     }
+}
+
+auto Database::generateToken( void ) -> std::string
+{
+    std::array<uint8_t, kTokenBytes> bytes;
 
-    return token;
+    fillRandom(bytes.data(), bytes.size());
+    return toHex(bytes.data(), bytes.size());
 }
 
 auto Database::addUser( const User &user ) -> Error
 {
+    auto timer = _time(Query::kAddUser);
+
     Error err;
 
     try
     {
-        SQLite::Statement query(_db, R"(
+        // Hashed before the lock, it is the slow part
+        std::string password = _hashPassword(user.password);
+        std::lock_guard lock(_writeMutex);
+        auto query = _writer.statements.get(R"(
             INSERT INTO users (login, password, first_name, last_name, is_online) VALUES (?, ?, ?, ?, ?)
         )");
 
-        query.bind(1, user.login);
-        query.bind(2, SHA256(user.password));
-        query.bind(3, user.firstName);
-        query.bind(4, user.lastName);
-        query.bind(5, false);
+        query->bind(1, user.login);
+        query->bind(2, password);
+        query->bind(3, user.firstName);
+        query->bind(4, user.lastName);
+        query->bind(5, false);
+
+        query->exec();
+        _usersCount++;
 
-        query.exec();
-        spdlog::info(std::string("User with login '") + user.login + "' has just registered!");
+        spdlog::info("User with login '{}' has just registered!", user.login);
     }
     catch ( const SQLite::Exception &e )
     {
@@ -110,54 +402,59 @@ auto Database::addUser( const User &user ) -> Error
     return err;
 }
 
-auto Database::_findToken( const std::string &token ) const -> std::optional<Token>
+auto Database::_findToken( const TokenHash &hash ) const -> std::optional<int>
 {
+    auto timer = _time(Query::kFindToken);
+
     try
     {
-        SQLite::Statement query(_db, R"(
-            SELECT * FROM auth_tokens WHERE token = ?
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get(R"(
+            SELECT user_id FROM auth_tokens WHERE token_hash = ?
         )");
 
-        query.bind(1, token);
+        query->bindNoCopy(1, hash.data(), static_cast<int>(hash.size()));
 
-        if (query.executeStep())
+        if (query->executeStep())
         {
-            Token tok;
-
-            tok.id = query.getColumn("id");
-            tok.userId = query.getColumn("user_id");
-            tok.token = query.getColumn("token").getString();
-
-            return tok;
+            return query->getColumn(0).getInt();
         }
     }
     catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Error while find token: ") + e.what());
+        spdlog::error("Error while find token: {}", e.what());
     }
 
     return std::nullopt;
 }
 
+auto Database::_hashToken( const std::string &token ) -> TokenHash
+{
+    return SHA256Digest(token.data(), token.size());
+}
+
 auto Database::isTokenExists( const std::string &token ) -> bool
 {
-    return static_cast<bool>(_findToken(SHA256(token)));
+    return static_cast<bool>(_resolveToken(token));
 }
 
-auto Database::_addToken( const Token &token ) -> Error
+auto Database::_addToken( const TokenHash &hash, const int userId ) -> Error
 {
+    auto timer = _time(Query::kAddToken);
+
     Error err;
 
     try
     {
-        SQLite::Statement query(_db, R"(
-            INSERT INTO auth_tokens (user_id, token) VALUES (?, ?)
+        std::lock_guard lock(_writeMutex);
+        auto query = _writer.statements.get(R"(
+            INSERT INTO auth_tokens (token_hash, user_id) VALUES (?, ?)
         )");
 
-        query.bind(1, token.userId);
-        query.bind(2, SHA256(token.token));
+        query->bindNoCopy(1, hash.data(), static_cast<int>(hash.size()));
+        query->bind(2, userId);
 
-        query.exec();
+        query->exec();
     }
     catch ( const std::exception &e )
     {
@@ -168,8 +465,43 @@ auto Database::_addToken( const Token &token ) -> Error
     return err;
 }
 
+auto Database::_hashPassword( const std::string &password ) const -> std::string
+{
+    std::array<uint8_t, Password::kSaltBytes> salt;
+
+    fillRandom(salt.data(), salt.size());
+    return Password::hash(password, salt.data(), salt.size(), _passwordIterations);
+}
+
+void Database::_updatePassword( const int userId, const std::string &password )
+{
+    std::string hash = _hashPassword(password);
+    auto timer = _time(Query::kUpdatePassword);
+
+    // The login already succeeded, a failed upgrade is retried on the next one
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        auto query = _writer.statements.get(R"(
+            UPDATE users SET password = ? WHERE id = ?
+        )");
+
+        query->bind(1, hash);
+        query->bind(2, userId);
+        query->exec();
+
+        spdlog::debug("Password of user {} is rehashed with {} iterations", userId, _passwordIterations);
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::warn("Can not rehash password of user {}: {}", userId, e.what());
+    }
+}
+
 auto Database::loginUser( const std::string &login, const std::string &password ) -> std::pair<Token, Error>
 {
+    auto timer = _time(Query::kLoginUser);
+
     auto user = getUserByLogin(login);
     Error err;
 
@@ -183,25 +515,28 @@ auto Database::loginUser( const std::string &login, const std::string &password
     }
 
     // Check password
-    if (SHA256(password) != user.value().password)
+    auto verdict = Password::verify(password, user.value().password, _passwordIterations);
+
+    if (verdict == Password::Verdict::kMismatch)
     {
         err = true;
         err.message = "Incorrect password!";
         err.errorId = 401;
         return {{}, err};
     }
+    if (verdict == Password::Verdict::kOutdated)
+    {
+        _updatePassword(user.value().id, password);
+    }
 
     // Add auth token to database
     Token token;
 
+    // 256 random bits, a collision is not worth a lookup
     token.userId = user.value().id;
+    token.token = generateToken();
 
-    do
-    {
-        token.token = generateToken(64);
-    } while (_findToken(SHA256(token.token)));
-
-    err = _addToken(token);
+    err = _addToken(_hashToken(token.token), token.userId);
 
     if (err)
     {
@@ -209,60 +544,37 @@ auto Database::loginUser( const std::string &login, const std::string &password
         return {{}, err};
     }
 
-    // Set user online to 1
-    try
-    {
-        SQLite::Statement query(_db, R"(
-            UPDATE users set is_online = true WHERE id = ?
-        )");
-
-        query.bind(1, user.value().id);
+    User sessionUser = user.value();
 
-        query.exec();
-    }
-    catch ( const std::exception &e )
-    {
-        err = true;
-        err.message = e.what();
-        err.errorId = 500;
-        return {{}, err};
-    }
+    sessionUser.isOnline = true;
+    _presence.join(sessionUser);
+    _sessions.insert(token.token, sessionUser);
 
-    spdlog::info("User with login " + user.value().login + " has just signed in!");
+    spdlog::info("User with login {} has just signed in!", user.value().login);
     return {token, err};
 }
 
 auto Database::logoutUser( const std::string &token ) -> Error
 {
-    auto tokOpt = _findToken(SHA256(token));
-    Error err;
-
-    if (!tokOpt)
-    {
-        err = true;
-        err.message = "Unknown auth token!";
-        err.errorId = 401;
-        return err;
-    }
+    auto timer = _time(Query::kLogoutUser);
 
-    Token tok = tokOpt.value();
+    auto hash = _hashToken(token);
+    std::optional<int> userId;
+    Error err;
 
     try
     {
-        // Set user online to 0
-        SQLite::Statement query(_db, R"(
-            UPDATE users set is_online = false WHERE id = ?
-        )");
-
-        query.bind(1, tok.userId);
-        query.exec();
-
-        // Remove token from base
-        query = SQLite::Statement(_db, R"(
-            DELETE FROM auth_tokens WHERE token = ?
+        // One statement both checks the token and removes it
+        std::lock_guard lock(_writeMutex);
+        auto deleteQuery = _writer.statements.get(R"(
+            DELETE FROM auth_tokens WHERE token_hash = ? RETURNING user_id
         )");
 
-        query.bind(1, tok.token);
+        deleteQuery->bindNoCopy(1, hash.data(), static_cast<int>(hash.size()));
+        if (deleteQuery->executeStep())
+        {
+            userId = deleteQuery->getColumn(0).getInt();
+        }
     }
     catch ( const std::exception &e )
     {
@@ -272,50 +584,72 @@ auto Database::logoutUser( const std::string &token ) -> Error
         return err;
     }
 
-    spdlog::info("User with id " + std::to_string(tok.userId) + " has just signed out!");
+    if (!userId)
+    {
+        err = true;
+        err.message = "Unknown auth token!";
+        err.errorId = 401;
+        return err;
+    }
+
+    _sessions.erase(token);
+    _presence.leave(userId.value());
+
+    spdlog::info("User with id {} has just signed out!", userId.value());
     return err;
 }
 
-auto Database::getUserByToken( const std::string &token ) const -> std::optional<User>
+auto Database::_resolveToken( const std::string &token ) const -> std::optional<User>
 {
-    auto tokOpt = _findToken(SHA256(token));
-    Error err;
+    if (auto user = _sessions.find(token))
+    {
+        user.value().isOnline = _presence.isOnline(user.value().id);
+        return user;
+    }
 
-    if (!tokOpt)
+    auto userId = _findToken(_hashToken(token));
+
+    if (!userId)
     {
-        spdlog::warn("Token " + token + " does not exist!");
         return std::nullopt;
     }
 
-    Token tok = tokOpt.value();
-    return getUserById(tok.userId);
+    auto user = getUserById(userId.value());
+
+    if (user)
+    {
+        user.value().password.clear();
+        _sessions.insert(token, user.value());
+    }
+
+    return user;
+}
+
+auto Database::getUserByToken( const std::string &token ) const -> std::optional<User>
+{
+    // Callers report unknown tokens, a client can send them at any rate
+    return _resolveToken(token);
 }
 
 auto Database::getAllUsers( void ) const -> std::vector<User>
 {
+    auto timer = _time(Query::kGetAllUsers);
+
     std::vector<User> users;
 
     try
     {
-        SQLite::Statement query(_db, "SELECT * FROM users");
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get("SELECT * FROM users");
             
-        while (query.executeStep())
+        while (query->executeStep())
         {
-            User user;
-
-            user.id = query.getColumn("id");
-            user.login = query.getColumn("login").getString();
-            user.password = query.getColumn("password").getString();
-            user.firstName = query.getColumn("first_name").getString();
-            user.lastName = query.getColumn("last_name").getString();
-            user.isOnline = (int)query.getColumn("is_online");
-
-            users.emplace_back(user);
+            users.emplace_back(_readUser(*query));
         }
     }
     catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Error while get all users: ") + e.what());
+        spdlog::error("Error while get all users: {}", e.what());
     }
 
     return users;
@@ -325,55 +659,58 @@ auto Database::getOnlineUsers( void ) const -> std::vector<User>
 {
     std::vector<User> users;
 
-    try
-    {
-        SQLite::Statement query(_db, "SELECT * FROM users WHERE is_online = true");
-            
-        while (query.executeStep())
-        {
-            User user;
+    _presence.getOnline(users);
+    return users;
+}
 
-            user.id = query.getColumn("id");
-            user.login = query.getColumn("login").getString();
-            user.password = query.getColumn("password").getString();
-            user.firstName = query.getColumn("first_name").getString();
-            user.lastName = query.getColumn("last_name").getString();
-            user.isOnline = (int)query.getColumn("is_online");
+auto Database::getOnlineSnapshot( std::vector<User> &users ) const -> uint64_t
+{
+    return _presence.getOnline(users);
+}
 
-            users.emplace_back(user);
-        }
-    }
-    catch ( const std::exception &e )
-    {
-        spdlog::error(std::string("Error while get all users: ") + e.what());
-    }
+auto Database::getOnlineDelta( const uint64_t sinceVersion, PresenceTracker::Delta &delta ) const -> bool
+{
+    return _presence.getDelta(sinceVersion, delta);
+}
 
-    return users;
+auto Database::getOnlineVersion( void ) const -> uint64_t
+{
+    return _presence.getVersion();
+}
+
+auto Database::_readUser( const SQLite::Statement &query ) const -> User
+{
+    User user;
+
+    user.id = query.getColumn("id");
+    user.login = query.getColumn("login").getString();
+    user.password = query.getColumn("password").getString();
+    user.firstName = query.getColumn("first_name").getString();
+    user.lastName = query.getColumn("last_name").getString();
+
+    // users.is_online lags behind, presence is the source of truth
+    user.isOnline = _presence.isOnline(user.id);
+
+    return user;
 }
 
 auto Database::getUserByLogin( const std::string &login ) const -> std::optional<User>
 {
+    auto timer = _time(Query::kGetUserByLogin);
+
     try
     {
-        SQLite::Statement query(_db, "SELECT * FROM users WHERE login = ?");
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get("SELECT * FROM users WHERE login = ?");
 
-        query.bind(1, login);
-        if (query.executeStep())
+        query->bind(1, login);
+        if (query->executeStep())
         {
-            User user;
-
-            user.id = query.getColumn("id");
-            user.login = query.getColumn("login").getString();
-            user.password = query.getColumn("password").getString();
-            user.firstName = query.getColumn("first_name").getString();
-            user.lastName = query.getColumn("last_name").getString();
-            user.isOnline = (int)query.getColumn("is_online");
-            
-            return user;
+            return _readUser(*query);
         }        
     } catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Error finding user by login: ") + e.what());
+        spdlog::error("Error finding user by login: {}", e.what());
     }
     
     return std::nullopt;
@@ -381,194 +718,1188 @@ auto Database::getUserByLogin( const std::string &login ) const -> std::optional
 
 auto Database::getUserById( const int id ) const -> std::optional<User>
 {
+    auto timer = _time(Query::kGetUserById);
+
     try
     {
-        SQLite::Statement query(_db, "SELECT * FROM users WHERE id = ?");
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get("SELECT * FROM users WHERE id = ?");
 
-        query.bind(1, id);
-        if (query.executeStep())
+        query->bind(1, id);
+        if (query->executeStep())
         {
-            User user;
-
-            user.id = query.getColumn("id");
-            user.login = query.getColumn("login").getString();
-            user.password = query.getColumn("password").getString();
-            user.firstName = query.getColumn("first_name").getString();
-            user.lastName = query.getColumn("last_name").getString();
-            user.isOnline = (int)query.getColumn("is_online");
-            
-            return user;
+            return _readUser(*query);
         }        
     } catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Error finding user by id: ") + e.what());
+        spdlog::error("Error finding user by id: {}", e.what());
     }
     
     return std::nullopt; 
 }
 
-auto Database::sendMessage( const int userId, const std::string &text ) -> Error
+auto Database::queueMessage( const int userId, const std::string &text, const int roomId )
+    -> std::future<std::pair<MessagePtr, Error>>
 {
-    Error err;
+    std::promise<std::pair<MessagePtr, Error>> result;
+    auto future = result.get_future();
 
-    try
+    if (!_pending.push({userId, roomId, text, std::move(result)}))
     {
-        SQLite::Statement query(_db, R"(
-            INSERT INTO messages (user_id, message_text) VALUES (?, ?)
-        )");
+        std::promise<std::pair<MessagePtr, Error>> closed;
 
-        query.bind(1, userId);
-        query.bind(2, text);
-
-        query.exec();
-    }
-    catch ( const std::exception &e )
-    {
-        err = true;
-        err.errorId = 500;
-        err.message = e.what();
-        spdlog::error(e.what());
+        closed.set_value({nullptr, Error(true, "Database is closing!", 500)});
+        return closed.get_future();
     }
 
-    return err;
+    return future;
 }
 
-auto Database::getLastMessages( const int limit ) -> std::vector<MessageJson>
+auto Database::sendMessage( const int userId, const std::string &text, const int roomId )
+    -> std::pair<MessagePtr, Error>
 {
-    std::vector<MessageJson> messages;
-    
+    return queueMessage(userId, text, roomId).get();
+}
+
+void Database::setMessageListener( std::function<void( const MessagePtr & )> listener )
+{
+    std::lock_guard lock(_writeMutex);
+    _messageListener = std::move(listener);
+}
+
+void Database::_writeMessages( std::vector<PendingMessage> &batch )
+{
+    auto timer = _time(Query::kWriteMessages);
+
+    std::vector<std::shared_ptr<MessageJson>> messages(batch.size());
+    std::vector<Error> errors(batch.size());
+
+    std::lock_guard lock(_writeMutex);
+
     try
     {
-        SQLite::Statement query(_db, R"(
-            SELECT m.*, u.login as login, u.is_online as is_online,
-            u.first_name as first_name, u.last_name as last_name
-            FROM messages m 
-            LEFT JOIN users u ON m.user_id = u.id 
-            ORDER BY m.timestamp DESC, id DESC
-            LIMIT ?
+        // One transaction for the whole batch, so one journal commit for all of it
+        SQLite::Transaction transaction(_writer.db);
+        // Selected from rooms, so a post to a deleted room inserts nothing
+        auto query = _writer.statements.get(R"(
+            INSERT INTO messages (user_id, room_id, message_text) SELECT ?, id, ? FROM rooms WHERE id = ?
+            RETURNING id, timestamp
         )");
-        query.bind(1, limit);
-        
-        while (query.executeStep())
-        {
-            MessageJson msg;
-
-            msg.id = query.getColumn("id").getInt();
-            msg.userId = query.getColumn("user_id").getInt();
-            msg.messageText = query.getColumn("message_text").getString();
+        auto userQuery = _writer.statements.get(R"(
+            SELECT login, first_name, last_name FROM users WHERE id = ?
+        )");
+        auto savepoint = _writer.statements.get("SAVEPOINT message");
+        auto release = _writer.statements.get("RELEASE message");
+        std::optional<StatementCache::Handle> searchQuery;
 
-            msg.user.id = msg.userId;
-            msg.user.login = query.getColumn("login").getString();
-            msg.user.firstName = query.getColumn("first_name").getString();
-            msg.user.lastName = query.getColumn("last_name").getString();
-            msg.user.isOnline = (int)query.getColumn("is_online");
+        if (_isSearchEnabled)
+        {
+            searchQuery.emplace(_writer.statements.get("INSERT INTO messages_fts (rowid, message_text) VALUES (?, ?)"));
+        }
 
-            msg.timestamp = query.getColumn("timestamp").getString();
-            
-            messages.push_back(msg);
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            auto msg = std::make_shared<MessageJson>();
+
+            // A failed message is rolled back to its savepoint and does not take the rest of the batch with it,
+            // so an error always means nothing of it was written
+            savepoint->exec();
+            savepoint->reset();
+
+            try
+            {
+                userQuery->bind(1, batch[i].userId);
+
+                if (userQuery->executeStep())
+                {
+                    msg->user.id = batch[i].userId;
+                    msg->user.login = userQuery->getColumn("login").getString();
+                    msg->user.firstName = userQuery->getColumn("first_name").getString();
+                    msg->user.lastName = userQuery->getColumn("last_name").getString();
+                    msg->user.isOnline = _presence.isOnline(batch[i].userId);
+                }
+                userQuery->reset();
+
+                query->bind(1, batch[i].userId);
+                query->bind(2, batch[i].text);
+                query->bind(3, batch[i].roomId);
+
+                if (!query->executeStep())
+                {
+                    query->reset();
+                    release->exec();
+                    release->reset();
+                    errors[i] = Error(true, "Room does not exist!", 404);
+                    continue;
+                }
+
+                msg->id = query->getColumn("id").getInt();
+                msg->timestamp = query->getColumn("timestamp").getString();
+                msg->userId = batch[i].userId;
+                msg->roomId = batch[i].roomId;
+                msg->messageText = std::move(batch[i].text);
+
+                query->executeStep();
+                query->reset();
+
+                // Same transaction as the row, the index never lags behind the table
+                if (searchQuery)
+                {
+                    (*searchQuery)->bind(1, msg->id);
+                    (*searchQuery)->bind(2, msg->messageText);
+                    (*searchQuery)->exec();
+                    (*searchQuery)->reset();
+                }
+
+                release->exec();
+                release->reset();
+                messages[i] = msg;
+            }
+            catch ( const std::exception &e )
+            {
+                userQuery->tryReset();
+                query->tryReset();
+                release->tryReset();
+                if (searchQuery)
+                {
+                    (*searchQuery)->tryReset();
+                }
+
+                // Throws on to the whole batch if even this fails
+                _writer.db.exec("ROLLBACK TO message; RELEASE message;");
+
+                errors[i] = Error(true, e.what(), 500);
+                spdlog::error("{}", e.what());
+            }
         }
-        std::reverse(messages.begin(), messages.end());
+
+        transaction.commit();
     }
     catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Error getting messages: ") + e.what());
-        return {};
+        spdlog::error("Error while write messages: {}", e.what());
+
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            messages[i] = nullptr;
+            errors[i] = Error(true, e.what(), 500);
+        }
     }
-    
-    return messages;
-}
 
-auto Database::getMessagesAfter( const int afterId ) -> std::vector<MessageJson>
-{
-    std::vector<MessageJson> messages;
-    
-    try
+    _batches.fetch_add(1, std::memory_order_relaxed);
+    _batchedMessages.fetch_add(batch.size(), std::memory_order_relaxed);
+
+    // Only the writer thread stores it
+    if (batch.size() > _largestBatch.load(std::memory_order_relaxed))
     {
-        SQLite::Statement query(_db, R"(
-            SELECT m.*, u.login as login, u.is_online as is_online,
-            u.first_name as first_name, u.last_name as last_name
-            FROM messages m 
-            LEFT JOIN users u ON m.user_id = u.id 
-            WHERE m.id > ?
-            ORDER BY m.timestamp DESC, id DESC
-        )");
-        query.bind(1, afterId);
-        
-        while (query.executeStep())
+        _largestBatch.store(batch.size(), std::memory_order_relaxed);
+    }
+
+    // Committed messages become visible in id order, still under the write lock
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (messages[i])
         {
-            MessageJson msg;
+            messages[i]->json = messages[i]->toJson().dump();
+            _messagesCount++;
+
+            // Rooms nobody has opened yet read it from SQL when they load
+            if (auto room = _findRoom(messages[i]->roomId))
+            {
+                room->publish(messages[i]);
+            }
+
+            if (_messageListener)
+            {
+                _messageListener(messages[i]);
+            }
+        }
 
-            msg.id = query.getColumn("id").getInt();
-            msg.userId = query.getColumn("user_id").getInt();
-            msg.messageText = query.getColumn("message_text").getString();
+        batch[i].result.set_value({messages[i], errors[i]});
+    }
+}
 
-            msg.user.id = msg.userId;
-            msg.user.login = query.getColumn("login").getString();
-            msg.user.firstName = query.getColumn("first_name").getString();
-            msg.user.lastName = query.getColumn("last_name").getString();
-            msg.user.isOnline = (int)query.getColumn("is_online");
+auto Database::_readMessage( const SQLite::Statement &query ) const -> MessagePtr
+{
+    auto msg = std::make_shared<MessageJson>();
 
-            msg.timestamp = query.getColumn("timestamp").getString();
-            
-            messages.push_back(msg);
-        }
+    msg->id = query.getColumn("id").getInt();
+    msg->userId = query.getColumn("user_id").getInt();
+    msg->roomId = query.getColumn("room_id").getInt();
+    msg->messageText = query.getColumn("message_text").getString();
+
+    msg->user.id = msg->userId;
+    msg->user.login = query.getColumn("login").getString();
+    msg->user.firstName = query.getColumn("first_name").getString();
+    msg->user.lastName = query.getColumn("last_name").getString();
+    msg->user.isOnline = _presence.isOnline(msg->userId);
+
+    msg->timestamp = query.getColumn("timestamp").getString();
+    msg->json = msg->toJson().dump();
+
+    return msg;
+}
+
+auto Database::_fetchMessages( const std::string_view sql, const int roomId, const int id, const int limit,
+                               const bool isReversed ) const -> std::vector<MessagePtr>
+{
+    auto timer = _time(Query::kQueryMessages);
+
+    std::vector<MessagePtr> messages;
+    auto reader = _readers->acquire();
+    auto query = reader->statements.get(sql);
+
+    query->bind(1, roomId);
+    query->bind(2, id);
+    query->bind(3, limit);
+
+    while (query->executeStep())
+    {
+        messages.push_back(_readMessage(*query));
+    }
+
+    if (isReversed)
+    {
         std::reverse(messages.begin(), messages.end());
     }
+
+    return messages;
+}
+
+auto Database::_queryMessages( const std::string_view sql, const int roomId, const int id, const int limit,
+                               const bool isReversed ) const -> std::vector<MessagePtr>
+{
+    try
+    {
+        return _fetchMessages(sql, roomId, id, limit, isReversed);
+    }
     catch ( const std::exception &e )
     {
-        spdlog::error(std::string("Error getting messages: ") + e.what());
+        spdlog::error("Error getting messages: {}", e.what());
         return {};
     }
-    
-    return messages;
+}
+
+auto Database::getLastMessages( const int limit, const int roomId ) -> std::vector<MessagePtr>
+{
+    return getMessagesBefore(std::numeric_limits<int>::max(), limit, roomId);
+}
+
+auto Database::getMessagesBefore( const int beforeId, const int limit, const int roomId ) -> std::vector<MessagePtr>
+{
+    std::vector<MessagePtr> messages;
+    auto room = _getRoom(roomId);
+
+    if (!room || limit == 0 || room->getRecent().getBefore(beforeId, limit < 0 ? SIZE_MAX : limit, messages))
+    {
+        return messages;
+    }
+
+    return _queryMessages(kMessagesBeforeSql, roomId, beforeId, limit, true);
+}
+
+auto Database::getMessagesAfter( const int afterId, const int limit, const int roomId ) -> std::vector<MessagePtr>
+{
+    std::vector<MessagePtr> messages;
+    auto room = _getRoom(roomId);
+
+    if (!room || limit == 0 || room->getRecent().getAfter(afterId, limit < 0 ? SIZE_MAX : limit, messages))
+    {
+        return messages;
+    }
+
+    return _queryMessages(kMessagesAfterSql, roomId, afterId, limit, false);
 }
 
 int Database::getMessageCount( void )
+{
+    return _messagesCount.load(std::memory_order_relaxed);
+}
+
+auto Database::getCounts( void ) const -> Counts
+{
+    return {
+        _usersCount.load(std::memory_order_relaxed),
+        _messagesCount.load(std::memory_order_relaxed),
+        static_cast<int>(_presence.getSize())
+    };
+}
+
+int Database::getLastMessageId( void )
 {
     try
     {
-        SQLite::Statement query(_db, "SELECT COUNT(*) FROM messages");
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get("SELECT COALESCE(MAX(id), 0) FROM messages");
 
-        if (query.executeStep())
+        if (query->executeStep())
         {
-            return query.getColumn(0).getInt();
+            return query->getColumn(0).getInt();
         }
     }
     catch ( const std::exception &e )
     {
-        spdlog::error(e.what());
+        spdlog::error("{}", e.what());
     }
 
-    return -1;
+    return 0;
+}
+
+auto Database::searchMessages( const std::string &text, const int roomId, const int limit,
+                               const std::optional<SearchCursor> &after ) const -> std::pair<std::vector<SearchHit>, Error>
+{
+    auto timer = _time(Query::kSearchMessages);
+
+    std::vector<SearchHit> hits;
+    std::string match = toMatchQuery(text);
+
+    if (!_isSearchEnabled)
+    {
+        return {hits, Error(true, "Search is not available!", 503)};
+    }
+    if (match.empty())
+    {
+        return {hits, Error(true, "Nothing to search for!", 400)};
+    }
+    if (limit <= 0)
+    {
+        return {hits, {}};
+    }
+
+    SearchCursor cursor = after.value_or(SearchCursor {std::numeric_limits<double>::lowest(), std::numeric_limits<int>::max()});
+
+    try
+    {
+        auto reader = _readers->acquire();
+        // Keyset on (rank, id) in the order of the page, so a page costs the same at any depth
+        auto query = reader->statements.get(R"(
+            SELECT m.*, u.login as login,
+            u.first_name as first_name, u.last_name as last_name,
+            snippet(messages_fts, 0, char(2), char(3), '…', 16) AS snippet,
+            bm25(messages_fts) AS rank
+            FROM messages_fts
+            JOIN messages m ON m.id = messages_fts.rowid
+            LEFT JOIN users u ON m.user_id = u.id
+            WHERE messages_fts MATCH ? AND m.room_id = ?
+            AND (bm25(messages_fts) > ? OR (bm25(messages_fts) = ? AND m.id < ?))
+            ORDER BY rank, m.id DESC
+            LIMIT ?
+        )");
+
+        query->bind(1, match);
+        query->bind(2, roomId);
+        query->bind(3, cursor.rank);
+        query->bind(4, cursor.rank);
+        query->bind(5, cursor.id);
+        query->bind(6, limit);
+
+        while (query->executeStep())
+        {
+            hits.push_back({
+                _readMessage(*query),
+                query->getColumn("snippet").getString(),
+                query->getColumn("rank").getDouble()
+            });
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::error("Error while search messages: {}", e.what());
+        return {{}, Error(true, "Search failed!", 500)};
+    }
+
+    return {hits, {}};
+}
+
+auto Database::backfillSearch( const size_t limit ) -> bool
+{
+    auto timer = _time(Query::kBackfillSearch);
+
+    std::lock_guard lock(_writeMutex);
+    int from = _searchIndexedThrough.load();
+    int end = _searchBacklogEnd.load();
+
+    if (!_isSearchEnabled || from >= end)
+    {
+        return false;
+    }
+
+    int through = end;
+
+    try
+    {
+        SQLite::Transaction transaction(_writer.db);
+
+        {
+            auto query = _writer.statements.get(R"(
+                SELECT MAX(id) FROM (SELECT id FROM messages WHERE id > ? AND id <= ? ORDER BY id LIMIT ?)
+            )");
+
+            query->bind(1, from);
+            query->bind(2, end);
+            query->bind(3, static_cast<int64_t>(limit));
+            if (query->executeStep() && !query->getColumn(0).isNull())
+            {
+                through = query->getColumn(0).getInt();
+            }
+        }
+
+        {
+            auto query = _writer.statements.get(R"(
+                INSERT INTO messages_fts (rowid, message_text)
+                SELECT id, message_text FROM messages WHERE id > ? AND id <= ?
+            )");
+
+            query->bind(1, from);
+            query->bind(2, through);
+            query->exec();
+        }
+
+        if (through < end)
+        {
+            auto query = _writer.statements.get("UPDATE search_backfill SET indexed_through = ?");
+
+            query->bind(1, through);
+            query->exec();
+        }
+        else
+        {
+            _writer.db.exec("DELETE FROM search_backfill");
+        }
+
+        transaction.commit();
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::error("Error while index messages for search: {}", e.what());
+        return false;
+    }
+
+    if (through < end)
+    {
+        _searchIndexedThrough = through;
+        return true;
+    }
+
+    _searchIndexedThrough = _searchBacklogEnd = 0;
+    spdlog::info("Search index has every message now");
+    return false;
+}
+
+auto Database::_readRoom( const SQLite::Statement &query ) const -> Room
+{
+    Room room;
+
+    room.id = query.getColumn("id").getInt();
+    room.name = query.getColumn("name").getString();
+    room.ownerId = query.getColumn("owner_id").getInt();
+    room.createdAt = query.getColumn("created_at").getString();
+    room.membersCount = query.getColumn("members_count").getInt();
+    room.isMember = query.getColumn("is_member").getInt() != 0;
+
+    // Nobody has a row for the general room, everyone is in it
+    if (room.id == kGeneralRoom)
+    {
+        room.membersCount = _usersCount.load(std::memory_order_relaxed);
+        room.isMember = true;
+    }
+
+    return room;
+}
+
+auto Database::addRoom( const std::string &name, const int ownerId ) -> std::pair<Room, Error>
+{
+    auto timer = _time(Query::kRooms);
+
+    Room room {0, name, ownerId, "", 1, true};
+    Error err;
+
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        SQLite::Transaction transaction(_writer.db);
+
+        {
+            auto query = _writer.statements.get(R"(
+                INSERT INTO rooms (name, owner_id) VALUES (?, ?) RETURNING id, created_at
+            )");
+
+            query->bind(1, name);
+            query->bind(2, ownerId);
+            if (query->executeStep())
+            {
+                room.id = query->getColumn("id").getInt();
+                room.createdAt = query->getColumn("created_at").getString();
+            }
+            query->executeStep();
+        }
+
+        auto memberQuery = _writer.statements.get("INSERT INTO room_members (room_id, user_id) VALUES (?, ?)");
+
+        memberQuery->bind(1, room.id);
+        memberQuery->bind(2, ownerId);
+        memberQuery->exec();
+        memberQuery->reset();
+
+        transaction.commit();
+    }
+    catch ( const SQLite::Exception &e )
+    {
+        err = true;
+        if (e.getExtendedErrorCode() == SQLITE_CONSTRAINT_UNIQUE)
+        {
+            err.message = "Room '" + name + "' already exists!";
+            err.errorId = 409;
+        }
+        else
+        {
+            err.message = std::string("Error: ") + e.what();
+            err.errorId = 500;
+        }
+        return {room, err};
+    }
+    catch ( const std::exception &e )
+    {
+        err = true;
+        err.message = e.what();
+        err.errorId = 500;
+        return {room, err};
+    }
+
+    // Nothing is posted yet, so the empty window already is the whole room
+    auto partition = std::make_shared<RoomPartition>(_roomRecentMessages, 0, std::vector<int> {ownerId});
+
+    partition->getRecent().reset({}, true);
+
+    {
+        std::unique_lock lock(_roomsMutex);
+
+        if (_isInterrupted)
+        {
+            partition->close();
+        }
+        _missingRooms.erase(room.id);
+        _rooms.try_emplace(room.id, std::move(partition));
+    }
+
+    spdlog::info("User {} created room '{}' ({})", ownerId, name, room.id);
+    return {room, err};
+}
+
+auto Database::getRooms( const int userId ) const -> std::vector<Room>
+{
+    auto timer = _time(Query::kRooms);
+
+    std::vector<Room> rooms;
+
+    try
+    {
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get(R"(
+            SELECT r.id, r.name, COALESCE(r.owner_id, 0) AS owner_id, r.created_at,
+            (SELECT COUNT(*) FROM room_members rm WHERE rm.room_id = r.id) AS members_count,
+            EXISTS (SELECT 1 FROM room_members rm WHERE rm.room_id = r.id AND rm.user_id = ?) AS is_member
+            FROM rooms r
+            ORDER BY r.id
+        )");
+
+        query->bind(1, userId);
+        while (query->executeStep())
+        {
+            rooms.push_back(_readRoom(*query));
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::error("Error while get rooms: {}", e.what());
+    }
+
+    return rooms;
+}
+
+auto Database::getRoom( const int roomId, const int userId ) const -> std::optional<Room>
+{
+    auto timer = _time(Query::kRooms);
+
+    try
+    {
+        auto reader = _readers->acquire();
+        auto query = reader->statements.get(R"(
+            SELECT r.id, r.name, COALESCE(r.owner_id, 0) AS owner_id, r.created_at,
+            (SELECT COUNT(*) FROM room_members rm WHERE rm.room_id = r.id) AS members_count,
+            EXISTS (SELECT 1 FROM room_members rm WHERE rm.room_id = r.id AND rm.user_id = ?) AS is_member
+            FROM rooms r
+            WHERE r.id = ?
+        )");
+
+        query->bind(1, userId);
+        query->bind(2, roomId);
+        if (query->executeStep())
+        {
+            return _readRoom(*query);
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::error("Error while get room: {}", e.what());
+    }
+
+    return std::nullopt;
+}
+
+auto Database::renameRoom( const int roomId, const int userId, const std::string &name ) -> Error
+{
+    auto room = getRoom(roomId, userId);
+
+    if (!room)
+    {
+        return Error(true, "Room does not exist!", 404);
+    }
+    if (room.value().ownerId != userId || roomId == kGeneralRoom)
+    {
+        return Error(true, "Only the owner can change the room!", 403);
+    }
+
+    auto timer = _time(Query::kRooms);
+
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        auto query = _writer.statements.get("UPDATE rooms SET name = ? WHERE id = ?");
+
+        query->bind(1, name);
+        query->bind(2, roomId);
+        query->exec();
+    }
+    catch ( const SQLite::Exception &e )
+    {
+        if (e.getExtendedErrorCode() == SQLITE_CONSTRAINT_UNIQUE)
+        {
+            return Error(true, "Room '" + name + "' already exists!", 409);
+        }
+        return Error(true, std::string("Error: ") + e.what(), 500);
+    }
+
+    return {};
+}
+
+auto Database::deleteRoom( const int roomId, const int userId ) -> Error
+{
+    auto room = getRoom(roomId, userId);
+
+    if (!room)
+    {
+        return Error(true, "Room does not exist!", 404);
+    }
+    if (room.value().ownerId != userId || roomId == kGeneralRoom)
+    {
+        return Error(true, "Only the owner can delete the room!", 403);
+    }
+
+    auto timer = _time(Query::kRooms);
+
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        SQLite::Transaction transaction(_writer.db);
+        int deleted = 0;
+
+        if (_isSearchEnabled)
+        {
+            // Only rows the index has, deleting one it never got would corrupt it
+            auto query = _writer.statements.get(R"(
+                INSERT INTO messages_fts (messages_fts, rowid, message_text)
+                SELECT 'delete', id, message_text FROM messages
+                WHERE room_id = ? AND (id <= ? OR id > ?)
+            )");
+
+            query->bind(1, roomId);
+            query->bind(2, _searchIndexedThrough.load());
+            query->bind(3, _searchBacklogEnd.load());
+            query->exec();
+        }
+
+        {
+            auto query = _writer.statements.get("DELETE FROM messages WHERE room_id = ?");
+
+            query->bind(1, roomId);
+            deleted = query->exec();
+        }
+
+        // Members go with the room by cascade
+        auto query = _writer.statements.get("DELETE FROM rooms WHERE id = ?");
+
+        query->bind(1, roomId);
+        query->exec();
+        query->reset();
+
+        transaction.commit();
+        _messagesCount -= deleted;
+    }
+    catch ( const std::exception &e )
+    {
+        return Error(true, e.what(), 500);
+    }
+
+    // Loads after the commit do not find the room any more, loads from before it are thrown away
+    std::shared_ptr<RoomPartition> partition;
+
+    {
+        std::unique_lock lock(_roomsMutex);
+        auto it = _rooms.find(roomId);
+
+        if (it != _rooms.end())
+        {
+            partition = std::move(it->second);
+            _rooms.erase(it);
+        }
+        _missingRooms[roomId] = std::chrono::steady_clock::now() + kMissingRoomTtl;
+        _roomsVersion++;
+    }
+    if (partition)
+    {
+        partition->close();
+    }
+
+    spdlog::info("User {} deleted room {}", userId, roomId);
+    return {};
+}
+
+auto Database::joinRoom( const int roomId, const int userId ) -> Error
+{
+    auto room = _getRoom(roomId);
+
+    if (!room)
+    {
+        return Error(true, "Room does not exist!", 404);
+    }
+    if (roomId == kGeneralRoom)
+    {
+        return {};
+    }
+
+    auto timer = _time(Query::kRooms);
+
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        auto query = _writer.statements.get("INSERT OR IGNORE INTO room_members (room_id, user_id) VALUES (?, ?)");
+
+        query->bind(1, roomId);
+        query->bind(2, userId);
+        query->exec();
+    }
+    catch ( const std::exception &e )
+    {
+        return Error(true, e.what(), 500);
+    }
+
+    // After the commit, so a partition loaded in between has either the row or this call
+    room->addMember(userId);
+    return {};
+}
+
+auto Database::leaveRoom( const int roomId, const int userId ) -> Error
+{
+    auto room = _getRoom(roomId);
+
+    if (!room)
+    {
+        return Error(true, "Room does not exist!", 404);
+    }
+    if (roomId == kGeneralRoom)
+    {
+        return Error(true, "Nobody can leave the general room!", 400);
+    }
+
+    auto timer = _time(Query::kRooms);
+
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        auto query = _writer.statements.get("DELETE FROM room_members WHERE room_id = ? AND user_id = ?");
+
+        query->bind(1, roomId);
+        query->bind(2, userId);
+        query->exec();
+    }
+    catch ( const std::exception &e )
+    {
+        return Error(true, e.what(), 500);
+    }
+
+    room->removeMember(userId);
+    return {};
+}
+
+auto Database::hasRoom( const int roomId ) const -> bool
+{
+    return static_cast<bool>(_getRoom(roomId));
+}
+
+auto Database::isRoomMember( const int roomId, const int userId ) const -> bool
+{
+    auto room = _getRoom(roomId);
+
+    return room && (roomId == kGeneralRoom || room->hasMember(userId));
+}
+
+auto Database::getRoomLastId( const int roomId ) const -> int
+{
+    auto room = _getRoom(roomId);
+
+    return room ? room->getLastId() : 0;
+}
+
+auto Database::waitForMessages( const int roomId, const int afterId, const std::chrono::milliseconds timeout ) -> bool
+{
+    auto room = _getRoom(roomId);
+
+    return room && room->waitAfter(afterId, timeout);
+}
+
+void Database::interruptWaits( void )
+{
+    std::unique_lock lock(_roomsMutex);
+
+    _isInterrupted = true;
+    for (const auto &[id, room] : _rooms)
+    {
+        room->close();
+    }
+}
+
+auto Database::_findRoom( const int roomId ) const -> std::shared_ptr<RoomPartition>
+{
+    std::shared_lock lock(_roomsMutex);
+    auto it = _rooms.find(roomId);
+
+    return it == _rooms.end() ? nullptr : it->second;
+}
+
+auto Database::_getRoom( const int roomId ) const -> std::shared_ptr<RoomPartition>
+{
+    while (true)
+    {
+        uint64_t version = 0;
+
+        {
+            std::shared_lock lock(_roomsMutex);
+            auto it = _rooms.find(roomId);
+
+            if (it != _rooms.end())
+            {
+                return it->second;
+            }
+
+            auto missing = _missingRooms.find(roomId);
+
+            if (missing != _missingRooms.end() && missing->second > std::chrono::steady_clock::now())
+            {
+                return nullptr;
+            }
+            version = _roomsVersion;
+        }
+
+        // Loaded without the lock, so a cold room never holds up the others
+        std::shared_ptr<RoomPartition> room;
+
+        try
+        {
+            room = _loadRoom(roomId);
+        }
+        catch ( const std::exception &e )
+        {
+            // Not remembered as missing, the next call tries again
+            spdlog::error("Error while load room {}: {}", roomId, e.what());
+            return nullptr;
+        }
+
+        if (room && _roomLoaded)
+        {
+            _roomLoaded(roomId);
+        }
+
+        // The writer publishes only to rooms in the map, so it is held off from before the insert until the
+        // messages committed since the load are in, otherwise a newer message would get in first and shut them out
+        std::unique_lock writeLock(_writeMutex, std::defer_lock);
+
+        if (room)
+        {
+            writeLock.lock();
+        }
+
+        {
+            std::unique_lock lock(_roomsMutex);
+
+            // A room deleted or cleared meanwhile may have been read before the commit, so read it again
+            if (_roomsVersion != version)
+            {
+                continue;
+            }
+            if (!room)
+            {
+                if (_missingRooms.size() >= kMissingRoomsMax)
+                {
+                    _missingRooms.clear();
+                }
+                _missingRooms[roomId] = std::chrono::steady_clock::now() + kMissingRoomTtl;
+                return nullptr;
+            }
+
+            auto [it, isInserted] = _rooms.try_emplace(roomId, room);
+
+            if (!isInserted)
+            {
+                return it->second;
+            }
+            if (_isInterrupted)
+            {
+                room->close();
+            }
+        }
+
+        for (auto &message : _queryMessages(kMessagesAfterSql, roomId, room->getLastId(), -1, false))
+        {
+            room->publish(std::move(message));
+        }
+        return room;
+    }
+}
+
+auto Database::_loadRoom( const int roomId ) const -> std::shared_ptr<RoomPartition>
+{
+    auto timer = _time(Query::kLoadRoom);
+
+    std::vector<int> members;
+
+    {
+        auto reader = _readers->acquire();
+
+        {
+            auto query = reader->statements.get("SELECT 1 FROM rooms WHERE id = ?");
+
+            query->bind(1, roomId);
+            if (!query->executeStep())
+            {
+                return nullptr;
+            }
+        }
+
+        auto query = reader->statements.get("SELECT user_id FROM room_members WHERE room_id = ?");
+
+        query->bind(1, roomId);
+        while (query->executeStep())
+        {
+            members.push_back(query->getColumn(0).getInt());
+        }
+    }
+
+    // Warmed with the newest page, the first reader of a room asks for it anyway
+    auto recent = _fetchMessages(kMessagesBeforeSql, roomId, std::numeric_limits<int>::max(),
+                                 static_cast<int>(_roomRecentMessages), true);
+    auto room = std::make_shared<RoomPartition>(_roomRecentMessages, recent.empty() ? 0 : recent.back()->id,
+                                                std::move(members));
+
+    // A failed query throws, so a short page is the whole room
+    room->getRecent().reset(recent, recent.size() < _roomRecentMessages);
+    return room;
+}
+
+auto Database::_makeGeneralRoom( void ) const -> std::shared_ptr<RoomPartition>
+{
+    std::vector<MessagePtr> recent;
+    bool isComplete = false;
+
+    try
+    {
+        recent = _fetchMessages(kMessagesBeforeSql, kGeneralRoom, std::numeric_limits<int>::max(),
+                                static_cast<int>(_recentMessages), true);
+        isComplete = recent.size() < _recentMessages;
+    }
+    catch ( const std::exception &e )
+    {
+        // The room still has to exist, pages its window does not cover go to SQL
+        spdlog::error("Error while load the general room: {}", e.what());
+    }
+
+    auto room = std::make_shared<RoomPartition>(_recentMessages, recent.empty() ? 0 : recent.back()->id,
+                                                std::vector<int> {});
+
+    room->getRecent().reset(recent, isComplete);
+    return room;
+}
+
+auto Database::getStats( void ) const -> nlohmann::json
+{
+    auto sessions = _sessions.getStats();
+    auto statements = _readers->getStatementStats();
+    auto writerStatements = _writer.statements.getStats();
+    auto recent = _getRoom(kGeneralRoom)->getRecent().getStats();
+    size_t roomsLoaded = 0;
+
+    {
+        std::shared_lock lock(_roomsMutex);
+        roomsLoaded = _rooms.size();
+    }
+
+    statements.prepared += writerStatements.prepared;
+    statements.reused += writerStatements.reused;
+    statements.size += writerStatements.size;
+
+    return nlohmann::json {
+        {"session_cache", {
+            {"hits", sessions.hits},
+            {"misses", sessions.misses},
+            {"size", sessions.size}
+        }},
+        {"statement_cache", {
+            {"prepared", statements.prepared},
+            {"reused", statements.reused},
+            {"size", statements.size}
+        }},
+        {"recent_messages", {
+            {"size", recent.size},
+            {"capacity", recent.capacity},
+            {"memory_bytes", recent.memoryBytes},
+            {"hits", recent.hits},
+            {"misses", recent.misses}
+        }},
+        {"rooms", {
+            {"loaded", roomsLoaded}
+        }},
+        {"search", {
+            {"enabled", _isSearchEnabled},
+            {"backfill_pending_ids", _searchBacklogEnd.load() - _searchIndexedThrough.load()}
+        }},
+        {"write_queue", {
+            {"queued", _pending.getSize()},
+            {"batches", _batches.load(std::memory_order_relaxed)},
+            {"messages", _batchedMessages.load(std::memory_order_relaxed)},
+            {"largest_batch", _largestBatch.load(std::memory_order_relaxed)}
+        }},
+        {"readers", _readers->getSize()}
+    };
+}
+
+auto Database::getMetrics( void ) const -> const Metrics &
+{
+    return _metrics;
+}
+
+auto Database::_time( const Query query ) const -> ScopedTimer
+{
+    return ScopedTimer(*_timings[static_cast<size_t>(query)]);
+}
+
+void Database::flushPresence( void )
+{
+    auto timer = _time(Query::kFlushPresence);
+
+    auto changes = _presence.takeChanges();
+
+    if (changes.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        std::lock_guard lock(_writeMutex);
+        SQLite::Transaction transaction(_writer.db);
+        auto query = _writer.statements.get("UPDATE users SET is_online = ? WHERE id = ?");
+
+        for (const auto &[userId, isOnline] : changes)
+        {
+            query->bind(1, isOnline);
+            query->bind(2, userId);
+            query->exec();
+            query->reset();
+        }
+
+        transaction.commit();
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::error("Error while flush presence: {}", e.what());
+    }
 }
 
 void Database::clear( void )
 {
+    _sessions.clear();
+    _presence.clear();
+
     try
     {
-        _db.exec("DELETE FROM users;");
-        _db.exec("DELETE FROM messages;");
-        _db.exec("DELETE FROM auth_tokens;");
+        std::lock_guard lock(_writeMutex);
+
+        _writer.db.exec("DELETE FROM users;");
+        _writer.db.exec("DELETE FROM messages;");
+        _writer.db.exec("DELETE FROM auth_tokens;");
+        if (_isSearchEnabled)
+        {
+            _writer.db.exec("INSERT INTO messages_fts (messages_fts) VALUES ('delete-all');");
+            _writer.db.exec("DELETE FROM search_backfill;");
+            _searchIndexedThrough = _searchBacklogEnd = 0;
+        }
+        _writer.db.exec("DELETE FROM rooms WHERE id != " + std::to_string(kGeneralRoom) + ";");
+
+        _writer.db.exec("DELETE FROM SQLITE_SEQUENCE WHERE name='users';");
+        _writer.db.exec("DELETE FROM SQLITE_SEQUENCE WHERE name='messages';");
+        _writer.db.exec("UPDATE SQLITE_SEQUENCE SET seq = " + std::to_string(kGeneralRoom) + " WHERE name='rooms';");
 
-        _db.exec("DELETE FROM SQLITE_SEQUENCE WHERE name='users';");
-        _db.exec("DELETE FROM SQLITE_SEQUENCE WHERE name='messages';");
-        _db.exec("DELETE FROM SQLITE_SEQUENCE WHERE name='auth_tokens';");
+        _usersCount = _messagesCount = 0;
     }
     catch( const std::exception &e )
     {
-        spdlog::error(e.what());
+        spdlog::error("{}", e.what());
+    }
+
+    // Waiters on the old rooms are woken, ids start over so the general room does too
+    std::unique_lock lock(_roomsMutex);
+
+    for (const auto &[id, room] : _rooms)
+    {
+        room->close();
     }
+    _rooms.clear();
+    _missingRooms.clear();
+    _roomsVersion++;
+    _rooms[kGeneralRoom] = _makeGeneralRoom();
 }
 
 Database::~Database( void )
 {
+    _searchBackfiller.request_stop();
+    if (_searchBackfiller.joinable())
+    {
+        _searchBackfiller.join();
+    }
+
+    // Whatever is already queued still gets written
+    _pending.shutdown();
+    if (_messageWriter.joinable())
+    {
+        _messageWriter.join();
+    }
+
+    _presenceFlusher.request_stop();
+    if (_presenceFlusher.joinable())
+    {
+        _presenceFlusher.join();
+    }
+    flushPresence();
+
     try
     {
-        _db.exec(R"(DROP TABLE IF EXISTS auth_tokens)");
+        std::lock_guard lock(_writeMutex);
+
+        _writer.db.exec(R"(DROP TABLE IF EXISTS auth_tokens)");
         spdlog::trace("All the authorization tokens were reset!");
     }
     catch ( const std::exception &e )
     {
-        spdlog::error(e.what());
+        spdlog::error("{}", e.what());
     }
 }
\ No newline at end of file
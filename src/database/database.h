@@ -1,82 +1,65 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <spdlog/spdlog.h>
 #include <nlohmann/json.hpp>
 
-struct User
+#include "entities.h"
+#include "batch_queue.h"
+#include "connection_pool.h"
+#include "message_ring.h"
+#include "metrics.h"
+#include "password.h"
+#include "presence_tracker.h"
+#include "room_partition.h"
+#include "session_cache.h"
+#include "sha256.h"
+#include "statement_cache.h"
+
+struct DatabaseOptions
 {
-    int id;
-    std::string login;
-    std::string password;
-    std::string firstName;
-    std::string lastName;
-    bool isOnline;
-
-    auto toJson( bool showPass = false ) const -> nlohmann::json
-    {
-        nlohmann::json res = {
-            {"id", id},
-            {"login", login},
-            {"password", password},
-            {"first_name", firstName},
-            {"last_name", lastName},
-            {"is_online", isOnline},
-        };
-
-        if (!showPass)
-        {
-            res.erase("password");
-        }
+    size_t readers = 4;
+    int busyTimeoutMs = 5000;
+    size_t recentMessages = 1024;
+    // Window of every other room, they are loaded on first use and most of them are quiet
+    size_t roomRecentMessages = 128;
+    std::chrono::milliseconds presenceFlush {5000};
 
-        return res;
-    }
-};
+    // Page cache and memory map of every connection, cache_size and mmap_size pragmas
+    int64_t cacheSizeKiB = 2000;
+    int64_t mmapSize = 0;
 
-struct Message
-{
-    int id;
-    int userId;
-    std::string messageText;
-    std::string timestamp;
-};
+    // PBKDF2 cost of stored passwords, rows hashed with less are upgraded on login
+    uint32_t passwordIterations = Password::kDefaultIterations;
 
-struct MessageJson : public Message
-{
-    User user;
+    // Group commit of posted messages
+    size_t writeQueue = 4096;
+    size_t maxBatch = 128;
+    std::chrono::microseconds maxBatchLatency {1000};
 
-    auto toJson( void ) const -> nlohmann::json
-    {
-        return nlohmann::json {
-            {"id", id},
-            {"user_id", userId},
-            {"message_text", messageText},
-            {"timestamp", timestamp},
-            {"user", user.toJson()}
-        };
-    }
-};
+    // Messages from before the search index are added to it this many at a time, with a pause in between
+    size_t searchBackfillChunk = 1000;
+    std::chrono::milliseconds searchBackfillPause {10};
 
-struct Token
-{
-    int id;
-    int userId;
-    std::string token;
+    // Called with the room id after a room is read and before it is published, tests post into that gap
+    std::function<void( const int )> roomLoaded {};
 };
 
 class Database final
 {
-private:
-    SQLite::Database _db;
-
-    struct Error;
-
-    static auto generateToken( const int len = 32 ) -> std::string;
-    auto _addToken( const Token &token ) -> Error;
-    auto _findToken( const std::string &token ) const -> std::optional<Token>;
-  
 public:
     struct Error
     {
@@ -99,7 +82,36 @@ public:
         }
     };
 
-    Database( const std::string &name = "a.db" );
+    struct Counts
+    {
+        int users;
+        int messages;
+        int online;
+    };
+
+    // Position of the last hit of a search page
+    struct SearchCursor
+    {
+        double rank;
+        int id;
+    };
+
+    struct SearchHit
+    {
+        MessagePtr message;
+        // Matched terms are wrapped in kMatchBegin and kMatchEnd, messages can not contain either
+        std::string snippet;
+        // bm25, lower is better
+        double rank;
+    };
+
+    static constexpr char kMatchBegin = '\x02';
+    static constexpr char kMatchEnd = '\x03';
+
+    // Always exists, every user is in it and the room-less endpoints serve it
+    static constexpr int kGeneralRoom = 1;
+
+    Database( const std::string &name = "a.db", const DatabaseOptions &options = {} );
 
     auto addUser( const User &user ) -> Error;
     auto loginUser( const std::string &login, const std::string &password ) -> std::pair<Token, Error>;
@@ -107,18 +119,178 @@ public:
 
     auto getAllUsers( void ) const -> std::vector<User>;
     auto getOnlineUsers( void ) const -> std::vector<User>;
+    auto getOnlineSnapshot( std::vector<User> &users ) const -> uint64_t;
+    auto getOnlineDelta( const uint64_t sinceVersion, PresenceTracker::Delta &delta ) const -> bool;
+    auto getOnlineVersion( void ) const -> uint64_t;
     auto getUserByLogin( const std::string &login ) const -> std::optional<User>;
     auto getUserById( const int id ) const -> std::optional<User>;
     auto getUserByToken( const std::string &token ) const -> std::optional<User>;
 
-    auto sendMessage( const int userId, const std::string &text ) -> Error;
-    auto getLastMessages( const int limit ) -> std::vector<MessageJson>;
-    auto getMessagesAfter( const int afterId ) -> std::vector<MessageJson>;
+    // Resolved by the writer thread once the batch holding the message commits
+    auto queueMessage( const int userId, const std::string &text, const int roomId = kGeneralRoom )
+        -> std::future<std::pair<MessagePtr, Error>>;
+    auto sendMessage( const int userId, const std::string &text, const int roomId = kGeneralRoom )
+        -> std::pair<MessagePtr, Error>;
+
+    // Called by the writer thread for every stored message, in id order
+    void setMessageListener( std::function<void( const MessagePtr & )> listener );
+    // Pages are keyed by message id and come back oldest first, limit < 0 means no limit
+    auto getLastMessages( const int limit, const int roomId = kGeneralRoom ) -> std::vector<MessagePtr>;
+    auto getMessagesBefore( const int beforeId, const int limit, const int roomId = kGeneralRoom )
+        -> std::vector<MessagePtr>;
+    auto getMessagesAfter( const int afterId, const int limit = -1, const int roomId = kGeneralRoom )
+        -> std::vector<MessagePtr>;
     int getMessageCount( void );
+    auto getCounts( void ) const -> Counts;
+    int getLastMessageId( void );
+
+    // Best matches first, then newest. Words are matched as written, the last one also as a prefix
+    auto searchMessages( const std::string &text, const int roomId, const int limit,
+                         const std::optional<SearchCursor> &after = std::nullopt ) const
+        -> std::pair<std::vector<SearchHit>, Error>;
+    // Indexes up to limit messages from before the search index, false once none are left.
+    // Runs in the background on its own, public for tests and tools
+    auto backfillSearch( const size_t limit ) -> bool;
 
     auto isTokenExists( const std::string &token ) -> bool;
 
+    // Only the owner renames or deletes a room, the general one belongs to nobody
+    auto addRoom( const std::string &name, const int ownerId ) -> std::pair<Room, Error>;
+    auto getRooms( const int userId ) const -> std::vector<Room>;
+    auto getRoom( const int roomId, const int userId ) const -> std::optional<Room>;
+    auto renameRoom( const int roomId, const int userId, const std::string &name ) -> Error;
+    auto deleteRoom( const int roomId, const int userId ) -> Error;
+    auto joinRoom( const int roomId, const int userId ) -> Error;
+    auto leaveRoom( const int roomId, const int userId ) -> Error;
+    auto hasRoom( const int roomId ) const -> bool;
+    auto isRoomMember( const int roomId, const int userId ) const -> bool;
+    // Newest message id of the room, 0 if it has none or does not exist
+    auto getRoomLastId( const int roomId ) const -> int;
+    // True once the room has a message after afterId, false on timeout
+    auto waitForMessages( const int roomId, const int afterId, const std::chrono::milliseconds timeout ) -> bool;
+    // Wakes every waitForMessages() for good, called on shutdown
+    void interruptWaits( void );
+
+    auto getStats( void ) const -> nlohmann::json;
+    auto getMetrics( void ) const -> const Metrics &;
+
+    // Writes pending presence changes to users.is_online, also done in the background
+    void flushPresence( void );
+
     void clear( void );
 
     ~Database( void );
+
+private:
+    enum struct Query
+    {
+        kAddUser,
+        kFindToken,
+        kAddToken,
+        kLoginUser,
+        kLogoutUser,
+        kUpdatePassword,
+        kGetAllUsers,
+        kGetUserByLogin,
+        kGetUserById,
+        kWriteMessages,
+        kQueryMessages,
+        kFlushPresence,
+        kRooms,
+        kLoadRoom,
+        kSearchMessages,
+        kBackfillSearch,
+        kCount
+    };
+
+    // Tokens are stored only as their SHA-256
+    using TokenHash = Sha256Hasher::Digest;
+
+    static constexpr size_t kTokenBytes = 32;
+
+    struct PendingMessage
+    {
+        int userId;
+        int roomId;
+        std::string text;
+        std::promise<std::pair<MessagePtr, Error>> result;
+    };
+
+    // Registered first thing in the constructor, before anything can run a query
+    Metrics _metrics;
+    std::array<Histogram *, static_cast<size_t>(Query::kCount)> _timings {};
+
+    Connection _writer;
+    mutable std::mutex _writeMutex;
+    std::unique_ptr<ConnectionPool> _readers;
+    mutable SessionCache _sessions;
+    PresenceTracker _presence;
+
+    // Rooms are loaded on first use and stay, the general one is loaded at startup
+    mutable std::shared_mutex _roomsMutex;
+    mutable std::unordered_map<int, std::shared_ptr<RoomPartition>> _rooms;
+    mutable std::unordered_map<int, std::chrono::steady_clock::time_point> _missingRooms;
+    // Moved by every removal, a load that started before one is thrown away
+    uint64_t _roomsVersion {};
+    size_t _recentMessages;
+    size_t _roomRecentMessages;
+    std::function<void( const int )> _roomLoaded;
+    bool _isInterrupted {};
+
+    // Counted once at startup, then moved by the writes that change them
+    std::atomic<int> _usersCount {};
+    std::atomic<int> _messagesCount {};
+
+    uint32_t _passwordIterations;
+
+    std::function<void( const MessagePtr & )> _messageListener;
+
+    BatchQueue<PendingMessage> _pending;
+    size_t _maxBatch;
+    std::chrono::microseconds _maxBatchLatency;
+    std::atomic<uint64_t> _batches {};
+    std::atomic<uint64_t> _batchedMessages {};
+    std::atomic<size_t> _largestBatch {};
+
+    // Off when SQLite is built without FTS5, messages are then stored without an index
+    bool _isSearchEnabled {};
+    // Messages in (_searchIndexedThrough, _searchBacklogEnd] are not in the index yet, changed under _writeMutex
+    std::atomic<int> _searchIndexedThrough {};
+    std::atomic<int> _searchBacklogEnd {};
+
+    std::mutex _flushMutex;
+    std::condition_variable_any _flushCv;
+    std::jthread _presenceFlusher;
+    std::jthread _messageWriter;
+    std::mutex _backfillMutex;
+    std::condition_variable_any _backfillCv;
+    std::jthread _searchBackfiller;
+
+    // Hex of kTokenBytes random bytes from the OS CSPRNG
+    static auto generateToken( void ) -> std::string;
+    static auto _hashToken( const std::string &token ) -> TokenHash;
+    auto _hashPassword( const std::string &password ) const -> std::string;
+    void _updatePassword( const int userId, const std::string &password );
+    auto _addToken( const TokenHash &hash, const int userId ) -> Error;
+    auto _findToken( const TokenHash &hash ) const -> std::optional<int>;
+    auto _resolveToken( const std::string &token ) const -> std::optional<User>;
+    // _fetchMessages throws on a failed query, _queryMessages logs it and gives an empty page
+    auto _fetchMessages( const std::string_view sql, const int roomId, const int id, const int limit,
+                         const bool isReversed ) const -> std::vector<MessagePtr>;
+    auto _queryMessages( const std::string_view sql, const int roomId, const int id, const int limit,
+                         const bool isReversed ) const -> std::vector<MessagePtr>;
+    // Null if the room does not exist, _findRoom also when it is not loaded yet
+    auto _getRoom( const int roomId ) const -> std::shared_ptr<RoomPartition>;
+    auto _findRoom( const int roomId ) const -> std::shared_ptr<RoomPartition>;
+    // Null if the room does not exist, throws if it could not be read
+    auto _loadRoom( const int roomId ) const -> std::shared_ptr<RoomPartition>;
+    auto _makeGeneralRoom( void ) const -> std::shared_ptr<RoomPartition>;
+    auto _readRoom( const SQLite::Statement &query ) const -> Room;
+
+    auto _time( const Query query ) const -> ScopedTimer;
+
+    void _setupSearch( void );
+    void _writeMessages( std::vector<PendingMessage> &batch );
+    auto _readMessage( const SQLite::Statement &query ) const -> MessagePtr;
+    auto _readUser( const SQLite::Statement &query ) const -> User;
 };
\ No newline at end of file
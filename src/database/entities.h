@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+struct User
+{
+    int id;
+    std::string login;
+    std::string password;
+    std::string firstName;
+    std::string lastName;
+    bool isOnline;
+
+    auto toJson( bool showPass = false ) const -> nlohmann::json
+    {
+        nlohmann::json res = {
+            {"id", id},
+            {"login", login},
+            {"password", password},
+            {"first_name", firstName},
+            {"last_name", lastName},
+            {"is_online", isOnline},
+        };
+
+        if (!showPass)
+        {
+            res.erase("password");
+        }
+
+        return res;
+    }
+};
+
+struct Message
+{
+    int id;
+    int userId;
+    int roomId;
+    std::string messageText;
+    std::string timestamp;
+};
+
+struct MessageJson : public Message
+{
+    User user;
+
+    // toJson().dump() made once, when the message is loaded or created
+    std::string json;
+
+    auto toJson( void ) const -> nlohmann::json
+    {
+        return nlohmann::json {
+            {"id", id},
+            {"user_id", userId},
+            {"room_id", roomId},
+            {"message_text", messageText},
+            {"timestamp", timestamp},
+            {"user", user.toJson()}
+        };
+    }
+};
+
+struct Room
+{
+    int id;
+    std::string name;
+    // 0 when nobody owns it
+    int ownerId;
+    std::string createdAt;
+    int membersCount;
+    // Of the user the room was asked for
+    bool isMember;
+
+    auto toJson( void ) const -> nlohmann::json
+    {
+        return nlohmann::json {
+            {"id", id},
+            {"name", name},
+            {"owner_id", ownerId},
+            {"created_at", createdAt},
+            {"members_count", membersCount},
+            {"is_member", isMember}
+        };
+    }
+};
+
+using MessagePtr = std::shared_ptr<const MessageJson>;
+
+struct Token
+{
+    int userId;
+    std::string token;
+};
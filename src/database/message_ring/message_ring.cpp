@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <mutex>
+
+#include "message_ring.h"
+
+MessageRing::MessageRing( const size_t capacity ) : _slots(std::max<size_t>(capacity, 1)) {}
+
+void MessageRing::reset( const std::vector<MessagePtr> &messages, const bool isComplete )
+{
+    std::unique_lock lock(_mutex);
+
+    std::fill(_slots.begin(), _slots.end(), nullptr);
+    _head = _size = _memoryBytes = 0;
+    _coveredAfter = kNothing;
+
+    for (const auto &message : messages)
+    {
+        _push(message);
+    }
+
+    // Window has already dropped something, so it can not be the whole table anymore
+    if (isComplete && messages.size() <= _slots.size())
+    {
+        _coveredAfter = kEverything;
+    }
+}
+
+void MessageRing::append( MessagePtr message )
+{
+    std::unique_lock lock(_mutex);
+
+    _push(std::move(message));
+}
+
+void MessageRing::clear( void )
+{
+    reset({}, true);
+}
+
+auto MessageRing::getLast( const size_t limit, std::vector<MessagePtr> &messages ) const -> bool
+{
+    std::shared_lock lock(_mutex);
+
+    if (limit > _size && _coveredAfter != kEverything)
+    {
+        return _count(false);
+    }
+
+    size_t count = std::min(limit, _size);
+
+    messages.reserve(messages.size() + count);
+    for (size_t i = _size - count; i < _size; i++)
+    {
+        messages.push_back(_at(i));
+    }
+
+    return _count(true);
+}
+
+auto MessageRing::getBefore( const int beforeId, const size_t limit, std::vector<MessagePtr> &messages ) const -> bool
+{
+    std::shared_lock lock(_mutex);
+    size_t end = _lowerBound(beforeId);
+
+    // Older part of the page would be below the window
+    if (end < limit && _coveredAfter != kEverything)
+    {
+        return _count(false);
+    }
+
+    size_t begin = end - std::min(limit, end);
+
+    messages.reserve(messages.size() + end - begin);
+    for (size_t i = begin; i < end; i++)
+    {
+        messages.push_back(_at(i));
+    }
+
+    return _count(true);
+}
+
+auto MessageRing::getAfter( const int afterId, const size_t limit, std::vector<MessagePtr> &messages ) const -> bool
+{
+    std::shared_lock lock(_mutex);
+
+    if (afterId < _coveredAfter)
+    {
+        return _count(false);
+    }
+
+    size_t begin = _lowerBound(static_cast<int64_t>(afterId) + 1);
+    size_t end = begin + std::min(limit, _size - begin);
+
+    messages.reserve(messages.size() + end - begin);
+    for (size_t i = begin; i < end; i++)
+    {
+        messages.push_back(_at(i));
+    }
+
+    return _count(true);
+}
+
+auto MessageRing::getStats( void ) const -> Stats
+{
+    std::shared_lock lock(_mutex);
+
+    return {
+        _size,
+        _slots.size(),
+        _memoryBytes + _slots.capacity() * sizeof(MessagePtr),
+        _hits.load(std::memory_order_relaxed),
+        _misses.load(std::memory_order_relaxed)
+    };
+}
+
+auto MessageRing::_at( const size_t index ) const -> const MessagePtr &
+{
+    return _slots[(_head + index) % _slots.size()];
+}
+
+// First index with id >= the given one, wide type so afterId + 1 can not overflow
+auto MessageRing::_lowerBound( const int64_t id ) const -> size_t
+{
+    size_t lo = 0, hi = _size;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (_at(mid)->id < id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+void MessageRing::_push( MessagePtr message )
+{
+    size_t bytes = _footprint(*message);
+
+    // Nothing known before, from now on the window gets every message after this one
+    if (_coveredAfter == kNothing)
+    {
+        _coveredAfter = static_cast<int64_t>(message->id) - 1;
+    }
+
+    if (_size == _slots.size())
+    {
+        // No message between the dropped one and the new oldest is missing
+        _coveredAfter = std::max<int64_t>(_coveredAfter, _slots[_head]->id);
+        _memoryBytes -= _footprint(*_slots[_head]);
+        _slots[_head] = std::move(message);
+        _head = (_head + 1) % _slots.size();
+    }
+    else
+    {
+        _slots[(_head + _size) % _slots.size()] = std::move(message);
+        _size++;
+    }
+
+    _memoryBytes += bytes;
+}
+
+auto MessageRing::_count( const bool isHit ) const -> bool
+{
+    (isHit ? _hits : _misses).fetch_add(1, std::memory_order_relaxed);
+    return isHit;
+}
+
+auto MessageRing::_footprint( const MessageJson &message ) -> size_t
+{
+    return sizeof(MessageJson) + message.messageText.capacity() + message.timestamp.capacity() +
+        message.user.login.capacity() + message.user.firstName.capacity() +
+        message.user.lastName.capacity() + message.user.password.capacity() + message.json.capacity();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <shared_mutex>
+#include <vector>
+
+#include "entities.h"
+
+/* Bounded window of the newest messages in id order.
+ * Answers "last N", "N before id X" and "N after id X" while the range is inside the window
+ * (or the window holds the whole table), otherwise tells the caller to
+ * fall back to SQL.
+ * Ids do not have to be consecutive, a room sees only some of them: the window remembers
+ * the id after which it has every message instead of assuming the one before its oldest.
+ */
+class MessageRing final
+{
+public:
+    struct Stats
+    {
+        size_t size;
+        size_t capacity;
+        size_t memoryBytes;
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    explicit MessageRing( const size_t capacity = 1024 );
+
+    void reset( const std::vector<MessagePtr> &messages, const bool isComplete );
+    void append( MessagePtr message );
+    void clear( void );
+
+    auto getLast( const size_t limit, std::vector<MessagePtr> &messages ) const -> bool;
+    auto getBefore( const int beforeId, const size_t limit, std::vector<MessagePtr> &messages ) const -> bool;
+    auto getAfter( const int afterId, const size_t limit, std::vector<MessagePtr> &messages ) const -> bool;
+
+    auto getStats( void ) const -> Stats;
+
+private:
+    mutable std::shared_mutex _mutex;
+    std::vector<MessagePtr> _slots;
+    size_t _head {};
+    size_t _size {};
+    size_t _memoryBytes {};
+    // Every message with a greater id is in the window, kEverything when that is the whole table
+    int64_t _coveredAfter {kNothing};
+
+    static constexpr int64_t kEverything = std::numeric_limits<int64_t>::min();
+    static constexpr int64_t kNothing = std::numeric_limits<int64_t>::max();
+
+    mutable std::atomic<uint64_t> _hits {};
+    mutable std::atomic<uint64_t> _misses {};
+
+    auto _at( const size_t index ) const -> const MessagePtr &;
+    auto _lowerBound( const int64_t id ) const -> size_t;
+    void _push( MessagePtr message );
+    auto _count( const bool isHit ) const -> bool;
+
+    static auto _footprint( const MessageJson &message ) -> size_t;
+};
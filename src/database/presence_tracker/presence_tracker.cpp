@@ -0,0 +1,136 @@
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <utility>
+
+#include "presence_tracker.h"
+
+// Versions start from the wall clock, so the ones a client remembers from a previous run are never reused
+PresenceTracker::PresenceTracker( const size_t history ) : _historySize(history),
+    _version(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count()) {}
+
+auto PresenceTracker::join( const User &user ) -> bool
+{
+    std::unique_lock lock(_mutex);
+    auto [it, isInserted] = _online.try_emplace(user.id, user);
+
+    if (!isInserted)
+    {
+        return false;
+    }
+
+    it->second.password.clear();
+    it->second.isOnline = true;
+
+    _record(user.id, true);
+    return true;
+}
+
+auto PresenceTracker::leave( const int userId ) -> bool
+{
+    std::unique_lock lock(_mutex);
+
+    if (_online.erase(userId) == 0)
+    {
+        return false;
+    }
+
+    _record(userId, false);
+    return true;
+}
+
+void PresenceTracker::clear( void )
+{
+    std::unique_lock lock(_mutex);
+
+    // History goes too, pollers get a full list on the next request
+    _online.clear();
+    _history.clear();
+    _unflushed.clear();
+    _version++;
+}
+
+auto PresenceTracker::isOnline( const int userId ) const -> bool
+{
+    std::shared_lock lock(_mutex);
+    return _online.contains(userId);
+}
+
+auto PresenceTracker::getOnline( std::vector<User> &users ) const -> uint64_t
+{
+    std::shared_lock lock(_mutex);
+
+    users.reserve(users.size() + _online.size());
+    for (const auto &[id, user] : _online)
+    {
+        users.push_back(user);
+    }
+
+    return _version;
+}
+
+auto PresenceTracker::getDelta( const uint64_t sinceVersion, Delta &delta ) const -> bool
+{
+    std::shared_lock lock(_mutex);
+
+    // Unknown version (older than the history or from another run), caller needs the full list
+    if (sinceVersion > _version || (_history.empty() ? sinceVersion != _version : sinceVersion < _history.front().version - 1))
+    {
+        return false;
+    }
+
+    std::set<int> changed;
+
+    for (auto it = _history.rbegin(); it != _history.rend() && it->version > sinceVersion; it++)
+    {
+        changed.insert(it->userId);
+    }
+
+    delta.version = _version;
+    delta.total = _online.size();
+    for (int userId : changed)
+    {
+        auto it = _online.find(userId);
+
+        if (it != _online.end())
+        {
+            delta.joined.push_back(it->second);
+        }
+        else
+        {
+            delta.left.push_back(userId);
+        }
+    }
+
+    return true;
+}
+
+auto PresenceTracker::getVersion( void ) const -> uint64_t
+{
+    std::shared_lock lock(_mutex);
+    return _version;
+}
+
+auto PresenceTracker::getSize( void ) const -> size_t
+{
+    std::shared_lock lock(_mutex);
+    return _online.size();
+}
+
+auto PresenceTracker::takeChanges( void ) -> std::unordered_map<int, bool>
+{
+    std::unique_lock lock(_mutex);
+    return std::exchange(_unflushed, {});
+}
+
+void PresenceTracker::_record( const int userId, const bool isOnline )
+{
+    _history.push_back({++_version, userId});
+    while (_history.size() > _historySize)
+    {
+        _history.pop_front();
+    }
+
+    _unflushed[userId] = isOnline;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "entities.h"
+
+/* Who is online right now, versioned.
+ * Every join or leave bumps the version and lands in a bounded history,
+ * so pollers can ask for the changes since the version they have seen.
+ * Changes are also queued for a lazy write to users.is_online.
+ */
+class PresenceTracker final
+{
+public:
+    struct Delta
+    {
+        uint64_t version;
+        size_t total;
+        std::vector<User> joined;
+        std::vector<int> left;
+    };
+
+    explicit PresenceTracker( const size_t history = 1024 );
+
+    auto join( const User &user ) -> bool;
+    auto leave( const int userId ) -> bool;
+    void clear( void );
+
+    auto isOnline( const int userId ) const -> bool;
+    auto getOnline( std::vector<User> &users ) const -> uint64_t;
+    auto getDelta( const uint64_t sinceVersion, Delta &delta ) const -> bool;
+    auto getVersion( void ) const -> uint64_t;
+    auto getSize( void ) const -> size_t;
+
+    // userId -> online, everything changed since the previous call
+    auto takeChanges( void ) -> std::unordered_map<int, bool>;
+
+private:
+    struct Change
+    {
+        uint64_t version;
+        int userId;
+    };
+
+    mutable std::shared_mutex _mutex;
+    std::map<int, User> _online;
+    std::deque<Change> _history;
+    std::unordered_map<int, bool> _unflushed;
+    size_t _historySize;
+    uint64_t _version;
+
+    void _record( const int userId, const bool isOnline );
+};
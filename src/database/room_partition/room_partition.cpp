@@ -0,0 +1,80 @@
+#include "room_partition.h"
+
+RoomPartition::RoomPartition( const size_t recentMessages, const int lastId, std::vector<int> members ) :
+    _recent(recentMessages), _lastId(lastId), _members(members.begin(), members.end()) {}
+
+void RoomPartition::publish( MessagePtr message )
+{
+    int id = message->id;
+
+    // A room loaded after the commit already read it from SQL
+    if (id <= _lastId.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    _recent.append(std::move(message));
+
+    {
+        std::lock_guard lock(_waitMutex);
+        _lastId.store(id, std::memory_order_release);
+    }
+    _waitCv.notify_all();
+}
+
+auto RoomPartition::waitAfter( const int afterId, const std::chrono::milliseconds timeout ) -> bool
+{
+    std::unique_lock lock(_waitMutex);
+
+    return _waitCv.wait_for(lock, timeout, [&] {
+        return _isClosed || _lastId.load(std::memory_order_relaxed) > afterId;
+    }) && !_isClosed;
+}
+
+void RoomPartition::close( void )
+{
+    {
+        std::lock_guard lock(_waitMutex);
+        _isClosed = true;
+    }
+    _waitCv.notify_all();
+}
+
+auto RoomPartition::getLastId( void ) const -> int
+{
+    return _lastId.load(std::memory_order_acquire);
+}
+
+auto RoomPartition::getRecent( void ) -> MessageRing &
+{
+    return _recent;
+}
+
+auto RoomPartition::getRecent( void ) const -> const MessageRing &
+{
+    return _recent;
+}
+
+void RoomPartition::addMember( const int userId )
+{
+    std::unique_lock lock(_membersMutex);
+    _members.insert(userId);
+}
+
+void RoomPartition::removeMember( const int userId )
+{
+    std::unique_lock lock(_membersMutex);
+    _members.erase(userId);
+}
+
+auto RoomPartition::hasMember( const int userId ) const -> bool
+{
+    std::shared_lock lock(_membersMutex);
+    return _members.contains(userId);
+}
+
+auto RoomPartition::getMembersCount( void ) const -> size_t
+{
+    std::shared_lock lock(_membersMutex);
+    return _members.size();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "entities.h"
+#include "message_ring.h"
+
+/* In-memory side of one room: its newest messages, its members and its newest id.
+ * Every room has its own locks, so posts and polls in a busy room never wait for another one.
+ * Pollers park on the newest id and are woken by the writer thread.
+ */
+class RoomPartition final
+{
+public:
+    RoomPartition( const size_t recentMessages, const int lastId, std::vector<int> members );
+
+    // Under the write lock only, in id order
+    void publish( MessagePtr message );
+
+    // True once the room has a message after afterId, false on timeout or close()
+    auto waitAfter( const int afterId, const std::chrono::milliseconds timeout ) -> bool;
+    // Wakes every waiter for good, for shutdown and deleted rooms
+    void close( void );
+
+    auto getLastId( void ) const -> int;
+    auto getRecent( void ) -> MessageRing &;
+    auto getRecent( void ) const -> const MessageRing &;
+
+    void addMember( const int userId );
+    void removeMember( const int userId );
+    auto hasMember( const int userId ) const -> bool;
+    auto getMembersCount( void ) const -> size_t;
+
+private:
+    MessageRing _recent;
+
+    std::mutex _waitMutex;
+    std::condition_variable _waitCv;
+    std::atomic<int> _lastId;
+    bool _isClosed {};
+
+    mutable std::shared_mutex _membersMutex;
+    std::unordered_set<int> _members;
+};
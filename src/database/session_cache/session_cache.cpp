@@ -0,0 +1,67 @@
+#include <mutex>
+
+#include "session_cache.h"
+
+SessionCache::SessionCache( const size_t capacity ) : _capacity(capacity) {}
+
+auto SessionCache::find( const std::string &token ) -> std::optional<User>
+{
+    std::shared_lock lock(_mutex);
+    auto it = _sessions.find(token);
+
+    if (it == _sessions.end())
+    {
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+    _hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second;
+}
+
+void SessionCache::insert( const std::string &token, const User &user )
+{
+    std::unique_lock lock(_mutex);
+
+    if (_sessions.size() >= _capacity && !_sessions.contains(token))
+    {
+        _sessions.erase(_sessions.begin());
+    }
+
+    User &cached = _sessions[token];
+
+    cached = user;
+    cached.password.clear();
+}
+
+void SessionCache::erase( const std::string &token )
+{
+    std::unique_lock lock(_mutex);
+    _sessions.erase(token);
+}
+
+void SessionCache::eraseUser( const int userId )
+{
+    std::unique_lock lock(_mutex);
+
+    std::erase_if(_sessions, [userId]( const auto &session ) {
+        return session.second.id == userId;
+    });
+}
+
+void SessionCache::clear( void )
+{
+    std::unique_lock lock(_mutex);
+    _sessions.clear();
+}
+
+auto SessionCache::getStats( void ) const -> Stats
+{
+    std::shared_lock lock(_mutex);
+
+    return {
+        _hits.load(std::memory_order_relaxed),
+        _misses.load(std::memory_order_relaxed),
+        _sessions.size()
+    };
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "entities.h"
+
+/* Raw auth token -> resolved user.
+ * Lets authenticated requests skip hashing the token and both lookups
+ * in auth_tokens and users.
+ */
+class SessionCache final
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        size_t size;
+    };
+
+    explicit SessionCache( const size_t capacity = 65536 );
+
+    auto find( const std::string &token ) -> std::optional<User>;
+    void insert( const std::string &token, const User &user );
+    void erase( const std::string &token );
+    void eraseUser( const int userId );
+    void clear( void );
+
+    auto getStats( void ) const -> Stats;
+
+private:
+    mutable std::shared_mutex _mutex;
+    std::unordered_map<std::string, User> _sessions;
+    size_t _capacity;
+
+    std::atomic<uint64_t> _hits {};
+    std::atomic<uint64_t> _misses {};
+};
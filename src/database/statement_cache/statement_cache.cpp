@@ -0,0 +1,75 @@
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "statement_cache.h"
+
+StatementCache::Handle::Handle( SQLite::Statement &statement, std::unique_lock<std::mutex> lock ) :
+    _statement(&statement), _lock(std::move(lock)) {}
+
+StatementCache::Handle::Handle( Handle &&other ) noexcept :
+    _statement(std::exchange(other._statement, nullptr)), _lock(std::move(other._lock)) {}
+
+StatementCache::Handle::~Handle( void )
+{
+    if (!_statement)
+    {
+        return;
+    }
+
+    // Unfinished statement keeps its read transaction open, so always reset
+    _statement->tryReset();
+
+    try
+    {
+        _statement->clearBindings();
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::error("Error while release statement: {}", e.what());
+    }
+}
+
+auto StatementCache::Handle::operator ->( void ) const -> SQLite::Statement *
+{
+    return _statement;
+}
+
+auto StatementCache::Handle::operator *( void ) const -> SQLite::Statement &
+{
+    return *_statement;
+}
+
+StatementCache::StatementCache( SQLite::Database &db ) : _db(db) {}
+
+auto StatementCache::get( std::string_view sql ) -> Handle
+{
+    Entry *entry;
+
+    {
+        std::lock_guard lock(_mutex);
+        auto it = _entries.find(sql);
+
+        if (it != _entries.end())
+        {
+            entry = it->second.get();
+            _reused++;
+        }
+        else
+        {
+            auto created = std::make_unique<Entry>(_db, sql);
+
+            entry = created.get();
+            _entries.emplace(entry->statement.getQuery(), std::move(created));
+            _prepared++;
+        }
+    }
+
+    return Handle(entry->statement, std::unique_lock(entry->mutex));
+}
+
+auto StatementCache::getStats( void ) const -> Stats
+{
+    std::lock_guard lock(_mutex);
+    return {_prepared, _reused, _entries.size()};
+}
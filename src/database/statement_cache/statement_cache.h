@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+/* Prepared statements of one connection, keyed by their SQL text.
+ * A statement is locked while its handle lives and is reset on release,
+ * so never hold two handles of the same query at once.
+ */
+class StatementCache final
+{
+public:
+    struct Stats
+    {
+        uint64_t prepared;
+        uint64_t reused;
+        size_t size;
+    };
+
+    class Handle final
+    {
+    public:
+        Handle( SQLite::Statement &statement, std::unique_lock<std::mutex> lock );
+        Handle( Handle &&other ) noexcept;
+        Handle( const Handle & ) = delete;
+        ~Handle( void );
+
+        auto operator ->( void ) const -> SQLite::Statement *;
+        auto operator *( void ) const -> SQLite::Statement &;
+
+    private:
+        SQLite::Statement *_statement;
+        std::unique_lock<std::mutex> _lock;
+    };
+
+    explicit StatementCache( SQLite::Database &db );
+
+    auto get( std::string_view sql ) -> Handle;
+    auto getStats( void ) const -> Stats;
+
+private:
+    struct Entry
+    {
+        std::mutex mutex;
+        SQLite::Statement statement;
+
+        Entry( SQLite::Database &db, std::string_view sql ) : statement(db, std::string(sql)) {}
+    };
+
+    SQLite::Database &_db;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string_view, std::unique_ptr<Entry>> _entries;
+
+    uint64_t _prepared {};
+    uint64_t _reused {};
+};
@@ -0,0 +1,67 @@
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "logging.h"
+
+void Logging::init( const spdlog::level::level_enum level, const size_t queueSize )
+{
+    spdlog::init_thread_pool(queueSize, 1);
+
+    // overrun_oldest: a full queue costs old records, never a blocked request
+    auto logger = spdlog::create_async_nb<spdlog::sinks::stdout_color_sink_mt>("chat");
+
+    logger->set_level(level);
+    logger->flush_on(spdlog::level::err);
+    spdlog::set_default_logger(logger);
+}
+
+void Logging::shutdown( void )
+{
+    spdlog::shutdown();
+}
+
+auto Logging::setLevel( std::string_view level ) -> bool
+{
+    auto parsed = spdlog::level::from_str(std::string(level));
+
+    // from_str falls back to off for unknown names
+    if (parsed == spdlog::level::off && level != "off")
+    {
+        return false;
+    }
+
+    spdlog::set_level(parsed);
+    return true;
+}
+
+auto Logging::getLevel( void ) -> std::string
+{
+    auto name = spdlog::level::to_string_view(spdlog::get_level());
+
+    return std::string(name.data(), name.size());
+}
+
+auto Logging::getDropped( void ) -> size_t
+{
+    auto pool = spdlog::thread_pool();
+
+    return pool ? pool->overrun_counter() : 0;
+}
+
+LogThrottle::LogThrottle( const std::chrono::milliseconds interval ) :
+    _interval(interval), _next(std::chrono::steady_clock::now().time_since_epoch().count()) {}
+
+auto LogThrottle::acquire( void ) -> std::optional<uint64_t>
+{
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t next = _next.load(std::memory_order_relaxed);
+
+    // Only one thread wins the slot, the others are counted
+    if (now < next || !_next.compare_exchange_strong(next, now + _interval.count(), std::memory_order_relaxed))
+    {
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+    return _suppressed.exchange(0, std::memory_order_relaxed);
+}
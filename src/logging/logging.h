@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <spdlog/spdlog.h>
+
+/* Process-wide logger setup.
+ * Records are formatted and written by a background thread, request threads
+ * only push into a bounded queue that drops the oldest record when full.
+ */
+class Logging final
+{
+public:
+    static void init( const spdlog::level::level_enum level = spdlog::level::info, const size_t queueSize = 8192 );
+    static void shutdown( void );
+
+    static auto setLevel( std::string_view level ) -> bool;
+    static auto getLevel( void ) -> std::string;
+    static auto getDropped( void ) -> size_t;
+};
+
+/* Lets one record through per interval and counts the rest.
+ * For warnings a client can trigger at will, like unknown tokens.
+ */
+class LogThrottle final
+{
+public:
+    explicit LogThrottle( const std::chrono::milliseconds interval = std::chrono::seconds(1) );
+
+    // Number of records suppressed since the previous one, or nullopt if this one is suppressed too
+    auto acquire( void ) -> std::optional<uint64_t>;
+
+private:
+    std::chrono::steady_clock::duration _interval;
+    std::atomic<int64_t> _next;
+    std::atomic<uint64_t> _suppressed {};
+};
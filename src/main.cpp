@@ -1,19 +1,32 @@
+#include <cstdlib>
+
+#include "config.h"
+#include "logging.h"
 #include "server.h"
 
 int main( int argc, char *argv[] )
 {
-    spdlog::set_level(spdlog::level::trace);
+    Logging::init();
+
+    int code = EXIT_SUCCESS;
 
     try
     {
-        Server server("0.0.0.0", 8080, "chat.db");
+        auto config = ServerConfig::fromArgs(argc, argv);
+
+        Logging::setLevel(config.logLevel);
+
+        Server server(config);
 
         server.run();
-        return EXIT_SUCCESS;
     }
     catch ( const std::exception &e )
     {
-        spdlog::critical(e.what());
-        return EXIT_FAILURE;
+        spdlog::critical("{}", e.what());
+        code = EXIT_FAILURE;
     }
-}
\ No newline at end of file
+
+    // Drains the queue, records still waiting there would be lost on exit
+    Logging::shutdown();
+    return code;
+}
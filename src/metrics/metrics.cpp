@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <bit>
+#include <charconv>
+
+#include "metrics.h"
+
+namespace
+{
+    struct Bound
+    {
+        uint64_t nanoseconds;
+        std::string_view seconds;
+    };
+
+    // Exported buckets, the recorded ones are much finer and get folded into these
+    constexpr std::array<Bound, 17> kBounds = {{
+        {50'000, "0.00005"}, {100'000, "0.0001"}, {250'000, "0.00025"}, {500'000, "0.0005"},
+        {1'000'000, "0.001"}, {2'500'000, "0.0025"}, {5'000'000, "0.005"}, {10'000'000, "0.01"},
+        {25'000'000, "0.025"}, {50'000'000, "0.05"}, {100'000'000, "0.1"}, {250'000'000, "0.25"},
+        {500'000'000, "0.5"}, {1'000'000'000, "1"}, {2'500'000'000, "2.5"}, {5'000'000'000, "5"},
+        {10'000'000'000, "10"},
+    }};
+
+    void appendSeconds( std::string &out, const uint64_t nanoseconds )
+    {
+        char buffer[32];
+        auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), static_cast<double>(nanoseconds) / 1e9);
+
+        out.append(buffer, end);
+    }
+
+    auto escapeLabel( std::string_view value ) -> std::string
+    {
+        std::string escaped;
+
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+
+        return escaped;
+    }
+}
+
+void Histogram::record( const uint64_t value )
+{
+    Shard &shard = _shards[_getShard()];
+
+    // Only contended when more threads than shards record at the same moment
+    shard.buckets[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+auto Histogram::getSnapshot( void ) const -> Snapshot
+{
+    Snapshot snapshot;
+
+    for (const auto &shard : _shards)
+    {
+        for (size_t i = 0; i < kBuckets; i++)
+        {
+            uint64_t count = shard.buckets[i].load(std::memory_order_relaxed);
+
+            snapshot.buckets[i] += count;
+            snapshot.count += count;
+        }
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+
+    return snapshot;
+}
+
+auto Histogram::getBucket( const uint64_t value ) -> size_t
+{
+    constexpr uint64_t linear = 2 << kSubBits;
+    constexpr uint64_t maxValue = (uint64_t(2) << kMaxExponent) - 1;
+
+    if (value < linear)
+    {
+        return value;
+    }
+
+    uint64_t clamped = std::min(value, maxValue);
+    int exponent = std::bit_width(clamped) - 1;
+    size_t sub = (clamped >> (exponent - kSubBits)) & ((1 << kSubBits) - 1);
+
+    return linear + (exponent - kSubBits - 1) * (1 << kSubBits) + sub;
+}
+
+auto Histogram::getBucketLimit( const size_t bucket ) -> uint64_t
+{
+    constexpr size_t linear = 2 << kSubBits;
+
+    if (bucket < linear)
+    {
+        return bucket;
+    }
+
+    size_t offset = bucket - linear;
+    int shift = static_cast<int>(offset >> kSubBits) + 1;
+    uint64_t lower = (uint64_t((1 << kSubBits) + (offset & ((1 << kSubBits) - 1)))) << shift;
+
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+auto Histogram::_getShard( void ) -> size_t
+{
+    static std::atomic<size_t> nextShard {};
+    thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % kShards;
+
+    return shard;
+}
+
+void Histogram::Snapshot::merge( const Snapshot &other )
+{
+    for (size_t i = 0; i < kBuckets; i++)
+    {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+}
+
+auto Histogram::Snapshot::getPercentile( const double q ) const -> uint64_t
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < kBuckets; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            return getBucketLimit(i);
+        }
+    }
+
+    return getBucketLimit(kBuckets - 1);
+}
+
+auto Histogram::Snapshot::getCountUpTo( const uint64_t value ) const -> uint64_t
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < kBuckets && getBucketLimit(i) <= value; i++)
+    {
+        total += buckets[i];
+    }
+
+    return total;
+}
+
+void Metrics::Route::finish( const int status, const std::chrono::steady_clock::duration elapsed )
+{
+    latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    statuses[status > 0 && status < kMaxStatus ? status : 0].fetch_add(1, std::memory_order_relaxed);
+    inFlight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+auto Metrics::addRoute( std::string_view method, std::string_view path ) -> Route &
+{
+    std::lock_guard lock(_mutex);
+    auto &route = _routes.emplace_back();
+
+    route.method = method;
+    route.path = path;
+    return route;
+}
+
+auto Metrics::addTimer( std::string_view name ) -> Histogram &
+{
+    std::lock_guard lock(_mutex);
+    auto &timer = _timers.emplace_back();
+
+    timer.name = name;
+    return timer.latency;
+}
+
+void Metrics::addGauge( std::string_view name, std::string_view help, std::function<uint64_t( void )> read )
+{
+    std::lock_guard lock(_mutex);
+
+    _sampled.push_back({std::string(name), std::string(help), "gauge", std::move(read)});
+}
+
+void Metrics::addCounter( std::string_view name, std::string_view help, std::function<uint64_t( void )> read )
+{
+    std::lock_guard lock(_mutex);
+
+    _sampled.push_back({std::string(name), std::string(help), "counter", std::move(read)});
+}
+
+void Metrics::write( std::string &out ) const
+{
+    std::lock_guard lock(_mutex);
+
+    if (!_routes.empty())
+    {
+        out += "# HELP chat_http_requests_total Finished requests by route and status code.\n"
+               "# TYPE chat_http_requests_total counter\n";
+        for (const auto &route : _routes)
+        {
+            for (int status = 0; status < kMaxStatus; status++)
+            {
+                uint64_t count = route.statuses[status].load(std::memory_order_relaxed);
+
+                if (count != 0)
+                {
+                    out += "chat_http_requests_total{method=\"" + route.method + "\",route=\"" +
+                           escapeLabel(route.path) + "\",code=\"" + std::to_string(status) + "\"} " +
+                           std::to_string(count) + "\n";
+                }
+            }
+        }
+
+        out += "# HELP chat_http_requests_in_flight Requests being handled right now.\n"
+               "# TYPE chat_http_requests_in_flight gauge\n";
+        for (const auto &route : _routes)
+        {
+            out += "chat_http_requests_in_flight{method=\"" + route.method + "\",route=\"" +
+                   escapeLabel(route.path) + "\"} " +
+                   std::to_string(route.inFlight.load(std::memory_order_relaxed)) + "\n";
+        }
+
+        out += "# HELP chat_http_request_duration_seconds Time spent in route handlers.\n"
+               "# TYPE chat_http_request_duration_seconds histogram\n";
+        for (const auto &route : _routes)
+        {
+            _writeHistogram(out, "chat_http_request_duration_seconds",
+                            "method=\"" + route.method + "\",route=\"" + escapeLabel(route.path) + "\"",
+                            route.latency.getSnapshot());
+        }
+    }
+
+    if (!_timers.empty())
+    {
+        out += "# HELP chat_db_query_duration_seconds Time spent in database calls.\n"
+               "# TYPE chat_db_query_duration_seconds histogram\n";
+        for (const auto &timer : _timers)
+        {
+            _writeHistogram(out, "chat_db_query_duration_seconds", "method=\"" + escapeLabel(timer.name) + "\"",
+                            timer.latency.getSnapshot());
+        }
+    }
+
+    for (const auto &sampled : _sampled)
+    {
+        out.append("# HELP ").append(sampled.name).append(" ").append(sampled.help).append("\n");
+        out.append("# TYPE ").append(sampled.name).append(" ").append(sampled.type).append("\n");
+        out.append(sampled.name).append(" ").append(std::to_string(sampled.read())).append("\n");
+    }
+}
+
+void Metrics::_writeHistogram( std::string &out, std::string_view name, const std::string &labels,
+                               const Histogram::Snapshot &snapshot )
+{
+    for (const auto &bound : kBounds)
+    {
+        out.append(name).append("_bucket{").append(labels).append(",le=\"").append(bound.seconds).append("\"} ");
+        out += std::to_string(snapshot.getCountUpTo(bound.nanoseconds)) + "\n";
+    }
+    out.append(name).append("_bucket{").append(labels).append(",le=\"+Inf\"} ");
+    out += std::to_string(snapshot.count) + "\n";
+
+    out.append(name).append("_sum{").append(labels).append("} ");
+    appendSeconds(out, snapshot.sum);
+    out += "\n";
+
+    out.append(name).append("_count{").append(labels).append("} ");
+    out += std::to_string(snapshot.count) + "\n";
+}
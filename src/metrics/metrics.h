@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/* HDR-style histogram: exact below 16, then 8 linear sub-buckets per power of two,
+ * so any value is kept within 12.5% of itself.
+ * Every thread counts into its own shard, shards are summed only by getSnapshot().
+ */
+class Histogram final
+{
+public:
+    static constexpr int kSubBits = 3;
+    static constexpr int kMaxExponent = 40;
+    static constexpr size_t kBuckets = (2 << kSubBits) + (kMaxExponent - kSubBits) * (1 << kSubBits);
+    static constexpr size_t kShards = 16;
+
+    struct Snapshot
+    {
+        std::array<uint64_t, kBuckets> buckets {};
+        uint64_t count {};
+        uint64_t sum {};
+
+        void merge( const Snapshot &other );
+
+        // Upper limit of the bucket holding the q-th quantile, q in [0, 1]
+        auto getPercentile( const double q ) const -> uint64_t;
+        // Samples in buckets that end at or below value
+        auto getCountUpTo( const uint64_t value ) const -> uint64_t;
+    };
+
+    void record( const uint64_t value );
+    auto getSnapshot( void ) const -> Snapshot;
+
+    static auto getBucket( const uint64_t value ) -> size_t;
+    static auto getBucketLimit( const size_t bucket ) -> uint64_t;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<uint64_t>, kBuckets> buckets {};
+        std::atomic<uint64_t> sum {};
+    };
+
+    std::array<Shard, kShards> _shards;
+
+    static auto _getShard( void ) -> size_t;
+};
+
+// Records the time of its own scope into a histogram, in nanoseconds
+class ScopedTimer final
+{
+public:
+    explicit ScopedTimer( Histogram &histogram ) :
+        _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer( const ScopedTimer & ) = delete;
+    ScopedTimer & operator =( const ScopedTimer & ) = delete;
+
+    ~ScopedTimer( void )
+    {
+        auto elapsed = std::chrono::steady_clock::now() - _start;
+
+        _histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+private:
+    Histogram &_histogram;
+    std::chrono::steady_clock::time_point _start;
+};
+
+/* Series are registered up front and never removed, so the references handed out stay valid
+ * and the request path only touches atomics. Written out in Prometheus text format.
+ */
+class Metrics final
+{
+public:
+    static constexpr int kMaxStatus = 600;
+
+    struct Route
+    {
+        std::string method;
+        std::string path;
+        Histogram latency;
+        std::atomic<int64_t> inFlight {};
+        std::array<std::atomic<uint64_t>, kMaxStatus> statuses {};
+
+        void finish( const int status, const std::chrono::steady_clock::duration elapsed );
+    };
+
+    struct Timer
+    {
+        std::string name;
+        Histogram latency;
+    };
+
+    auto addRoute( std::string_view method, std::string_view path ) -> Route &;
+    // Timers are written as chat_db_query_duration_seconds{method="<name>"}
+    auto addTimer( std::string_view name ) -> Histogram &;
+
+    // Values some other object already keeps, read when the metrics are written
+    void addGauge( std::string_view name, std::string_view help, std::function<uint64_t( void )> read );
+    void addCounter( std::string_view name, std::string_view help, std::function<uint64_t( void )> read );
+
+    void write( std::string &out ) const;
+
+private:
+    struct Sampled
+    {
+        std::string name;
+        std::string help;
+        std::string_view type;
+        std::function<uint64_t( void )> read;
+    };
+
+    mutable std::mutex _mutex;
+    std::deque<Route> _routes;
+    std::deque<Timer> _timers;
+    std::deque<Sampled> _sampled;
+
+    static void _writeHistogram( std::string &out, std::string_view name, const std::string &labels,
+                                 const Histogram::Snapshot &snapshot );
+};
@@ -0,0 +1,122 @@
+#include <charconv>
+#include <vector>
+
+#include "password.h"
+#include "sha256.h"
+
+namespace
+{
+    constexpr std::string_view kScheme = "pbkdf2-sha256";
+
+    auto fromHexDigit( const char c ) -> int
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        return -1;
+    }
+
+    auto fromHex( std::string_view hex, std::vector<uint8_t> &bytes ) -> bool
+    {
+        if (hex.size() % 2 != 0)
+        {
+            return false;
+        }
+
+        bytes.resize(hex.size() / 2);
+        for (size_t i = 0; i < bytes.size(); i++)
+        {
+            int high = fromHexDigit(hex[2 * i]);
+            int low = fromHexDigit(hex[2 * i + 1]);
+
+            if (high < 0 || low < 0)
+            {
+                return false;
+            }
+            bytes[i] = static_cast<uint8_t>(high << 4 | low);
+        }
+
+        return true;
+    }
+
+    // Time does not depend on where the first difference is
+    auto isEqual( const uint8_t *a, const uint8_t *b, const size_t length ) -> bool
+    {
+        uint8_t diff = 0;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            diff |= a[i] ^ b[i];
+        }
+
+        return diff == 0;
+    }
+
+    // Cuts the field up to the next '$' off the front of text
+    auto nextField( std::string_view &text ) -> std::string_view
+    {
+        size_t end = text.find('$');
+        std::string_view field = text.substr(0, end);
+
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        return field;
+    }
+}
+
+auto Password::hash( std::string_view password, const uint8_t *salt, const size_t saltLength,
+                     const uint32_t iterations ) -> std::string
+{
+    auto digest = PBKDF2SHA256(password.data(), password.size(), salt, saltLength, iterations);
+
+    return std::string(kScheme) + "$" + std::to_string(iterations) + "$" + toHex(salt, saltLength) + "$" +
+           toHex(digest.data(), digest.size());
+}
+
+auto Password::verify( std::string_view password, std::string_view stored, const uint32_t iterations ) -> Verdict
+{
+    if (stored.find('$') == std::string_view::npos)
+    {
+        auto legacy = SHA256(std::string(password));
+
+        return stored.size() == legacy.size() &&
+               isEqual(reinterpret_cast<const uint8_t *>(stored.data()),
+                       reinterpret_cast<const uint8_t *>(legacy.data()), legacy.size()) ?
+            Verdict::kOutdated : Verdict::kMismatch;
+    }
+
+    if (nextField(stored) != kScheme)
+    {
+        return Verdict::kMismatch;
+    }
+
+    auto countField = nextField(stored);
+    uint32_t count = 0;
+    auto [end, ec] = std::from_chars(countField.data(), countField.data() + countField.size(), count);
+    std::vector<uint8_t> salt;
+    std::vector<uint8_t> expected;
+
+    if (ec != std::errc() || end != countField.data() + countField.size() || count == 0 ||
+        !fromHex(nextField(stored), salt) || !fromHex(nextField(stored), expected) ||
+        expected.size() != Sha256Hasher::kDigestSize)
+    {
+        return Verdict::kMismatch;
+    }
+
+    auto digest = PBKDF2SHA256(password.data(), password.size(), salt.data(), salt.size(), count);
+
+    if (!isEqual(digest.data(), expected.data(), digest.size()))
+    {
+        return Verdict::kMismatch;
+    }
+
+    return count < iterations ? Verdict::kOutdated : Verdict::kMatch;
+}
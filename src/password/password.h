@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/* Stored password format: "pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>".
+ * Rows written before it hold a bare SHA-256 hex digest, those still verify
+ * and are reported as outdated so the caller can store them again.
+ */
+class Password final
+{
+public:
+    enum struct Verdict
+    {
+        kMismatch,
+        kMatch,
+        // Matches, but with the legacy hash or fewer iterations than asked for
+        kOutdated,
+    };
+
+    static constexpr uint32_t kDefaultIterations = 100000;
+    static constexpr uint32_t kMinIterations = 1000;
+    static constexpr size_t kSaltBytes = 16;
+
+    static auto hash( std::string_view password, const uint8_t *salt, const size_t saltLength,
+                      const uint32_t iterations ) -> std::string;
+    static auto verify( std::string_view password, std::string_view stored, const uint32_t iterations ) -> Verdict;
+};
@@ -1,11 +1,18 @@
 class ChatManager {
     constructor() {
         this.lastMessageId = 0;
+        this.firstMessageId = 0;
+        this.historyPageSize = 100;
+        this.hasMoreHistory = true;
+        this.isLoadingHistory = false;
         this.currentUser = null;
-        this.refreshInterval = null;
         this.onlineRefreshInterval = null;
+        this.onlineVersion = null;
+        this.onlineUsers = new Map();
+        this.etags = new Map();
+        this.eventSource = null;
+        this.isPolling = false;
         this.isAutoScroll = true;
-        this.preventUpdate = false;
     }
 
     // Инициализация чата
@@ -30,7 +37,7 @@ class ChatManager {
             await this.loadStats();
             
             // Настраиваем обновления
-            this.setupAutoRefresh();
+            await this.setupAutoRefresh();
             
             // Настраиваем обработчики событий
             this.setupEventListeners();
@@ -44,14 +51,34 @@ class ChatManager {
         }
     }
 
+    // GET с валидатором: если у нас уже есть актуальный ответ, сервер вернет 304 без тела
+    async fetchWithEtag(url) {
+        const path = url.split('?')[0];
+        const headers = {
+            'Authorization-Token': `${await Utils.getToken()}`
+        };
+
+        if (this.etags.has(path)) {
+            headers['If-None-Match'] = this.etags.get(path);
+        }
+
+        const response = await fetch(url, { headers });
+        const etag = response.headers.get('ETag');
+
+        if (response.ok && etag) {
+            this.etags.set(path, etag);
+        }
+        return response;
+    }
+
     // Загрузка данных пользователя
     async loadUserData() {
         try {
-            const response = await fetch('/api/users/me', {
-                headers: {
-                    'Authorization-Token': `${await Utils.getToken()}`
-                }
-            });
+            const response = await this.fetchWithEtag('/api/users/me');
+
+            if (response.status === 304) {
+                return;
+            }
 
             if (!response.ok) {
                 throw new Error('Failed to load user data');
@@ -73,7 +100,7 @@ class ChatManager {
     // Загрузка сообщений
     async loadMessages() {
         try {
-            const response = await fetch(`/api/messages?limit=100`, {
+            const response = await fetch(`/api/messages?limit=${this.historyPageSize}`, {
                 headers: {
                     'Authorization-Token': `${await Utils.getToken()}`
                 }
@@ -86,10 +113,12 @@ class ChatManager {
             const data = await response.json();
             this.displayMessages(data.messages);
             
-            // Обновляем ID последнего сообщения
+            // Обновляем ID первого и последнего сообщения
             if (data.messages.length > 0) {
+                this.firstMessageId = data.messages[0].id;
                 this.lastMessageId = data.messages[data.messages.length - 1].id;
             }
+            this.hasMoreHistory = data.messages.length === this.historyPageSize;
             
         } catch (error) {
             console.error('Error loading messages:', error);
@@ -97,41 +126,93 @@ class ChatManager {
         }
     }
 
-    // Загрузка новых сообщений
-    async loadNewMessages() {
-        if (this.preventUpdate) {
-            this.preventUpdate = false;
+    // Подгрузка более старых сообщений при прокрутке вверх
+    async loadOlderMessages() {
+        if (!this.hasMoreHistory || this.isLoadingHistory || this.firstMessageId === 0) {
             return;
         }
 
+        this.isLoadingHistory = true;
+
         try {
-            const response = await fetch(`/api/messages/new?after_id=${this.lastMessageId}`, {
+            const response = await fetch(
+                `/api/messages?limit=${this.historyPageSize}&before_id=${this.firstMessageId}`, {
                 headers: {
                     'Authorization-Token': `${await Utils.getToken()}`
                 }
             });
 
+            if (!response.ok) {
+                throw new Error('Failed to load older messages');
+            }
+
+            const data = await response.json();
+
+            this.hasMoreHistory = data.messages.length === this.historyPageSize;
+
+            if (data.messages.length > 0) {
+                this.firstMessageId = data.messages[0].id;
+                this.prependMessages(data.messages);
+            }
+        } catch (error) {
+            console.error('Error loading older messages:', error);
+        } finally {
+            this.isLoadingHistory = false;
+        }
+    }
+
+    // Загрузка новых сообщений (wait > 0 - сервер держит запрос до появления сообщений)
+    async loadNewMessages(wait = 0) {
+        try {
+            const response = await this.fetchWithEtag(`/api/messages/new?after_id=${this.lastMessageId}&wait=${wait}`);
+
+            // Новых сообщений нет
+            if (response.status === 304) {
+                return true;
+            }
+
+            // Сервер не может держать еще один опрос: ждем, сколько он просит, со случайной добавкой
+            if (response.status === 503) {
+                const retryAfter = Number(response.headers.get('Retry-After')) || 2;
+
+                await new Promise(resolve => setTimeout(resolve, retryAfter * 1000 * (1 + Math.random())));
+                return true;
+            }
+
             if (!response.ok) {
                 alert("Failed to load messages, try to relogin");
                 window.location.href = '/';
-                return;
+                return false;
             }
 
             const data = await response.json();
             
-            if (data.messages && data.messages.length > 0) {
-                this.displayMessages(data.messages, true);
-                this.lastMessageId = data.messages[data.messages.length - 1].id;
-                
-                // Воспроизводим звук нового сообщения (опционально)
-                this.playNotificationSound();
+            if (data.messages) {
+                this.appendNewMessages(data.messages);
             }
+            return true;
             
         } catch (error) {
             console.error('Error loading new messages:', error);
+            return false;
         }
     }
 
+    // Добавление новых сообщений (поток и опрос могут прислать одно и то же)
+    appendNewMessages(messages) {
+        const fresh = messages.filter(message => message.id > this.lastMessageId);
+
+        if (fresh.length === 0) {
+            return;
+        }
+
+        this.displayMessages(fresh, true);
+        this.lastMessageId = fresh[fresh.length - 1].id;
+
+        // Воспроизводим звук нового сообщения (опционально)
+        this.playNotificationSound();
+    }
+
     // Отправка сообщения
     async sendMessage(messageText) {
         const sendBtn = document.getElementById('sendBtn');
@@ -159,10 +240,10 @@ class ChatManager {
             // Очищаем поле ввода
             messageInput.value = '';
             
-            // Обновляем сообщения
-            this.preventUpdate = false;
-            await this.loadNewMessages();
-            this.preventUpdate = true;
+            // Обновляем сообщения (при активном потоке или опросе сообщение придет само)
+            if (!this.eventSource && !this.isPolling) {
+                await this.loadNewMessages();
+            }
             
         } catch (error) {
             console.error('Error sending message:', error);
@@ -199,6 +280,20 @@ class ChatManager {
         }
     }
 
+    // Вставка старых сообщений сверху без сдвига видимой части
+    prependMessages(messages) {
+        const container = document.getElementById('messagesContainer');
+        const fragment = document.createDocumentFragment();
+        const previousHeight = container.scrollHeight;
+
+        messages.forEach(message => {
+            fragment.appendChild(this.createMessageElement(message));
+        });
+
+        container.insertBefore(fragment, container.firstChild);
+        container.scrollTop += container.scrollHeight - previousHeight;
+    }
+
     // Создание элемента сообщения
     createMessageElement(message) {
         const messageDiv = document.createElement('div');
@@ -221,14 +316,16 @@ class ChatManager {
         return messageDiv;
     }
 
-    // Загрузка онлайн пользователей
+    // Загрузка онлайн пользователей (после первого раза - только изменения)
     async loadOnlineUsers() {
         try {
-            const response = await fetch('/api/users/online', {
-                headers: {
-                    'Authorization-Token': `${await Utils.getToken()}`
-                }
-            });
+            const query = this.onlineVersion === null ? '' : `?since_version=${this.onlineVersion}`;
+            const response = await this.fetchWithEtag(`/api/users/online${query}`);
+
+            // Никто не входил и не выходил
+            if (response.status === 304) {
+                return;
+            }
 
             if (!response.ok) {
                 alert("Failed to load messages, try to relogin");
@@ -238,7 +335,15 @@ class ChatManager {
 
             const data = await response.json();
 
-            this.displayOnlineUsers(data.online_users);
+            if (data.online_users) {
+                this.onlineUsers = new Map(data.online_users.map(user => [user.id, user]));
+            } else {
+                data.left.forEach(id => this.onlineUsers.delete(id));
+                data.joined.forEach(user => this.onlineUsers.set(user.id, user));
+            }
+
+            this.onlineVersion = data.version;
+            this.displayOnlineUsers([...this.onlineUsers.values()].sort((a, b) => a.id - b.id));
             document.getElementById('onlineCount').textContent = data.total_online;
             
         } catch (error) {
@@ -263,50 +368,78 @@ class ChatManager {
         `).join('');
     }
 
-    // Загрузка статистики
+    // Загрузка статистики (все счетчики одним запросом)
     async loadStats() {
         try {
-            const messagesResponse = await fetch('/api/messages/count', {
-                headers: {
-                    'Authorization-Token': `${await Utils.getToken()}`
-                }
-            });
-            
-            const usersResponse = await fetch('/api/users/count', {
-                headers: {
-                    'Authorization-Token': `${await Utils.getToken()}`
-                }
-            });
+            const response = await this.fetchWithEtag('/api/stats');
 
-            if (messagesResponse.ok) {
-                const messagesData = await messagesResponse.json();
-                document.getElementById('totalMessages').textContent = messagesData.count;
-            } else {
-                alert("Failed to load messages count, try to relogin");
-                window.location.href = '/';
+            // Счетчики не изменились
+            if (response.status === 304) {
                 return;
             }
 
-            if (usersResponse.ok) {
-                const usersData = await usersResponse.json();
-                document.getElementById('totalUsers').textContent = usersData.count;
-            } else {
-                alert("Failed to load users count, try to relogin");
+            if (!response.ok) {
+                alert("Failed to load stats, try to relogin");
                 window.location.href = '/';
                 return;
             }
+
+            const stats = await response.json();
+
+            document.getElementById('totalMessages').textContent = stats.messages;
+            document.getElementById('totalUsers').textContent = stats.users;
             
         } catch (error) {
             console.error('Error loading stats:', error);
         }
     }
 
+    // Подписка на поток новых сообщений
+    async setupMessageStream() {
+        if (typeof EventSource === 'undefined') {
+            return false;
+        }
+
+        const token = encodeURIComponent(await Utils.getToken());
+
+        this.eventSource = new EventSource(
+            `/api/messages/stream?token=${token}&after_id=${this.lastMessageId}`);
+
+        this.eventSource.addEventListener('message', (event) => {
+            this.appendNewMessages([JSON.parse(event.data)]);
+        });
+
+        // Сервер отказал в потоке - возвращаемся к периодическому опросу
+        this.eventSource.onerror = () => {
+            if (this.eventSource.readyState === EventSource.CLOSED) {
+                this.eventSource = null;
+                this.setupPolling();
+            }
+        };
+
+        return true;
+    }
+
+    // Долгий опрос: следующий запрос уходит сразу после ответа на предыдущий
+    async setupPolling() {
+        if (this.isPolling) {
+            return;
+        }
+
+        this.isPolling = true;
+
+        while (this.isPolling) {
+            if (!(await this.loadNewMessages(25000))) {
+                await new Promise(resolve => setTimeout(resolve, 1500));
+            }
+        }
+    }
+
     // Настройка автоматического обновления
-    setupAutoRefresh() {
-        // Обновление сообщений каждые 1.5 секунды
-        this.refreshInterval = setInterval(() => {
-            this.loadNewMessages();
-        }, 1500);
+    async setupAutoRefresh() {
+        if (!(await this.setupMessageStream())) {
+            this.setupPolling();
+        }
 
         // Обновление онлайн пользователей каждые 5 секунд
         this.onlineRefreshInterval = setInterval(() => {
@@ -368,6 +501,10 @@ class ChatManager {
         messagesContainer.addEventListener('scroll', () => {
             const isAtBottom = messagesContainer.scrollHeight - messagesContainer.clientHeight <= messagesContainer.scrollTop + 10;
             this.isAutoScroll = isAtBottom;
+
+            if (messagesContainer.scrollTop < 50) {
+                this.loadOlderMessages();
+            }
         });
     }
 
@@ -435,9 +572,10 @@ class ChatManager {
 
     // Очистка при размонтировании
     destroy() {
-        if (this.refreshInterval) {
-            clearInterval(this.refreshInterval);
+        if (this.eventSource) {
+            this.eventSource.close();
         }
+        this.isPolling = false;
         if (this.onlineRefreshInterval) {
             clearInterval(this.onlineRefreshInterval);
         }
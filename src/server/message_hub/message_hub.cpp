@@ -0,0 +1,121 @@
+#include "message_hub.h"
+
+MessageHub::Subscription::Subscription( MessageHub &hub ) : _hub(hub.subscribe() ? &hub : nullptr) {}
+
+MessageHub::Subscription::~Subscription( void )
+{
+    if (_hub)
+    {
+        _hub->unsubscribe();
+    }
+}
+
+MessageHub::Subscription::operator bool( void ) const
+{
+    return _hub != nullptr;
+}
+
+MessageHub::MessageHub( const size_t backlog, const size_t maxSubscribers ) :
+    _backlog(backlog), _maxSubscribers(maxSubscribers) {}
+
+void MessageHub::reset( const int lastId )
+{
+    std::lock_guard lock(_mutex);
+
+    _events.clear();
+    _lastId = lastId;
+}
+
+void MessageHub::publish( MessagePtr message )
+{
+    {
+        std::lock_guard lock(_mutex);
+
+        _lastId = message->id;
+        _events.push_back(std::move(message));
+
+        while (_events.size() > _backlog)
+        {
+            _events.pop_front();
+        }
+    }
+    _cv.notify_all();
+}
+
+void MessageHub::shutdown( void )
+{
+    {
+        std::lock_guard lock(_mutex);
+        _stopped = true;
+    }
+    _cv.notify_all();
+}
+
+auto MessageHub::waitAfter( const int afterId, const std::chrono::milliseconds timeout ) -> bool
+{
+    std::unique_lock lock(_mutex);
+
+    return _cv.wait_for(lock, timeout, [&] {return _stopped || _lastId > afterId;}) && !_stopped;
+}
+
+auto MessageHub::eventsAfter( const int afterId, std::vector<MessagePtr> &events ) const -> bool
+{
+    std::lock_guard lock(_mutex);
+
+    // Some of the requested events were already dropped from the backlog
+    if (_events.empty() ? afterId < _lastId : afterId < _events.front()->id - 1)
+    {
+        return false;
+    }
+
+    for (const auto &event : _events)
+    {
+        if (event->id > afterId)
+        {
+            events.push_back(event);
+        }
+    }
+
+    return true;
+}
+
+auto MessageHub::subscribe( void ) -> bool
+{
+    std::lock_guard lock(_mutex);
+
+    if (_stopped || _subscribers >= _maxSubscribers)
+    {
+        return false;
+    }
+
+    _subscribers++;
+    return true;
+}
+
+void MessageHub::unsubscribe( void )
+{
+    std::lock_guard lock(_mutex);
+
+    if (_subscribers > 0)
+    {
+        _subscribers--;
+    }
+}
+
+auto MessageHub::getLastId( void ) const -> int
+{
+    std::lock_guard lock(_mutex);
+    return _lastId;
+}
+
+auto MessageHub::getSubscribersCount( void ) const -> size_t
+{
+    std::lock_guard lock(_mutex);
+    return _subscribers;
+}
+
+auto MessageHub::isStopped( void ) const -> bool
+{
+    std::lock_guard lock(_mutex);
+    return _stopped;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "entities.h"
+
+/* In-process fan-out of freshly posted messages.
+ * Messages are kept in a short backlog with their serialized JSON,
+ * subscribers only remember the last id they have delivered.
+ */
+class MessageHub final
+{
+public:
+    // Holds one subscriber slot until it is destroyed, false when the hub refused it
+    class Subscription final
+    {
+    public:
+        explicit Subscription( MessageHub &hub );
+        Subscription( const Subscription & ) = delete;
+        ~Subscription( void );
+
+        explicit operator bool( void ) const;
+
+    private:
+        MessageHub *_hub;
+    };
+
+    explicit MessageHub( const size_t backlog = 256, const size_t maxSubscribers = 256 );
+
+    void reset( const int lastId );
+    void publish( MessagePtr message );
+    void shutdown( void );
+
+    auto waitAfter( const int afterId, const std::chrono::milliseconds timeout ) -> bool;
+    auto eventsAfter( const int afterId, std::vector<MessagePtr> &events ) const -> bool;
+
+    auto subscribe( void ) -> bool;
+    void unsubscribe( void );
+
+    auto getLastId( void ) const -> int;
+    auto getSubscribersCount( void ) const -> size_t;
+    auto isStopped( void ) const -> bool;
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<MessagePtr> _events;
+
+    size_t _backlog;
+    size_t _maxSubscribers;
+    size_t _subscribers {};
+    int _lastId {};
+    bool _stopped {};
+};
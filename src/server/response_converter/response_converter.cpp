@@ -3,4 +3,38 @@
 auto ResponseConverter::toJson( const ErrorSchema &error ) -> Json
 {
     return Json {{"status", "error"}, {"error", error.error}, {"message", error.message}};
-}
\ No newline at end of file
+}
+
+auto ResponseConverter::toMessagesPage( const std::vector<MessagePtr> &messages ) -> std::string
+{
+    static const std::string head = R"({"messages":[)";
+    static const std::string tail = R"(],"total_count":)";
+
+    std::string count = std::to_string(messages.size());
+    size_t size = head.size() + tail.size() + count.size() + 1 + messages.size();
+
+    for (const auto &msg : messages)
+    {
+        size += msg->json.size();
+    }
+
+    std::string payload;
+
+    payload.reserve(size);
+    payload += head;
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        if (i > 0)
+        {
+            payload += ',';
+        }
+        payload += messages[i]->json;
+    }
+
+    payload += tail;
+    payload += count;
+    payload += '}';
+
+    return payload;
+}
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include <nlohmann/json.hpp>
 
+#include "entities.h"
+
 struct ErrorSchema
 {
     std::string error;
@@ -16,5 +21,8 @@ private:
 public:
 
     static auto toJson( const ErrorSchema &error ) -> Json;
+
+    // Same bytes as dumping {"messages": [...], "total_count": N}, spliced from cached message JSON
+    static auto toMessagesPage( const std::vector<MessagePtr> &messages ) -> std::string;
 };
 
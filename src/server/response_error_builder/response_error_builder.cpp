@@ -11,6 +11,21 @@ void ErrorResponseBuilder::unauthorized( const std::string &message )
     _buildError("not_found", message, ErrorCode::kUnauthorized);
 }
 
+void ErrorResponseBuilder::forbidden( const std::string &message )
+{
+    _buildError("forbidden", message, ErrorCode::kForbidden);
+}
+
+void ErrorResponseBuilder::notFound( const std::string &message )
+{
+    _buildError("not_found", message, ErrorCode::kNotFound);
+}
+
+void ErrorResponseBuilder::conflict( const std::string &message )
+{
+    _buildError("conflict", message, ErrorCode::kConflict);
+}
+
 void ErrorResponseBuilder::validationError( const std::string &message )
 {
     _buildError("validation_error", message, ErrorCode::kValidationError);
@@ -21,6 +36,11 @@ void ErrorResponseBuilder::internal( const std::string &message )
     _buildError("internal_server_error", message, ErrorCode::kInternal);
 }
 
+void ErrorResponseBuilder::serviceUnavailable( const std::string &message )
+{
+    _buildError("service_unavailable", message, ErrorCode::kServiceUnavailable);
+}
+
 void ErrorResponseBuilder::_buildError( const std::string &error, const std::string &message, ErrorCode code )
 {
     ErrorSchema err;
@@ -4,8 +4,12 @@ enum struct ErrorCode
 {
     kBadRequest = 400,
     kUnauthorized = 401,
+    kForbidden = 403,
+    kNotFound = 404,
+    kConflict = 409,
     kValidationError = 422,
     kInternal = 500,
+    kServiceUnavailable = 503,
 };
 
 class ErrorResponseBuilder
@@ -22,6 +26,10 @@ public:
 
     void badRequest( const std::string &message );
     void unauthorized( const std::string &message );
+    void forbidden( const std::string &message );
+    void notFound( const std::string &message );
+    void conflict( const std::string &message );
     void validationError( const std::string &message );
     void internal( const std::string &message );
+    void serviceUnavailable( const std::string &message );
 };
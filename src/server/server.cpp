@@ -1,68 +1,168 @@
+#include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <format>
-#include <filesystem>
-#include <fstream>
+#include <future>
 #include <sstream>
 #include <iterator>
-#include <regex>
 
 #include <spdlog/spdlog.h>
 
 #include "server.h"
+#include "compression.h"
 #include "response_converter.h"
 #include "response_error_builder.h"
-
-Server::Server( const std::string &host, const int port, const std::string &dbName ) :
-    _db(dbName), _server(nullptr), _host(host), _port(port) {}
-
-auto Server::readFile( const std::string &filename ) -> std::string
+#include "validation.h"
+
+Server::Server( const std::string &host, const int port, const std::string &dbName, const bool devMode ) :
+    Server(ServerConfig {.host = host, .port = port, .database = dbName, .devMode = devMode}) {}
+
+Server::Server( const ServerConfig &config ) :
+    _config(config), _hub(256, config.maxStreams),
+    _db(config.database, DatabaseOptions {
+        .readers = config.threads,
+        .cacheSizeKiB = config.sqliteCacheKiB,
+        .mmapSize = config.sqliteMmapSize,
+        .passwordIterations = config.kdfIterations
+    }),
+    _assets(StaticAssets::getDefaultRoot(), config.devMode), _authPool(config.authWorkers, config.authQueue)
 {
-    std::filesystem::path fullPath = __FILE__;
+    _hub.reset(_db.getRoomLastId(Database::kGeneralRoom));
+    _etagEpoch = std::format("{:x}", std::chrono::system_clock::now().time_since_epoch().count());
+
+    // Writer thread reports messages in commit order, so the hub never sees ids go backwards.
+    // The event stream is the general room, the other rooms are polled
+    _db.setMessageListener([this]( const MessagePtr &msg ) {
+        if (msg->roomId == Database::kGeneralRoom)
+        {
+            _hub.publish(msg);
+        }
+    });
 
-    fullPath = fullPath.parent_path().parent_path();
-    fullPath += "/public/" + filename;
+    _metrics.addGauge("chat_auth_pool_workers", "Threads of the login and registration pool.", [this] {
+        return _authPool.getStats().workers;
+    });
+    _metrics.addGauge("chat_auth_pool_busy", "Auth pool threads running a request.", [this] {
+        return _authPool.getStats().busy;
+    });
+    _metrics.addGauge("chat_auth_pool_queued", "Auth requests waiting for a thread.", [this] {
+        return _authPool.getStats().queued;
+    });
+    _metrics.addCounter("chat_auth_pool_rejected_total", "Auth requests answered 503 because the pool was full.", [this] {
+        return _authPool.getStats().rejected;
+    });
 
-    std::ifstream file(fullPath);
+    _metrics.addCounter("chat_http_compressed_responses_total", "JSON responses sent compressed.", [this] {
+        return _compressedResponses.load(std::memory_order_relaxed);
+    });
+    _metrics.addCounter("chat_http_compression_input_bytes_total", "Size of compressed responses before compression.", [this] {
+        return _compressionInputBytes.load(std::memory_order_relaxed);
+    });
+    _metrics.addCounter("chat_http_compression_output_bytes_total", "Size of compressed responses as sent.", [this] {
+        return _compressionOutputBytes.load(std::memory_order_relaxed);
+    });
 
-    if (!file)
+    if (config.authWorkers + config.authQueue >= config.threads)
     {
-        return ""; 
+        spdlog::warn("Auth pool can hold all {} HTTP workers, logins may starve the other requests", config.threads);
     }
-    std::string content(
-        (std::istreambuf_iterator<char>(file)),
-        std::istreambuf_iterator<char>()
-    );
-
-    return content;
 }
 
 void Server::run( void )
 {
-    if (_server)
     {
-        spdlog::warn("Server is already existed!");
-        return;
+        std::lock_guard lock(_runMutex);
+
+        if (_server)
+        {
+            spdlog::warn("Server is already existed!");
+            return;
+        }
+
+        _server = std::make_unique<httplib::Server>();
     }
 
-    _server = std::make_unique<httplib::Server>();
+    // Every event stream holds a worker for its whole life, keep the usual pool free for requests
+    _server->new_task_queue = [threads = _config.threads + _config.maxStreams, maxQueued = _config.maxQueuedRequests] {
+        return new httplib::ThreadPool(threads, maxQueued);
+    };
+
+    _server->set_keep_alive_max_count(_config.keepAliveMaxCount);
+    _server->set_keep_alive_timeout(_config.keepAliveTimeout.count());
+    _server->set_read_timeout(_config.readTimeout.count());
+    _server->set_write_timeout(_config.writeTimeout.count());
+    _server->set_payload_max_length(_config.maxBodySize);
 
-    spdlog::info("Running server on " + _host + ":" + std::to_string(_port) + "...");
+    spdlog::info("Running server on {}:{} with {} workers...", _config.host, _config.port, _config.threads);
 
     httplib::Headers corsHeaders = {
         {"Access-Control-Allow-Origin", "*"},
         {"Access-Control-Allow-Methods", "*"},
-        {"Access-Control-Allow-Headers", "*"}};
+        {"Access-Control-Allow-Headers", "*"},
+        {"Access-Control-Expose-Headers", "ETag, Retry-After"}};
 
     _server->set_default_headers(corsHeaders);
+    _server->set_post_routing_handler([this]( const Request &req, Response &res ) {
+        _compressResponse(req, res);
+    });
 
     _setupHandlers();
     _setupStaticHandlers();
 
-    _startedAt = getCurrentTimestamp();
+    {
+        std::lock_guard lock(_runMutex);
+
+        _startedAt = getCurrentTimestamp();
+
+        // stop() came before the server was set up
+        if (_isStopped)
+        {
+            _hub.shutdown();
+            _db.interruptWaits();
+            return;
+        }
+        _runCv.notify_all();
+    }
 
-    if (!_server->listen(_host, _port)) {
+    if (!_server->listen(_config.host, _config.port)) {
+        _hub.shutdown();
+        _db.interruptWaits();
         throw std::runtime_error("Server run error!");
     }
+
+    _hub.shutdown();
+    _db.interruptWaits();
+}
+
+auto Server::waitUntilReady( void ) -> bool
+{
+    {
+        std::unique_lock lock(_runMutex);
+
+        _runCv.wait(lock, [this] {
+            return _isStopped || (_server && !_startedAt.empty());
+        });
+
+        if (_isStopped)
+        {
+            return false;
+        }
+    }
+
+    _server->wait_until_ready();
+    return _server->is_running();
+}
+
+void Server::stop( void )
+{
+    std::lock_guard lock(_runMutex);
+
+    _isStopped = true;
+    if (_server)
+    {
+        _server->stop();
+    }
+    _runCv.notify_all();
 }
 
 auto Server::getCurrentTimestamp( void ) -> std::string
@@ -74,12 +174,40 @@ auto Server::getCurrentTimestamp( void ) -> std::string
     return std::format(R"({:%Y-%m-%d %H:%M:%S})", localSeconds);
 }
 
-void Server::_handleAlive( const Request &req, Response &res )
+void Server::_handleAlive( const Request &, Response &res )
 {
+    auto assets = _assets.getStats();
+    auto authPool = _authPool.getStats();
     Json status = {
         {"status", "online"},
         {"started_at", _startedAt},
-        {"timestamp", getCurrentTimestamp()}
+        {"timestamp", getCurrentTimestamp()},
+        {"database", _db.getStats()},
+        {"static_assets", {
+            {"count", assets.count},
+            {"bytes", assets.bytes},
+            {"compressed_bytes", assets.compressedBytes},
+            {"embedded", assets.isEmbedded},
+            {"hot_reload", assets.isHotReload}
+        }},
+        {"config", _config.toJson()},
+        {"auth_pool", {
+            {"workers", authPool.workers},
+            {"busy", authPool.busy},
+            {"queued", authPool.queued},
+            {"max_queued", authPool.maxQueued},
+            {"completed", authPool.completed},
+            {"rejected", authPool.rejected}
+        }},
+        {"compression", {
+            {"responses", _compressedResponses.load(std::memory_order_relaxed)},
+            {"input_bytes", _compressionInputBytes.load(std::memory_order_relaxed)},
+            {"output_bytes", _compressionOutputBytes.load(std::memory_order_relaxed)}
+        }},
+        {"logging", {
+            {"level", Logging::getLevel()},
+            {"dropped", Logging::getDropped()}
+        }}
     };
 
     res.status = StatusCode::OK_200;
@@ -98,13 +226,21 @@ void Server::_handleRegister( const Request &req, Response &res )
         user.firstName = inputUser["first_name"];
         user.lastName = inputUser["last_name"];
 
-        std::regex loginReg("^[a-zA-Z0-9_]{3,20}$");
+        const std::pair<std::string_view, Validation::Verdict> checks[] = {
+            {"Login", Validation::checkLogin(user.login)},
+            {"Password", Validation::checkPassword(user.password)},
+            {"First name", Validation::checkName(user.firstName)},
+            {"Last name", Validation::checkName(user.lastName)},
+        };
 
-        if (!std::regex_match(user.login, loginReg) || user.firstName.length() < 2)
+        for (const auto &[field, verdict] : checks)
         {
-            ErrorResponseBuilder(res).badRequest("Login, first and last name should be normal!");
-            spdlog::warn("Incorrect register arguments!");
-            return;
+            if (verdict != Validation::Verdict::kValid)
+            {
+                ErrorResponseBuilder(res).badRequest(std::format("{} {}!", field, Validation::describe(verdict)));
+                spdlog::debug("Incorrect register arguments: {} {}", field, Validation::describe(verdict));
+                return;
+            }
         }
 
         auto err = _db.addUser(user);
@@ -112,7 +248,7 @@ void Server::_handleRegister( const Request &req, Response &res )
         if (err)
         {
             ErrorResponseBuilder(res).badRequest(err.message);
-            spdlog::warn(err.message);
+            spdlog::warn("{}", err.message);
             return;
         }
 
@@ -125,7 +261,7 @@ void Server::_handleRegister( const Request &req, Response &res )
     }
     catch ( const std::exception &e )
     {
-        spdlog::warn(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " + e.what());
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
         ErrorResponseBuilder(res).badRequest("Error while parsing user!");
     }
 }
@@ -145,12 +281,24 @@ void Server::processErrors( Response &res, const Database::Error &err )
     case StatusCode::Unauthorized_401:
         ErrorResponseBuilder(res).unauthorized(err.message);
         break;
+    case StatusCode::Forbidden_403:
+        ErrorResponseBuilder(res).forbidden(err.message);
+        break;
+    case StatusCode::NotFound_404:
+        ErrorResponseBuilder(res).notFound(err.message);
+        break;
+    case StatusCode::Conflict_409:
+        ErrorResponseBuilder(res).conflict(err.message);
+        break;
+    case StatusCode::ServiceUnavailable_503:
+        ErrorResponseBuilder(res).serviceUnavailable(err.message);
+        break;
     case StatusCode::InternalServerError_500:
     default:
         ErrorResponseBuilder(res).internal(err.message);
         break;
     }
-    spdlog::warn(err.message);
+    spdlog::warn("{}", err.message);
 }
 
 void Server::_handleLogin( const Request &req, Response &res )
@@ -179,7 +327,7 @@ void Server::_handleLogin( const Request &req, Response &res )
     }
     catch ( const std::exception &e )
     {
-        spdlog::warn(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " + e.what());
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
         ErrorResponseBuilder(res).badRequest("Error while parsing user!");
     }
 }
@@ -211,13 +359,22 @@ void Server::_handleMe( const Request &req, Response &res )
     if (!userOpt)
     {
         ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
+        _warnUnknownToken(token);
+        return;
+    }
+
+    // Rows do not change after registration, only presence does
+    auto etag = _makeEtag(std::format("u{}-{:d}", userOpt.value().id, userOpt.value().isOnline));
+
+    if (_respondNotModified(req, res, etag))
+    {
         return;
     }
 
     Json user = userOpt.value().toJson();
 
     res.status = StatusCode::OK_200;
+    res.set_header("ETag", etag);
     res.set_content(user.dump(), "application/json");
 }
 
@@ -228,23 +385,67 @@ void Server::_handleOnline( const Request &req, Response &res )
     if (!_db.isTokenExists(token))
     {
         ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
+        _warnUnknownToken(token);
+        return;
+    }
+
+    auto toJsons = []( const std::vector<User> &users ) {
+        Json usersJsons = Json::array();
+
+        std::transform(users.begin(), users.end(), std::back_inserter(usersJsons), 
+                       []( const User &user ) {return user.toJson();});
+        return usersJsons;
+    };
+
+    PresenceTracker::Delta delta;
+    // Response is fixed by the version it is built from and, for deltas, the version asked about
+    std::string since = req.has_param("since_version") ? req.get_param_value("since_version") : "";
+    auto makeEtag = [&]( const uint64_t version ) {
+        return _makeEtag(std::format("p{}-{}", since, version));
+    };
+
+    if (_respondNotModified(req, res, makeEtag(_db.getOnlineVersion())))
+    {
         return;
     }
 
-    auto users = _db.getOnlineUsers();
-    Json usersJsons = Json::array();
+    try
+    {
+        // Client that knows a recent version only gets who joined and who left since
+        if (!since.empty() && _db.getOnlineDelta(std::stoull(since), delta))
+        {
+            Json changes = {
+                {"version", delta.version},
+                {"total_online", delta.total},
+                {"joined", toJsons(delta.joined)},
+                {"left", delta.left}
+            };
+
+            res.status = StatusCode::OK_200;
+            res.set_header("ETag", makeEtag(delta.version));
+            res.set_content(changes.dump(), "application/json");
+            return;
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
+        ErrorResponseBuilder(res).badRequest("Incorrect since_version!");
+        return;
+    }
 
-    std::transform(users.begin(), users.end(), std::back_inserter(usersJsons), 
-                   []( const User &user ) {return user.toJson();});
+    std::vector<User> users;
+    uint64_t version = _db.getOnlineSnapshot(users);
 
     Json usersOnline = {
+        {"version", version},
         {"total_online", users.size()},
-        {"online_users", usersJsons}
+        {"online_users", toJsons(users)}
     };
 
     res.status = StatusCode::OK_200;
-    res.set_content(usersOnline.dump(), "applciation/json");
+    res.set_header("ETag", makeEtag(version));
+    res.set_content(usersOnline.dump(), "application/json");
 }
 
 void Server::_handleUsersCount( const Request &req, Response &res )
@@ -254,11 +455,17 @@ void Server::_handleUsersCount( const Request &req, Response &res )
     if (!_db.isTokenExists(token))
     {
         ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
+        _warnUnknownToken(token);
         return;
     }
 
-    int count = _db.getAllUsers().size();
+    int count = _db.getCounts().users;
+    auto etag = _makeEtag(std::format("c{}", count));
+
+    if (_respondNotModified(req, res, etag))
+    {
+        return;
+    }
 
     Json countResp = {
         {"status", "success"},
@@ -266,6 +473,7 @@ void Server::_handleUsersCount( const Request &req, Response &res )
     };
 
     res.status = StatusCode::OK_200;
+    res.set_header("ETag", etag);
     res.set_content(countResp.dump(), "application/json");
 }
 
@@ -274,7 +482,48 @@ auto Server::getAuthorizationToken( const Request &req ) -> std::string
     return req.get_header_value("Authorization-Token");
 }
 
-void Server::_handleMessagesPost( const Request &req, Response &res )
+void Server::_warnUnknownToken( const std::string &token )
+{
+    auto suppressed = _unknownTokenLog.acquire();
+
+    if (!suppressed)
+    {
+        return;
+    }
+
+    // A prefix is enough to tell clients apart and keeps tokens out of the log
+    std::string_view prefix(token);
+
+    prefix = prefix.substr(0, 8);
+    if (suppressed.value() > 0)
+    {
+        spdlog::warn("Unknown token '{}...'! ({} more suppressed)", prefix, suppressed.value());
+    }
+    else
+    {
+        spdlog::warn("Unknown token '{}...'!", prefix);
+    }
+}
+
+auto Server::_makeEtag( std::string_view tag ) const -> std::string
+{
+    return std::format("W/\"{}-{}\"", _etagEpoch, tag);
+}
+
+auto Server::_respondNotModified( const Request &req, Response &res, const std::string &etag ) -> bool
+{
+    // If-None-Match compares weakly, so the tag is matched without its W/ prefix
+    if (!StaticAssets::isNotModified(req.get_header_value("If-None-Match"), etag.substr(2)))
+    {
+        return false;
+    }
+
+    res.status = StatusCode::NotModified_304;
+    res.set_header("ETag", etag);
+    return true;
+}
+
+void Server::_handleMessagesPost( const Request &req, Response &res, const int roomId )
 {
     const std::string token = getAuthorizationToken(req);
     auto userOpt = _db.getUserByToken(token);
@@ -282,7 +531,11 @@ void Server::_handleMessagesPost( const Request &req, Response &res )
     if (!userOpt)
     {
         ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
+        _warnUnknownToken(token);
+        return;
+    }
+    if (!_checkRoomAccess(roomId, userOpt.value().id, res))
+    {
         return;
     }
 
@@ -290,7 +543,17 @@ void Server::_handleMessagesPost( const Request &req, Response &res )
     {
         Json body = Json::parse(req.body);
         std::string text = body["message_text"];
-        auto err = _db.sendMessage(userOpt.value().id, text);
+        auto verdict = Validation::checkMessage(text);
+
+        // Spam and garbage stop here instead of taking a slot in the write queue
+        if (verdict != Validation::Verdict::kValid)
+        {
+            ErrorResponseBuilder(res).validationError(std::format("Message {}!", Validation::describe(verdict)));
+            return;
+        }
+
+        // Waits for the batch with this message to commit, subscribers get it from the writer thread
+        auto [msg, err] = _db.queueMessage(userOpt.value().id, text, roomId).get();
 
         if (err)
         {
@@ -302,12 +565,12 @@ void Server::_handleMessagesPost( const Request &req, Response &res )
     }
     catch ( const std::exception &e )
     {
-        spdlog::warn(std::string(__FILE__) + std::to_string(__LINE__) + e.what());
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
         ErrorResponseBuilder(res).badRequest("Error while send message!");
     }
 }
 
-void Server::_handleMessagesGet( const Request &req, Response &res )
+void Server::_handleMessagesGet( const Request &req, Response &res, const int roomId )
 {
     const std::string token = getAuthorizationToken(req);
     auto userOpt = _db.getUserByToken(token);
@@ -315,7 +578,11 @@ void Server::_handleMessagesGet( const Request &req, Response &res )
     if (!userOpt)
     {
         ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
+        _warnUnknownToken(token);
+        return;
+    }
+    if (!_checkRoomAccess(roomId, userOpt.value().id, res))
+    {
         return;
     }
 
@@ -327,29 +594,40 @@ void Server::_handleMessagesGet( const Request &req, Response &res )
             return;
         }
 
-        int limit = std::stoi(req.get_param_value("limit"));
-        auto messages = _db.getLastMessages(limit);
-        Json msgArray = Json::array();
+        if (req.has_param("before_id") && req.has_param("after_id"))
+        {
+            ErrorResponseBuilder(res).badRequest("Only one of before_id and after_id is allowed!");
+            return;
+        }
+
+        int limit = std::clamp(std::stoi(req.get_param_value("limit")), 0, kMaxPageSize);
+        std::vector<MessagePtr> messages;
 
-        std::transform(messages.begin(), messages.end(), std::back_inserter(msgArray), 
-                       []( const MessageJson &msg ) {return msg.toJson();});
-        
-        Json payload = {
-            {"total_count", msgArray.size()},
-            {"messages", msgArray}
-        };
+        // before_id scrolls back through history, after_id pages forward from a known message
+        if (req.has_param("before_id"))
+        {
+            messages = _db.getMessagesBefore(std::stoi(req.get_param_value("before_id")), limit, roomId);
+        }
+        else if (req.has_param("after_id"))
+        {
+            messages = _db.getMessagesAfter(std::stoi(req.get_param_value("after_id")), limit, roomId);
+        }
+        else
+        {
+            messages = _db.getLastMessages(limit, roomId);
+        }
 
         res.status = StatusCode::OK_200;
-        res.set_content(payload.dump(), "application/json");
+        res.set_content(ResponseConverter::toMessagesPage(messages), "application/json");
     }
     catch ( const std::exception &e )
     {
-        spdlog::warn(std::string(__FILE__) + std::to_string(__LINE__) + e.what());
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
         ErrorResponseBuilder(res).badRequest("Error while get last messages!");
     }
 }
 
-void Server::_handleMessagesGetNew( const Request &req, Response &res )
+void Server::_handleMessagesGetNew( const Request &req, Response &res, const int roomId )
 {
     const std::string token = getAuthorizationToken(req);
     auto userOpt = _db.getUserByToken(token);
@@ -357,7 +635,11 @@ void Server::_handleMessagesGetNew( const Request &req, Response &res )
     if (!userOpt)
     {
         ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
+        _warnUnknownToken(token);
+        return;
+    }
+    if (!_checkRoomAccess(roomId, userOpt.value().id, res))
+    {
         return;
     }
 
@@ -370,158 +652,828 @@ void Server::_handleMessagesGetNew( const Request &req, Response &res )
         }
 
         int afterId = std::stoi(req.get_param_value("after_id"));
-        auto messages = _db.getMessagesAfter(afterId);
-        Json msgArray = Json::array();
+        int waitMs = req.has_param("wait") ? std::stoi(req.get_param_value("wait")) : 0;
 
-        std::transform(messages.begin(), messages.end(), std::back_inserter(msgArray), 
-                       []( const MessageJson &msg ) {return msg.toJson();});
-        
-        Json payload = {
-            {"total_count", msgArray.size()},
-            {"messages", msgArray}
-        };
+        // Long polls check the validator once the wait is over, not before it
+        // An unparked poll answered at once would come straight back, so the client is told to back off
+        if (waitMs > 0 && !_waitLongPoll(roomId, afterId, std::min(std::chrono::milliseconds(waitMs), kMaxLongPoll)))
+        {
+            res.set_header("Retry-After", std::to_string(kPollRetryAfter.count()));
+            ErrorResponseBuilder(res).serviceUnavailable("Too many waiting requests, try again later!");
+            return;
+        }
+
+        if (_respondNotModified(req, res, _makeEtag(std::format("r{}-m{}-{}", roomId, afterId,
+                                                                std::max(afterId, _db.getRoomLastId(roomId))))))
+        {
+            return;
+        }
+
+        // Served from the window of the room, it already has whatever woke the poll
+        auto messages = _db.getMessagesAfter(afterId, -1, roomId);
 
         res.status = StatusCode::OK_200;
-        res.set_content(payload.dump(), "application/json");
+        res.set_header("ETag", _makeEtag(std::format("r{}-m{}-{}", roomId, afterId,
+                                                     messages.empty() ? afterId : messages.back()->id)));
+        res.set_content(ResponseConverter::toMessagesPage(messages), "application/json");
     }
     catch ( const std::exception &e )
     {
-        spdlog::warn(std::string(__FILE__) + std::to_string(__LINE__) + e.what());
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
         ErrorResponseBuilder(res).badRequest("Error while get new messages!");
     }
 }
 
-void Server::_handleMessagesCount( const Request &req, Response &res )
+auto Server::_waitLongPoll( const int roomId, const int afterId, const std::chrono::milliseconds wait ) -> bool
 {
-    const std::string token = getAuthorizationToken(req);
+    // Parked pollers hold a worker just like streams, so they share the limit
+    MessageHub::Subscription slot(_hub);
 
-    if (!_db.isTokenExists(token))
+    if (!slot)
     {
-        ErrorResponseBuilder(res).unauthorized("Unknown token!");
-        spdlog::warn("Unknown token '" + token + "'!");
-        return;
+        return false;
     }
 
-    int count = _db.getMessageCount();
+    _db.waitForMessages(roomId, afterId, wait);
+    return true;
+}
+
+auto Server::_authorize( const Request &req, Response &res ) -> std::optional<User>
+{
+    const std::string token = getAuthorizationToken(req);
+    auto userOpt = _db.getUserByToken(token);
 
-    if (count == -1)
+    if (!userOpt)
     {
-        ErrorResponseBuilder(res).internal("Something was wrong, check logs...");
-        return;
+        ErrorResponseBuilder(res).unauthorized("Unknown token!");
+        _warnUnknownToken(token);
     }
 
-    Json countResp = {
-        {"status", "success"},
-        {"count", count}
-    };
-
-    res.status = StatusCode::OK_200;
-    res.set_content(countResp.dump(), "application/json");
+    return userOpt;
 }
 
-void Server::_setupHandlers( void )
+auto Server::_getRoomId( const Request &req, Response &res ) -> std::optional<int>
 {
-    // System endpoints
-    _server->Get("/api/alive", [&]( const Request &req, Response &res ) {
-        _handleAlive(req, res);
-    });
+    auto it = req.path_params.find("id");
+    int roomId = 0;
 
-    _server->Post("/api/check_token", [&]( const Request &req, Response &res ) {
-        try
-        {
-            std::string token = Json::parse(req.body)["token"];
-            Json result = {
-                {"check_status", _db.isTokenExists(token)} 
-            };
+    if (it != req.path_params.end())
+    {
+        const std::string &text = it->second;
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), roomId);
 
-            res.status = StatusCode::OK_200;
-            res.set_content(result.dump(), "application/json");
-        }
-        catch ( const std::exception &e )
+        if (ec == std::errc() && end == text.data() + text.size() && roomId > 0)
         {
-            ErrorResponseBuilder(res).badRequest(e.what());
+            return roomId;
         }
-    });
-
-    // Authentication endpoints
-    _server->Post("/api/auth/register", [&]( const Request &req, Response &res ) {
-        _handleRegister(req, res);
-    });
-
-    _server->Post("/api/auth/login", [&]( const Request &req, Response &res ) {
-        _handleLogin(req, res);
-    });
-
-    _server->Post("/api/auth/logout", [&]( const Request &req, Response &res ) {
-        _handleLogout(req, res);
-    });
+    }
 
-    // Users endpoints
-    _server->Get("/api/users/me", [&]( const Request &req, Response &res ) {
-        _handleMe(req, res);
-    });
+    ErrorResponseBuilder(res).badRequest("Room id must be a positive number!");
+    return std::nullopt;
+}
 
-    _server->Get("/api/users/online", [&]( const Request &req, Response &res ) {
-        _handleOnline(req, res);
-    });
+auto Server::_checkRoomAccess( const int roomId, const int userId, Response &res ) -> bool
+{
+    if (_db.isRoomMember(roomId, userId))
+    {
+        return true;
+    }
 
-    _server->Get("/api/users/count", [&]( const Request &req, Response &res ) {
-        _handleUsersCount(req, res);
-    });
+    if (_db.hasRoom(roomId))
+    {
+        ErrorResponseBuilder(res).forbidden("Join the room first!");
+    }
+    else
+    {
+        ErrorResponseBuilder(res).notFound("Room does not exist!");
+    }
+    return false;
+}
 
-    // Messages endpoints
-    _server->Post("/api/messages", [&]( const Request &req, Response &res ) {
-        _handleMessagesPost(req, res);
-    });
+void Server::_handleRooms( const Request &req, Response &res )
+{
+    auto userOpt = _authorize(req, res);
 
-    _server->Get("/api/messages", [&]( const Request &req, Response &res ) {
-        _handleMessagesGet(req, res);
-    });
+    if (!userOpt)
+    {
+        return;
+    }
 
-    _server->Get("/api/messages/new", [&]( const Request &req, Response &res ) {
-        _handleMessagesGetNew(req, res);
-    });
+    Json rooms = Json::array();
 
-    _server->Get("/api/messages/count", [&]( const Request &req, Response &res ) {
-        _handleMessagesCount(req, res);
-    });
+    for (const auto &room : _db.getRooms(userOpt.value().id))
+    {
+        rooms.push_back(room.toJson());
+    }
 
-    _server->Options(R"(.*)", [&]( const Request &req, Response &res ) {
-        res.status = 200;
-    });
+    res.status = StatusCode::OK_200;
+    res.set_content(Json {{"rooms", rooms}}.dump(), "application/json");
 }
 
-void Server::_setupStaticHandlers( void )
+void Server::_handleRoomCreate( const Request &req, Response &res )
 {
-    _server->Get("/", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("index.html"), "text/html");
-    });
+    auto userOpt = _authorize(req, res);
 
-    _server->Get("/css/style.css", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("css/style.css"), "text/css");
-    });
+    if (!userOpt)
+    {
+        return;
+    }
 
-    _server->Get("/js/utils.js", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("/js/utils.js"), "application/javascript");
-    });
+    try
+    {
+        std::string name = Json::parse(req.body)["name"];
+        auto verdict = Validation::checkName(name);
 
-    _server->Get("/js/auth.js", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("/js/auth.js"), "application/javascript");
-    });
+        if (verdict != Validation::Verdict::kValid)
+        {
+            ErrorResponseBuilder(res).validationError(std::format("Room name {}!", Validation::describe(verdict)));
+            return;
+        }
 
-    _server->Get("/register", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("register.html"), "text/html");
-    });
+        auto [room, err] = _db.addRoom(name, userOpt.value().id);
 
-    _server->Get("/chat", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("chat.html"), "text/html");
-    });
+        if (err)
+        {
+            processErrors(res, err);
+            return;
+        }
 
-    _server->Get("/css/chat.css", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("css/chat.css"), "text/css");
-    });
+        res.status = StatusCode::Created_201;
+        res.set_content(room.toJson().dump(), "application/json");
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
+        ErrorResponseBuilder(res).badRequest("Error while parsing room!");
+    }
+}
 
-    _server->Get("/js/chat.js", [&]( const Request& req, Response& res ) {
-        res.set_content(readFile("js/chat.js"), "application/javascript");
-    });
-}
\ No newline at end of file
+void Server::_handleRoomGet( const Request &req, Response &res, const int roomId )
+{
+    auto userOpt = _authorize(req, res);
+
+    if (!userOpt)
+    {
+        return;
+    }
+
+    auto room = _db.getRoom(roomId, userOpt.value().id);
+
+    if (!room)
+    {
+        ErrorResponseBuilder(res).notFound("Room does not exist!");
+        return;
+    }
+
+    res.status = StatusCode::OK_200;
+    res.set_content(room.value().toJson().dump(), "application/json");
+}
+
+void Server::_handleRoomRename( const Request &req, Response &res, const int roomId )
+{
+    auto userOpt = _authorize(req, res);
+
+    if (!userOpt)
+    {
+        return;
+    }
+
+    try
+    {
+        std::string name = Json::parse(req.body)["name"];
+        auto verdict = Validation::checkName(name);
+
+        if (verdict != Validation::Verdict::kValid)
+        {
+            ErrorResponseBuilder(res).validationError(std::format("Room name {}!", Validation::describe(verdict)));
+            return;
+        }
+
+        if (auto err = _db.renameRoom(roomId, userOpt.value().id, name))
+        {
+            processErrors(res, err);
+            return;
+        }
+
+        _handleRoomGet(req, res, roomId);
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
+        ErrorResponseBuilder(res).badRequest("Error while parsing room!");
+    }
+}
+
+void Server::_handleRoomDelete( const Request &req, Response &res, const int roomId )
+{
+    auto userOpt = _authorize(req, res);
+
+    if (!userOpt)
+    {
+        return;
+    }
+
+    if (auto err = _db.deleteRoom(roomId, userOpt.value().id))
+    {
+        processErrors(res, err);
+        return;
+    }
+
+    res.status = StatusCode::OK_200;
+    res.set_content(Json {{"status", "success"}}.dump(), "application/json");
+}
+
+void Server::_handleRoomJoin( const Request &req, Response &res, const int roomId )
+{
+    auto userOpt = _authorize(req, res);
+
+    if (!userOpt)
+    {
+        return;
+    }
+
+    if (auto err = _db.joinRoom(roomId, userOpt.value().id))
+    {
+        processErrors(res, err);
+        return;
+    }
+
+    res.status = StatusCode::OK_200;
+    res.set_content(Json {{"status", "success"}}.dump(), "application/json");
+}
+
+void Server::_handleRoomLeave( const Request &req, Response &res, const int roomId )
+{
+    auto userOpt = _authorize(req, res);
+
+    if (!userOpt)
+    {
+        return;
+    }
+
+    if (auto err = _db.leaveRoom(roomId, userOpt.value().id))
+    {
+        processErrors(res, err);
+        return;
+    }
+
+    res.status = StatusCode::OK_200;
+    res.set_content(Json {{"status", "success"}}.dump(), "application/json");
+}
+
+void Server::_handleMessagesSearch( const Request &req, Response &res, const int roomId )
+{
+    const std::string token = getAuthorizationToken(req);
+    auto userOpt = _db.getUserByToken(token);
+
+    if (!userOpt)
+    {
+        ErrorResponseBuilder(res).unauthorized("Unknown token!");
+        _warnUnknownToken(token);
+        return;
+    }
+    if (!_checkRoomAccess(roomId, userOpt.value().id, res))
+    {
+        return;
+    }
+
+    try
+    {
+        if (!req.has_param("q"))
+        {
+            ErrorResponseBuilder(res).badRequest("Q is needed!");
+            return;
+        }
+
+        std::string text = req.get_param_value("q");
+        auto verdict = Validation::checkMessage(text);
+
+        if (verdict != Validation::Verdict::kValid)
+        {
+            ErrorResponseBuilder(res).validationError(std::format("Query {}!", Validation::describe(verdict)));
+            return;
+        }
+
+        int limit = req.has_param("limit") ?
+            std::clamp(std::stoi(req.get_param_value("limit")), 1, kMaxPageSize) : kDefaultSearchPage;
+        std::optional<Database::SearchCursor> after;
+
+        if (req.has_param("cursor"))
+        {
+            after = _parseSearchCursor(req.get_param_value("cursor"));
+            if (!after)
+            {
+                ErrorResponseBuilder(res).badRequest("Unknown cursor!");
+                return;
+            }
+        }
+
+        auto [hits, err] = _db.searchMessages(text, roomId, limit, after);
+
+        if (err)
+        {
+            processErrors(res, err);
+            return;
+        }
+
+        Json messages = Json::array();
+
+        for (const auto &hit : hits)
+        {
+            Json item = hit.message->toJson();
+
+            item["snippet"] = hit.snippet;
+            item["rank"] = hit.rank;
+            messages.push_back(std::move(item));
+        }
+
+        // A short page is the last one
+        Json page = {
+            {"messages", messages},
+            {"next_cursor", nullptr}
+        };
+
+        if (static_cast<int>(hits.size()) == limit)
+        {
+            page["next_cursor"] = std::format("{}:{}", hits.back().rank, hits.back().message->id);
+        }
+
+        res.status = StatusCode::OK_200;
+        res.set_content(page.dump(), "application/json");
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
+        ErrorResponseBuilder(res).badRequest("Error while search messages!");
+    }
+}
+
+auto Server::_parseSearchCursor( std::string_view text ) -> std::optional<Database::SearchCursor>
+{
+    size_t colon = text.rfind(':');
+
+    if (colon == std::string_view::npos)
+    {
+        return std::nullopt;
+    }
+
+    Database::SearchCursor cursor;
+    const char *end = text.data() + text.size();
+    auto rank = std::from_chars(text.data(), text.data() + colon, cursor.rank);
+    auto id = std::from_chars(text.data() + colon + 1, end, cursor.id);
+
+    if (rank.ec != std::errc() || rank.ptr != text.data() + colon || id.ec != std::errc() || id.ptr != end)
+    {
+        return std::nullopt;
+    }
+
+    return cursor;
+}
+
+void Server::_handleMessagesCount( const Request &req, Response &res )
+{
+    const std::string token = getAuthorizationToken(req);
+
+    if (!_db.isTokenExists(token))
+    {
+        ErrorResponseBuilder(res).unauthorized("Unknown token!");
+        _warnUnknownToken(token);
+        return;
+    }
+
+    int count = _db.getMessageCount();
+    auto etag = _makeEtag(std::format("n{}", count));
+
+    if (_respondNotModified(req, res, etag))
+    {
+        return;
+    }
+
+    Json countResp = {
+        {"status", "success"},
+        {"count", count}
+    };
+
+    res.status = StatusCode::OK_200;
+    res.set_header("ETag", etag);
+    res.set_content(countResp.dump(), "application/json");
+}
+
+void Server::_handleStats( const Request &req, Response &res )
+{
+    const std::string token = getAuthorizationToken(req);
+
+    if (!_db.isTokenExists(token))
+    {
+        ErrorResponseBuilder(res).unauthorized("Unknown token!");
+        _warnUnknownToken(token);
+        return;
+    }
+
+    auto counts = _db.getCounts();
+    auto etag = _makeEtag(std::format("s{}-{}-{}", counts.users, counts.messages, counts.online));
+
+    if (_respondNotModified(req, res, etag))
+    {
+        return;
+    }
+
+    Json stats = {
+        {"status", "success"},
+        {"users", counts.users},
+        {"messages", counts.messages},
+        {"online", counts.online}
+    };
+
+    res.status = StatusCode::OK_200;
+    res.set_header("ETag", etag);
+    res.set_content(stats.dump(), "application/json");
+}
+
+void Server::_handleLogLevel( const Request &req, Response &res )
+{
+    // Operator knob, not part of the chat API
+    if (req.remote_addr != "127.0.0.1" && req.remote_addr != "::1")
+    {
+        ErrorResponseBuilder(res).forbidden("Log level can be changed only locally!");
+        return;
+    }
+
+    try
+    {
+        auto input = Json::parse(req.body);
+
+        if (!input.contains("level") || !input["level"].is_string() ||
+            !Logging::setLevel(input["level"].get<std::string>()))
+        {
+            ErrorResponseBuilder(res).validationError("Unknown log level!");
+            return;
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        ErrorResponseBuilder(res).badRequest("Error while parsing log level!");
+        return;
+    }
+
+    Json status = {
+        {"status", "success"},
+        {"level", Logging::getLevel()}
+    };
+
+    res.status = StatusCode::OK_200;
+    res.set_content(status.dump(), "application/json");
+}
+
+void Server::_handleMetrics( const Request &, Response &res )
+{
+    std::string body;
+
+    _metrics.write(body);
+    _db.getMetrics().write(body);
+
+    res.status = StatusCode::OK_200;
+    res.set_content(body, "text/plain; version=0.0.4");
+}
+
+void Server::_compressResponse( const Request &req, Response &res )
+{
+    // Streams and static files have no body here, static files also carry their own encoding
+    if (res.body.empty() || res.has_header("Content-Encoding") ||
+        !res.get_header_value("Content-Type").starts_with("application/json"))
+    {
+        return;
+    }
+
+    // httplib gzips plain "application/json" on its own with no size limit or level, with a charset it leaves it to us
+    res.headers.erase("Content-Type");
+    res.set_header("Content-Type", "application/json; charset=utf-8");
+
+    if (_config.compressionLevel == 0 || res.body.size() < _config.compressionMinBytes)
+    {
+        return;
+    }
+
+    res.set_header("Vary", "Accept-Encoding");
+
+    auto encoding = Compression::choose(req.get_header_value("Accept-Encoding"));
+
+    if (encoding == Compression::Encoding::kIdentity)
+    {
+        return;
+    }
+
+    auto compressed = Compression::compress(res.body, encoding, _config.compressionLevel);
+
+    if (compressed.empty() || compressed.size() >= res.body.size())
+    {
+        return;
+    }
+
+    _compressedResponses.fetch_add(1, std::memory_order_relaxed);
+    _compressionInputBytes.fetch_add(res.body.size(), std::memory_order_relaxed);
+    _compressionOutputBytes.fetch_add(compressed.size(), std::memory_order_relaxed);
+
+    res.body = std::move(compressed);
+    res.set_header("Content-Encoding", std::string(Compression::getName(encoding)));
+}
+
+auto Server::_measured( std::string_view method, std::string_view route, httplib::Server::Handler handler )
+    -> httplib::Server::Handler
+{
+    Metrics::Route &metrics = _metrics.addRoute(method, route);
+
+    return [&metrics, handler = std::move(handler)]( const Request &req, Response &res ) {
+        auto start = std::chrono::steady_clock::now();
+
+        metrics.inFlight.fetch_add(1, std::memory_order_relaxed);
+
+        try
+        {
+            handler(req, res);
+        }
+        catch ( ... )
+        {
+            // httplib answers 500 for handlers that throw
+            metrics.finish(StatusCode::InternalServerError_500, std::chrono::steady_clock::now() - start);
+            throw;
+        }
+
+        // Status is left unset when httplib should pick the default 200
+        metrics.finish(res.status == -1 ? StatusCode::OK_200 : res.status, std::chrono::steady_clock::now() - start);
+    };
+}
+
+auto Server::_onAuthPool( httplib::Server::Handler handler ) -> httplib::Server::Handler
+{
+    return [this, handler = std::move(handler)]( const Request &req, Response &res ) {
+        std::packaged_task<void( void )> task([&] {
+            handler(req, res);
+        });
+        auto done = task.get_future();
+
+        if (!_authPool.trySubmit([&task] {
+                task();
+            }))
+        {
+            res.set_header("Retry-After", std::to_string(kAuthRetryAfter.count()));
+            ErrorResponseBuilder(res).serviceUnavailable("Server is busy, try again later!");
+
+            auto suppressed = _authRejectLog.acquire();
+
+            if (suppressed && suppressed.value() > 0)
+            {
+                spdlog::warn("Auth pool is full, request rejected! ({} more suppressed)", suppressed.value());
+            }
+            else if (suppressed)
+            {
+                spdlog::warn("Auth pool is full, request rejected!");
+            }
+            return;
+        }
+
+        // httplib handlers are synchronous, so this worker still waits, but only workers + queue of them at once
+        done.get();
+    };
+}
+
+void Server::_handleMessagesStream( const Request &req, Response &res )
+{
+    std::string token = getAuthorizationToken(req);
+
+    // EventSource can not set custom headers, so token may come as a parameter
+    if (token.empty())
+    {
+        token = req.get_param_value("token");
+    }
+
+    if (!_db.isTokenExists(token))
+    {
+        ErrorResponseBuilder(res).unauthorized("Unknown token!");
+        _warnUnknownToken(token);
+        return;
+    }
+
+    auto cursor = std::make_shared<int>(_hub.getLastId());
+
+    try
+    {
+        if (req.has_header("Last-Event-ID"))
+        {
+            *cursor = std::stoi(req.get_header_value("Last-Event-ID"));
+        }
+        else if (req.has_param("after_id"))
+        {
+            *cursor = std::stoi(req.get_param_value("after_id"));
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        spdlog::warn("{}:{}: {}", __FILE__, __LINE__, e.what());
+        ErrorResponseBuilder(res).badRequest("Incorrect after_id!");
+        return;
+    }
+
+    if (!_hub.subscribe())
+    {
+        ErrorResponseBuilder(res).serviceUnavailable("Too many streams, use polling instead!");
+        return;
+    }
+
+    res.status = StatusCode::OK_200;
+    res.set_header("Cache-Control", "no-cache");
+    res.set_chunked_content_provider("text/event-stream",
+        [this, cursor]( size_t, httplib::DataSink &sink ) {
+            return _writeStreamEvents(*cursor, sink);
+        },
+        [this]( bool ) {
+            _hub.unsubscribe();
+        });
+}
+
+auto Server::_writeStreamEvents( int &cursor, httplib::DataSink &sink ) -> bool
+{
+    static const std::string ping = ": ping\n\n";
+
+    if (!_hub.waitAfter(cursor, kStreamHeartbeat))
+    {
+        if (_hub.isStopped())
+        {
+            sink.done();
+            return true;
+        }
+        return sink.write(ping.data(), ping.size());
+    }
+
+    std::vector<MessagePtr> events;
+
+    // Stream fell behind the hub backlog, catch up from the database
+    if (!_hub.eventsAfter(cursor, events))
+    {
+        events = _db.getMessagesAfter(cursor);
+
+        if (events.empty())
+        {
+            cursor = _hub.getLastId();
+            return true;
+        }
+    }
+
+    std::string chunk;
+
+    for (const auto &event : events)
+    {
+        chunk += std::format("id: {}\nevent: message\ndata: {}\n\n", event->id, event->json);
+        cursor = event->id;
+    }
+
+    return chunk.empty() || sink.write(chunk.data(), chunk.size());
+}
+
+void Server::_setupHandlers( void )
+{
+    // System endpoints
+    _server->Get("/api/alive", _measured("GET", "/api/alive", [&]( const Request &req, Response &res ) {
+        _handleAlive(req, res);
+    }));
+
+    _server->Post("/api/check_token", _measured("POST", "/api/check_token", [&]( const Request &req, Response &res ) {
+        try
+        {
+            std::string token = Json::parse(req.body)["token"];
+            Json result = {
+                {"check_status", _db.isTokenExists(token)} 
+            };
+
+            res.status = StatusCode::OK_200;
+            res.set_content(result.dump(), "application/json");
+        }
+        catch ( const std::exception &e )
+        {
+            ErrorResponseBuilder(res).badRequest(e.what());
+        }
+    }));
+
+    // Authentication endpoints
+    _server->Post("/api/auth/register", _measured("POST", "/api/auth/register", _onAuthPool([&]( const Request &req, Response &res ) {
+        _handleRegister(req, res);
+    })));
+
+    _server->Post("/api/auth/login", _measured("POST", "/api/auth/login", _onAuthPool([&]( const Request &req, Response &res ) {
+        _handleLogin(req, res);
+    })));
+
+    _server->Post("/api/auth/logout", _measured("POST", "/api/auth/logout", [&]( const Request &req, Response &res ) {
+        _handleLogout(req, res);
+    }));
+
+    // Users endpoints
+    _server->Get("/api/users/me", _measured("GET", "/api/users/me", [&]( const Request &req, Response &res ) {
+        _handleMe(req, res);
+    }));
+
+    _server->Get("/api/users/online", _measured("GET", "/api/users/online", [&]( const Request &req, Response &res ) {
+        _handleOnline(req, res);
+    }));
+
+    _server->Get("/api/users/count", _measured("GET", "/api/users/count", [&]( const Request &req, Response &res ) {
+        _handleUsersCount(req, res);
+    }));
+
+    // Messages endpoints
+    _server->Post("/api/messages", _measured("POST", "/api/messages", [&]( const Request &req, Response &res ) {
+        _handleMessagesPost(req, res, Database::kGeneralRoom);
+    }));
+
+    _server->Get("/api/messages", _measured("GET", "/api/messages", [&]( const Request &req, Response &res ) {
+        _handleMessagesGet(req, res, Database::kGeneralRoom);
+    }));
+
+    _server->Get("/api/messages/new", _measured("GET", "/api/messages/new", [&]( const Request &req, Response &res ) {
+        _handleMessagesGetNew(req, res, Database::kGeneralRoom);
+    }));
+
+    _server->Get("/api/messages/search", _measured("GET", "/api/messages/search", [&]( const Request &req, Response &res ) {
+        _handleMessagesSearch(req, res, Database::kGeneralRoom);
+    }));
+
+    _server->Get("/api/messages/count", _measured("GET", "/api/messages/count", [&]( const Request &req, Response &res ) {
+        _handleMessagesCount(req, res);
+    }));
+
+    _server->Get("/api/messages/stream", _measured("GET", "/api/messages/stream", [&]( const Request &req, Response &res ) {
+        _handleMessagesStream(req, res);
+    }));
+
+    // Rooms endpoints, metrics label them by pattern so every room shares one series
+    _server->Get("/api/rooms", _measured("GET", "/api/rooms", [&]( const Request &req, Response &res ) {
+        _handleRooms(req, res);
+    }));
+
+    _server->Post("/api/rooms", _measured("POST", "/api/rooms", [&]( const Request &req, Response &res ) {
+        _handleRoomCreate(req, res);
+    }));
+
+    _roomRoute("GET", "/api/rooms/:id", &Server::_handleRoomGet);
+    _roomRoute("PUT", "/api/rooms/:id", &Server::_handleRoomRename);
+    _roomRoute("DELETE", "/api/rooms/:id", &Server::_handleRoomDelete);
+    _roomRoute("POST", "/api/rooms/:id/join", &Server::_handleRoomJoin);
+    _roomRoute("POST", "/api/rooms/:id/leave", &Server::_handleRoomLeave);
+    _roomRoute("GET", "/api/rooms/:id/messages", &Server::_handleMessagesGet);
+    _roomRoute("POST", "/api/rooms/:id/messages", &Server::_handleMessagesPost);
+    _roomRoute("GET", "/api/rooms/:id/messages/new", &Server::_handleMessagesGetNew);
+    _roomRoute("GET", "/api/rooms/:id/messages/search", &Server::_handleMessagesSearch);
+
+    _server->Get("/api/stats", _measured("GET", "/api/stats", [&]( const Request &req, Response &res ) {
+        _handleStats(req, res);
+    }));
+
+    _server->Get("/api/metrics", _measured("GET", "/api/metrics", [&]( const Request &req, Response &res ) {
+        _handleMetrics(req, res);
+    }));
+
+    _server->Put("/api/log-level", _measured("PUT", "/api/log-level", [&]( const Request &req, Response &res ) {
+        _handleLogLevel(req, res);
+    }));
+
+    _server->Options(R"(.*)", [&]( const Request &, Response &res ) {
+        res.status = 200;
+    });
+}
+
+void Server::_roomRoute( std::string_view method, std::string_view route,
+                         void (Server::*handler)( const Request &, Response &, const int ) )
+{
+    auto measured = _measured(method, route, [this, handler]( const Request &req, Response &res ) {
+        if (auto roomId = _getRoomId(req, res))
+        {
+            (this->*handler)(req, res, roomId.value());
+        }
+    });
+    std::string pattern(route);
+
+    if (method == "GET")
+    {
+        _server->Get(pattern, std::move(measured));
+    }
+    else if (method == "POST")
+    {
+        _server->Post(pattern, std::move(measured));
+    }
+    else if (method == "PUT")
+    {
+        _server->Put(pattern, std::move(measured));
+    }
+    else
+    {
+        _server->Delete(pattern, std::move(measured));
+    }
+}
+
+void Server::_setupStaticHandlers( void )
+{
+    // Everything outside of /api is a public file: /, /chat, /js/chat.js, ...
+    _server->Get(R"(/(?!api/).*)", _measured("GET", "/*", [&]( const Request &req, Response &res ) {
+        _assets.serve(req, res);
+    }));
+}
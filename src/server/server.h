@@ -1,9 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
 #include <httplib.h>
 #include <nlohmann/json.hpp>
 
+#include "config.h"
 #include "database/database.h"
+#include "logging.h"
+#include "message_hub.h"
+#include "metrics.h"
+#include "static_assets.h"
+#include "worker_pool.h"
 
 class Server final
 {
@@ -14,23 +25,65 @@ class Server final
 
 public:
 
-    explicit Server( const std::string &host, const int port, const std::string &dbName = "a.db" );
+    explicit Server( const ServerConfig &config );
+    // devMode re-reads public files on change instead of serving the startup copy
+    explicit Server( const std::string &host, const int port, const std::string &dbName = "a.db",
+                     const bool devMode = false );
     void run( void );
 
+    // For running the server on a side thread: block until it accepts connections / make run() return
+    auto waitUntilReady( void ) -> bool;
+    void stop( void );
+
 private:
 
+    static constexpr int kMaxPageSize = 200;
+    static constexpr int kDefaultSearchPage = 20;
+    static constexpr std::chrono::seconds kStreamHeartbeat {15};
+    static constexpr std::chrono::milliseconds kMaxLongPoll {30000};
+    static constexpr std::chrono::seconds kAuthRetryAfter {1};
+    static constexpr std::chrono::seconds kPollRetryAfter {2};
+
     std::unique_ptr<httplib::Server> _server;
+    std::mutex _runMutex;
+    std::condition_variable _runCv;
+    bool _isStopped {};
+
+    // Routes are registered in _setupHandlers, before the first request
+    Metrics _metrics;
+
+    ServerConfig _config;
+
+    // Database writer thread publishes into the hub, so the hub has to outlive it
+    MessageHub _hub;
     Database _db;
+    StaticAssets _assets;
+
+    // Password hashing runs here, declared after _db so its tasks never outlive the database
+    WorkerPool _authPool;
 
-    std::string _host;
-    int _port;
     std::string _startedAt;
+    // Part of every API etag, so tags handed out before a restart never match
+    std::string _etagEpoch;
+
+    // Unknown tokens come from clients, so the warning must not scale with their request rate
+    LogThrottle _unknownTokenLog {std::chrono::seconds(1)};
+    LogThrottle _authRejectLog {std::chrono::seconds(1)};
 
-    static auto readFile( const std::string &filename ) -> std::string;
+    // JSON responses compressed by _compressResponse, sizes before and after
+    std::atomic<uint64_t> _compressedResponses {};
+    std::atomic<uint64_t> _compressionInputBytes {};
+    std::atomic<uint64_t> _compressionOutputBytes {};
 
     static auto getCurrentTimestamp( void ) -> std::string;
     static auto getAuthorizationToken( const Request &req ) -> std::string;
     static void processErrors( Response &res, const Database::Error &err );
+    void _warnUnknownToken( const std::string &token );
+
+    // Weak validators of polled responses, built from versions the server already keeps
+    auto _makeEtag( std::string_view tag ) const -> std::string;
+    // Answers 304 with the etag when If-None-Match already has it, before any work on the body
+    static auto _respondNotModified( const Request &req, Response &res, const std::string &etag ) -> bool;
 
     void _handleAlive( const Request &req, Response &res );
 
@@ -42,10 +95,49 @@ private:
     void _handleOnline( const Request &req, Response &res );
     void _handleUsersCount( const Request &req, Response &res );
     
-    void _handleMessagesPost( const Request &req, Response &res );
-    void _handleMessagesGet( const Request &req, Response &res );
-    void _handleMessagesGetNew( const Request &req, Response &res );
+    // Room-less routes pass the general room
+    void _handleMessagesPost( const Request &req, Response &res, const int roomId );
+    void _handleMessagesGet( const Request &req, Response &res, const int roomId );
+    void _handleMessagesGetNew( const Request &req, Response &res, const int roomId );
+    void _handleMessagesSearch( const Request &req, Response &res, const int roomId );
     void _handleMessagesCount( const Request &req, Response &res );
+    void _handleMessagesStream( const Request &req, Response &res );
+
+    void _handleRooms( const Request &req, Response &res );
+    void _handleRoomCreate( const Request &req, Response &res );
+    void _handleRoomGet( const Request &req, Response &res, const int roomId );
+    void _handleRoomRename( const Request &req, Response &res, const int roomId );
+    void _handleRoomDelete( const Request &req, Response &res, const int roomId );
+    void _handleRoomJoin( const Request &req, Response &res, const int roomId );
+    void _handleRoomLeave( const Request &req, Response &res, const int roomId );
+
+    void _handleStats( const Request &req, Response &res );
+    void _handleLogLevel( const Request &req, Response &res );
+    void _handleMetrics( const Request &req, Response &res );
+
+    // Post-routing: negotiates Content-Encoding for JSON bodies
+    void _compressResponse( const Request &req, Response &res );
+
+    auto _writeStreamEvents( int &cursor, httplib::DataSink &sink ) -> bool;
+    // Parks the request until the room has a message after afterId or the wait is over,
+    // false without waiting when the poller limit is reached
+    auto _waitLongPoll( const int roomId, const int afterId, const std::chrono::milliseconds wait ) -> bool;
+
+    // Answer 401 / 400 / 403 / 404 themselves and return nothing when the request can not go on
+    auto _authorize( const Request &req, Response &res ) -> std::optional<User>;
+    static auto _getRoomId( const Request &req, Response &res ) -> std::optional<int>;
+    // next_cursor of a search page is "rank:id"
+    static auto _parseSearchCursor( std::string_view text ) -> std::optional<Database::SearchCursor>;
+    auto _checkRoomAccess( const int roomId, const int userId, Response &res ) -> bool;
+    // Registers a /api/rooms/:id route, the handler gets the parsed id
+    void _roomRoute( std::string_view method, std::string_view route,
+                     void (Server::*handler)( const Request &, Response &, const int ) );
+
+    // Wraps a handler with latency, status and in-flight accounting for its route
+    auto _measured( std::string_view method, std::string_view route, httplib::Server::Handler handler )
+        -> httplib::Server::Handler;
+    // Runs a handler on the auth pool, or answers 503 at once when the pool is full
+    auto _onAuthPool( httplib::Server::Handler handler ) -> httplib::Server::Handler;
 
     void _setupHandlers( void );
     void _setupStaticHandlers( void );
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <span>
+#include <string_view>
+
+struct EmbeddedAsset
+{
+    std::string_view name;
+    std::string_view data;
+};
+
+// Defined by the source cmake/embed_assets.cmake generates when CHAT_EMBED_ASSETS is on
+auto getEmbeddedAssets( void ) -> std::span<const EmbeddedAsset>;
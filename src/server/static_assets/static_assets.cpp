@@ -0,0 +1,365 @@
+#include <fstream>
+#include <iterator>
+#include <mutex>
+
+#include <spdlog/spdlog.h>
+
+#include "static_assets.h"
+#include "compression.h"
+#include "sha256.h"
+
+#ifdef CHAT_EMBED_ASSETS
+#include "embedded_assets.h"
+#endif
+
+namespace
+{
+    auto readFile( const std::filesystem::path &path, std::string &content ) -> bool
+    {
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file)
+        {
+            return false;
+        }
+
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+}
+
+StaticAssets::StaticAssets( const std::filesystem::path &root, const bool hotReload ) :
+    _root(root), _hotReload(hotReload)
+{
+#ifdef CHAT_EMBED_ASSETS
+    // Hot reload is for editing the files, so it always works from disk
+    if (!_hotReload)
+    {
+        _loadEmbedded();
+        return;
+    }
+#endif
+    _loadDirectory();
+}
+
+void StaticAssets::_loadDirectory( void )
+{
+    std::error_code ec;
+
+    if (!std::filesystem::is_directory(_root, ec))
+    {
+        spdlog::error("Static assets directory '{}' is not found!", _root.string());
+        return;
+    }
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(_root, ec))
+    {
+        if (!entry.is_regular_file())
+        {
+            continue;
+        }
+
+        std::string body;
+
+        if (!readFile(entry.path(), body))
+        {
+            spdlog::warn("Can not read static asset '{}'!", entry.path().string());
+            continue;
+        }
+
+        std::string name = std::filesystem::relative(entry.path(), _root).generic_string();
+
+        _assets[name] = _makeAsset(name, std::move(body), entry.last_write_time(ec));
+    }
+
+    spdlog::info("Loaded {} static assets from '{}'", _assets.size(), _root.string());
+}
+
+void StaticAssets::_loadEmbedded( void )
+{
+#ifdef CHAT_EMBED_ASSETS
+    for (const auto &embedded : getEmbeddedAssets())
+    {
+        std::string name(embedded.name);
+
+        _assets[name] = _makeAsset(name, std::string(embedded.data));
+    }
+
+    _isEmbedded = true;
+    spdlog::info("Loaded {} embedded static assets", _assets.size());
+#endif
+}
+
+auto StaticAssets::_makeAsset( const std::string &name, std::string body,
+                               const std::filesystem::file_time_type modifiedAt ) const -> AssetPtr
+{
+    auto asset = std::make_shared<Asset>();
+    auto digest = SHA256Digest(body.data(), body.size());
+    std::string hash = toHex(digest.data(), 16);
+
+    asset->contentType = _getContentType(name);
+    asset->modifiedAt = modifiedAt;
+    asset->identity.etag = "\"" + hash + "\"";
+
+    // Hot reload favours quick edits over transfer size
+    if (!_hotReload)
+    {
+        auto precompress = [&]( Variant &variant, const Compression::Encoding encoding, const std::string &suffix ) {
+            variant.data = Compression::compress(body, encoding);
+
+            // Not worth a separate representation if it does not get smaller
+            if (variant.data.empty() || variant.data.size() >= body.size())
+            {
+                variant.data.clear();
+                return;
+            }
+            variant.etag = "\"" + hash + suffix + "\"";
+        };
+
+        precompress(asset->gzip, Compression::Encoding::kGzip, "-gz");
+        precompress(asset->brotli, Compression::Encoding::kBrotli, "-br");
+    }
+
+    asset->identity.data = std::move(body);
+    return asset;
+}
+
+auto StaticAssets::find( const std::string &path ) -> AssetPtr
+{
+    std::string name = _toName(path);
+
+    if (name.empty())
+    {
+        return nullptr;
+    }
+
+    // Pages are linked without extension: /chat -> chat.html
+    std::string pageName = name.find('.', name.rfind('/') + 1) == std::string::npos ? name + ".html" : "";
+    AssetPtr asset;
+
+    {
+        std::shared_lock lock(_mutex);
+        auto it = _assets.find(name);
+
+        if (it == _assets.end() && !pageName.empty())
+        {
+            it = _assets.find(pageName);
+            if (it != _assets.end())
+            {
+                name = pageName;
+            }
+        }
+
+        if (it != _assets.end())
+        {
+            asset = it->second;
+        }
+    }
+
+    if (_hotReload)
+    {
+        asset = _reload(name, asset);
+
+        if (!asset && !pageName.empty())
+        {
+            asset = _reload(pageName, nullptr);
+        }
+    }
+
+    return asset;
+}
+
+auto StaticAssets::_reload( const std::string &name, const AssetPtr &current ) -> AssetPtr
+{
+    std::error_code ec;
+    auto path = _root / name;
+    auto modifiedAt = std::filesystem::last_write_time(path, ec);
+
+    if (ec)
+    {
+        // Deleted on disk, stop serving it
+        if (current)
+        {
+            std::unique_lock lock(_mutex);
+            _assets.erase(name);
+        }
+        return nullptr;
+    }
+
+    if (current && current->modifiedAt == modifiedAt)
+    {
+        return current;
+    }
+
+    std::string body;
+
+    if (!std::filesystem::is_regular_file(path, ec) || !readFile(path, body))
+    {
+        return current;
+    }
+
+    auto asset = _makeAsset(name, std::move(body), modifiedAt);
+
+    std::unique_lock lock(_mutex);
+    _assets[name] = asset;
+    return asset;
+}
+
+void StaticAssets::serve( const httplib::Request &req, httplib::Response &res )
+{
+    auto asset = find(req.path);
+
+    if (!asset)
+    {
+        res.status = httplib::StatusCode::NotFound_404;
+        return;
+    }
+
+    const std::string acceptEncoding = req.get_header_value("Accept-Encoding");
+    const Variant *variant = &asset->identity;
+    auto encoding = Compression::Encoding::kIdentity;
+
+    if (!asset->brotli.data.empty() && Compression::isAccepted(acceptEncoding, Compression::Encoding::kBrotli))
+    {
+        variant = &asset->brotli;
+        encoding = Compression::Encoding::kBrotli;
+    }
+    else if (!asset->gzip.data.empty() && Compression::isAccepted(acceptEncoding, Compression::Encoding::kGzip))
+    {
+        variant = &asset->gzip;
+        encoding = Compression::Encoding::kGzip;
+    }
+
+    res.set_header("ETag", variant->etag);
+    res.set_header("Cache-Control", "no-cache");
+    res.set_header("Vary", "Accept-Encoding");
+
+    if (isNotModified(req.get_header_value("If-None-Match"), variant->etag))
+    {
+        res.status = httplib::StatusCode::NotModified_304;
+        return;
+    }
+
+    res.status = httplib::StatusCode::OK_200;
+
+    if (variant->data.empty())
+    {
+        res.set_content("", asset->contentType);
+        return;
+    }
+
+    if (encoding != Compression::Encoding::kIdentity)
+    {
+        res.set_header("Content-Encoding", std::string(Compression::getName(encoding)));
+    }
+
+    // Provider writes straight from the shared asset, and httplib does not compress provider output again
+    res.set_content_provider(variant->data.size(), asset->contentType,
+        [asset, variant]( size_t offset, size_t length, httplib::DataSink &sink ) {
+            return sink.write(variant->data.data() + offset, length);
+        });
+}
+
+auto StaticAssets::getStats( void ) const -> Stats
+{
+    std::shared_lock lock(_mutex);
+    Stats stats {_assets.size(), 0, 0, _isEmbedded, _hotReload};
+
+    for (const auto &[name, asset] : _assets)
+    {
+        stats.bytes += asset->identity.data.size();
+        stats.compressedBytes += asset->gzip.data.size() + asset->brotli.data.size();
+    }
+
+    return stats;
+}
+
+auto StaticAssets::getDefaultRoot( void ) -> std::filesystem::path
+{
+#ifdef CHAT_PUBLIC_DIR
+    return CHAT_PUBLIC_DIR;
+#else
+    std::filesystem::path fullPath = __FILE__;
+
+    return fullPath.parent_path().parent_path().parent_path() / "public";
+#endif
+}
+
+auto StaticAssets::_toName( const std::string &path ) -> std::string
+{
+    std::string name = path.starts_with('/') ? path.substr(1) : path;
+
+    if (name.empty() || name.ends_with('/'))
+    {
+        name += "index.html";
+    }
+
+    // Never look outside of the public root
+    if (name.find('\\') != std::string::npos || name.find(':') != std::string::npos ||
+        name == ".." || name.starts_with("../") || name.ends_with("/..") || name.find("/../") != std::string::npos)
+    {
+        return "";
+    }
+
+    return name;
+}
+
+auto StaticAssets::_getContentType( const std::string &name ) -> std::string
+{
+    static const std::unordered_map<std::string, std::string> types = {
+        {".html", "text/html"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+        {".json", "application/json"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".ico", "image/x-icon"},
+        {".txt", "text/plain"},
+    };
+
+    auto it = types.find(std::filesystem::path(name).extension().string());
+
+    return it == types.end() ? "application/octet-stream" : it->second;
+}
+
+auto StaticAssets::isNotModified( const std::string &ifNoneMatch, const std::string &etag ) -> bool
+{
+    if (ifNoneMatch.empty())
+    {
+        return false;
+    }
+
+    size_t begin = 0;
+
+    while (begin < ifNoneMatch.size())
+    {
+        size_t end = ifNoneMatch.find(',', begin);
+        std::string_view tag(ifNoneMatch);
+
+        tag = tag.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        begin = end == std::string::npos ? ifNoneMatch.size() : end + 1;
+
+        while (!tag.empty() && tag.front() == ' ')
+        {
+            tag.remove_prefix(1);
+        }
+        while (!tag.empty() && tag.back() == ' ')
+        {
+            tag.remove_suffix(1);
+        }
+
+        // If-None-Match uses weak comparison
+        if (tag.starts_with("W/"))
+        {
+            tag.remove_prefix(2);
+        }
+
+        if (tag == "*" || tag == etag)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include <httplib.h>
+
+/* In-memory copy of the public web files.
+ * Each file is read (or taken from the binary) once, tagged with a strong ETag
+ * and precompressed; in hot reload mode a file is re-read whenever its mtime changes.
+ */
+class StaticAssets final
+{
+public:
+    struct Variant
+    {
+        std::string data;
+        std::string etag;
+    };
+
+    struct Asset
+    {
+        std::string contentType;
+        Variant identity;
+        Variant gzip;
+        Variant brotli;
+        std::filesystem::file_time_type modifiedAt;
+    };
+
+    using AssetPtr = std::shared_ptr<const Asset>;
+
+    struct Stats
+    {
+        size_t count;
+        size_t bytes;
+        size_t compressedBytes;
+        bool isEmbedded;
+        bool isHotReload;
+    };
+
+    explicit StaticAssets( const std::filesystem::path &root = getDefaultRoot(), const bool hotReload = false );
+
+    auto find( const std::string &path ) -> AssetPtr;
+    void serve( const httplib::Request &req, httplib::Response &res );
+
+    auto getStats( void ) const -> Stats;
+
+    static auto getDefaultRoot( void ) -> std::filesystem::path;
+    // Weak comparison of a strong etag against an If-None-Match list, API validators use it too
+    static auto isNotModified( const std::string &ifNoneMatch, const std::string &etag ) -> bool;
+
+private:
+    std::filesystem::path _root;
+    bool _hotReload;
+    bool _isEmbedded {};
+
+    mutable std::shared_mutex _mutex;
+    std::unordered_map<std::string, AssetPtr> _assets;
+
+    void _loadDirectory( void );
+    void _loadEmbedded( void );
+    auto _reload( const std::string &name, const AssetPtr &current ) -> AssetPtr;
+
+    auto _makeAsset( const std::string &name, std::string body,
+                     const std::filesystem::file_time_type modifiedAt = {} ) const -> AssetPtr;
+
+    static auto _toName( const std::string &path ) -> std::string;
+    static auto _getContentType( const std::string &name ) -> std::string;
+};
@@ -0,0 +1,90 @@
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool( const size_t workers, const size_t maxQueued ) : _maxQueued(maxQueued)
+{
+    size_t count = std::max<size_t>(workers, 1);
+
+    _threads.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        _threads.emplace_back(&WorkerPool::_work, this);
+    }
+}
+
+auto WorkerPool::trySubmit( std::function<void( void )> task ) -> bool
+{
+    {
+        std::lock_guard lock(_mutex);
+
+        // An idle worker takes the task right away, so only what has to wait counts against the limit
+        if (_stopped || _tasks.size() + _busy >= _threads.size() + _maxQueued)
+        {
+            _rejected++;
+            return false;
+        }
+
+        _tasks.push_back(std::move(task));
+    }
+
+    _cv.notify_one();
+    return true;
+}
+
+auto WorkerPool::getStats( void ) const -> Stats
+{
+    std::lock_guard lock(_mutex);
+
+    return {_threads.size(), _busy, _tasks.size(), _maxQueued, _completed, _rejected};
+}
+
+void WorkerPool::_work( void )
+{
+    std::unique_lock lock(_mutex);
+
+    while (true)
+    {
+        _cv.wait(lock, [&] {return _stopped || !_tasks.empty();});
+        if (_tasks.empty())
+        {
+            return;
+        }
+
+        auto task = std::move(_tasks.front());
+
+        _tasks.pop_front();
+        _busy++;
+        lock.unlock();
+
+        try
+        {
+            task();
+        }
+        catch ( const std::exception &e )
+        {
+            // Tasks report their own errors, this is only a last resort
+            spdlog::error("Worker pool task failed: {}", e.what());
+        }
+
+        lock.lock();
+        _busy--;
+        _completed++;
+    }
+}
+
+WorkerPool::~WorkerPool( void )
+{
+    {
+        std::lock_guard lock(_mutex);
+        _stopped = true;
+    }
+
+    _cv.notify_all();
+    for (auto &thread : _threads)
+    {
+        thread.join();
+    }
+}
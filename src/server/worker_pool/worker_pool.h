@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of threads for expensive request work (password hashing), with admission control:
+ * when maxQueued tasks are already waiting a new one is refused at once instead of piling up.
+ * Tasks left in the queue still run on destruction.
+ */
+class WorkerPool final
+{
+public:
+    struct Stats
+    {
+        size_t workers;
+        size_t busy;
+        size_t queued;
+        size_t maxQueued;
+        uint64_t completed;
+        uint64_t rejected;
+    };
+
+    WorkerPool( const size_t workers, const size_t maxQueued );
+
+    WorkerPool( const WorkerPool & ) = delete;
+    WorkerPool & operator =( const WorkerPool & ) = delete;
+
+    // False without running the task when the queue is full
+    auto trySubmit( std::function<void( void )> task ) -> bool;
+
+    auto getStats( void ) const -> Stats;
+
+    ~WorkerPool( void );
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void( void )>> _tasks;
+
+    size_t _maxQueued;
+    size_t _busy {};
+    uint64_t _completed {};
+    uint64_t _rejected {};
+    bool _stopped {};
+
+    std::vector<std::thread> _threads;
+
+    void _work( void );
+};
@@ -1,362 +1,471 @@
-#include <iostream>
-#include <vector>
-#include <bit>
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA256_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 #include "sha256.h"
 
-typedef unsigned uint;
-
-std::string SHA256( const char *Msg, uint64_t length )
+namespace
 {
-  std::vector<uint> Bulk;
-  auto ToBin = []( uint x )
-  {
-    std::vector<uint> Res;
+    using CompressFn = void (*)( uint32_t *state, const uint8_t *blocks, size_t count );
+
+    constexpr uint32_t K[64] =
+    {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+        0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+        0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+        0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+        0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+        0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+        0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+        0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+        0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+    };
+
+    constexpr uint32_t kInit256[8] =
+    {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+        0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+    };
+
+    constexpr uint32_t kInit224[8] =
+    {
+        0xC1059ED8, 0x367CD507, 0x3070DD17, 0xF70E5939,
+        0xFFC00B31, 0x68581511, 0x64F98FA7, 0xBEFA4FA4
+    };
+
+    auto loadBigEndian( const uint8_t *p ) -> uint32_t
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
 
-    while (x > 0)
+    void compressScalar( uint32_t *state, const uint8_t *blocks, size_t count )
     {
-      Res.push_back(x % 2);
-      x /= 2;
+        uint32_t w[64];
+
+        for (; count > 0; count--, blocks += Sha256Hasher::kBlockSize)
+        {
+            for (int j = 0; j < 16; j++)
+            {
+                w[j] = loadBigEndian(blocks + 4 * j);
+            }
+
+            for (int j = 16; j < 64; j++)
+            {
+                uint32_t s0 = std::rotr(w[j - 15], 7) ^ std::rotr(w[j - 15], 18) ^ (w[j - 15] >> 3);
+                uint32_t s1 = std::rotr(w[j - 2], 17) ^ std::rotr(w[j - 2], 19) ^ (w[j - 2] >> 10);
+
+                w[j] = w[j - 16] + s0 + w[j - 7] + s1;
+            }
+
+            uint32_t
+                a = state[0],
+                b = state[1],
+                c = state[2],
+                d = state[3],
+                e = state[4],
+                f = state[5],
+                g = state[6],
+                h = state[7];
+
+            for (int j = 0; j < 64; j++)
+            {
+                uint32_t
+                    E0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22),
+                    Ma = (a & b) ^ (a & c) ^ (b & c),
+                    E1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25),
+                    Ch = (e & f) ^ (~e & g),
+                    t1 = h + E1 + Ch + K[j] + w[j],
+                    t2 = E0 + Ma;
+
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
     }
-    while (Res.size() < 8)
-      Res.push_back(0);
-    std::reverse(Res.begin(), Res.end());
 
-    return Res;
-  };
+#ifdef SHA256_X86
 
-  auto ToBin64 = []( uint64_t x )
-  { 
-    std::vector<uint> Res;
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA256_TARGET_SHANI __attribute__((target("sha,ssse3,sse4.1")))
+#else
+#define SHA256_TARGET_SHANI
+#endif
 
-    while (x > 0)
+    SHA256_TARGET_SHANI void compressShaNi( uint32_t *state, const uint8_t *blocks, size_t count )
     {
-      Res.push_back(x % 2);
-      x /= 2;
+        const __m128i shuffleMask = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+        // Hardware rounds keep the state as ABEF / CDGH halves
+        __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xB1);
+        __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1B);
+        __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+
+        state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+        for (; count > 0; count--, blocks += Sha256Hasher::kBlockSize)
+        {
+            const __m128i abefSave = state0;
+            const __m128i cdghSave = state1;
+            __m128i w[4];
+
+            for (int i = 0; i < 16; i++)
+            {
+                __m128i &cur = w[i % 4];
+
+                if (i < 4)
+                {
+                    cur = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(blocks + 16 * i)), shuffleMask);
+                }
+                else
+                {
+                    const __m128i &prev1 = w[(i + 3) % 4];
+                    const __m128i &prev2 = w[(i + 2) % 4];
+                    const __m128i &prev3 = w[(i + 1) % 4];
+
+                    cur = _mm_add_epi32(_mm_sha256msg1_epu32(cur, prev3), _mm_alignr_epi8(prev1, prev2, 4));
+                    cur = _mm_sha256msg2_epu32(cur, prev1);
+                }
+
+                __m128i msg = _mm_add_epi32(cur, _mm_loadu_si128(reinterpret_cast<const __m128i *>(K + 4 * i)));
+
+                state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+                state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+            }
+
+            state0 = _mm_add_epi32(state0, abefSave);
+            state1 = _mm_add_epi32(state1, cdghSave);
+        }
+
+        // Back to ABCD / EFGH
+        tmp = _mm_shuffle_epi32(state0, 0x1B);
+        state1 = _mm_shuffle_epi32(state1, 0xB1);
+        state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+        state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state), state0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), state1);
     }
-    while (Res.size() < 64)
-      Res.push_back(0);
-    std::reverse(Res.begin(), Res.end());
-
-    return Res;
-  };
-
-  /*
-   * STEP 1 - PREPROCESSING
-   */
-
-  // Convert message to binary
-  while (*Msg != 0)
-  {
-    auto tmp = ToBin(*Msg++);
-
-    Bulk.insert(Bulk.end(), tmp.begin(), tmp.end());
-  }
-
-  // Append a single 1
-  Bulk.push_back(1);
-
-  // Pad with 0's
-  while (Bulk.size() % 512 != 448)
-    Bulk.push_back(0);
-
-  // Add message length in bits
-  auto bitlen = ToBin64(length * 8);
-  Bulk.insert(Bulk.end(), bitlen.begin(), bitlen.end());
-
-  /*
-   * STEP 2 - INITIALIZE CONSTANTS
-   */
-  uint
-    h0 = 0x6A09E667,
-    h1 = 0xBB67AE85,
-    h2 = 0x3C6EF372,
-    h3 = 0xA54FF53A,
-    h4 = 0x510E527F,
-    h5 = 0x9B05688C,
-    h6 = 0x1F83D9AB,
-    h7 = 0x5BE0CD19;
-  uint K[64] = 
-  {
-    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
-    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
-    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
-    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
-    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
-    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
-    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
-    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
-    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
-    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
-    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
-    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
-    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
-    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
-    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
-    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
-  };
-
-  /*
-   * STEP 3 - SHUNK LOOP
-   */
-  for (uint i = 0; i < (uint)Bulk.size(); i += 512)
-  {
-    std::vector<uint> SubBulk;
-
-    SubBulk.insert(SubBulk.end(), Bulk.begin() + i, Bulk.begin() + i + 512);
-
-    // Create words array
-    std::vector<uint> Words(64);
-
-    for (uint j = 0; j < 512; j += 32)
+
+    auto hasShaNi( void ) -> bool
+    {
+        // CPUID.(EAX=7,ECX=0):EBX[29] - SHA, CPUID.1:ECX[19] - SSE4.1
+        unsigned regs1[4] {}, regs7[4] {};
+
+#ifdef _MSC_VER
+        int info[4];
+
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        __cpuidex(info, 1, 0);
+        std::memcpy(regs1, info, sizeof(info));
+        __cpuidex(info, 7, 0);
+        std::memcpy(regs7, info, sizeof(info));
+#else
+        if (__get_cpuid_max(0, nullptr) < 7)
+        {
+            return false;
+        }
+        __cpuid_count(1, 0, regs1[0], regs1[1], regs1[2], regs1[3]);
+        __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+#endif
+
+        return (regs7[1] & (1u << 29)) != 0 && (regs1[2] & (1u << 19)) != 0;
+    }
+#else
+    auto hasShaNi( void ) -> bool
     {
-      std::string BitWord;
+        return false;
+    }
+#endif
 
-      for (uint k = 0; k < 32; k++)
-        BitWord += ('0' + SubBulk[(i + j + k) % SubBulk.size()]);
-      Words[j / 32] = strtoul(BitWord.c_str(), nullptr, 2);
+    auto compressFor( const Sha256Hasher::Kernel kernel ) -> CompressFn
+    {
+#ifdef SHA256_X86
+        if (kernel == Sha256Hasher::Kernel::kShaNi)
+        {
+            return compressShaNi;
+        }
+#endif
+        return compressScalar;
     }
 
-    // Generate additional 48 words
-    for (uint j = 16; j < 64; j++)
+    auto bestKernel( void ) -> Sha256Hasher::Kernel
     {
-      uint s0 = (std::rotr(Words[j - 15], 7)) ^ (std::rotr(Words[j - 15], 18)) ^ (Words[j - 15] >> 3);
-      uint s1 = (std::rotr(Words[j - 2], 17)) ^ (std::rotr(Words[j - 2], 19)) ^ (Words[j - 2] >> 10);
+        return hasShaNi() ? Sha256Hasher::Kernel::kShaNi : Sha256Hasher::Kernel::kScalar;
+    }
+
+    std::atomic<Sha256Hasher::Kernel> activeKernel {bestKernel()};
+    std::atomic<CompressFn> activeCompress {compressFor(activeKernel.load())};
+}
+
+Sha256Hasher::Sha256Hasher( const bool is224 ) : _is224(is224)
+{
+    init();
+}
 
-      Words[j] = Words[j - 16] + s0 + Words[j - 7] + s1;
+void Sha256Hasher::init( void )
+{
+    std::memcpy(_state.data(), _is224 ? kInit224 : kInit256, sizeof(_state));
+    _length = 0;
+    _buffered = 0;
+}
+
+void Sha256Hasher::update( const void *data, size_t length )
+{
+    const CompressFn compress = activeCompress.load(std::memory_order_relaxed);
+    auto bytes = static_cast<const uint8_t *>(data);
+
+    _length += length;
+
+    if (_buffered > 0)
+    {
+        size_t chunk = std::min(length, kBlockSize - _buffered);
+
+        std::memcpy(_buffer.data() + _buffered, bytes, chunk);
+        _buffered += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        if (_buffered < kBlockSize)
+        {
+            return;
+        }
+
+        compress(_state.data(), _buffer.data(), 1);
+        _buffered = 0;
+    }
+
+    // Whole blocks go straight from the input
+    if (length >= kBlockSize)
+    {
+        size_t blocks = length / kBlockSize;
+
+        compress(_state.data(), bytes, blocks);
+        bytes += blocks * kBlockSize;
+        length -= blocks * kBlockSize;
     }
 
-    // Initialize variables
-    uint
-      a = h0,
-      b = h1,
-      c = h2,
-      d = h3,
-      e = h4,
-      f = h5,
-      g = h6,
-      h = h7;
-
-    // Main cycle
-    for (uint j = 0; j < 64; j++)
+    if (length > 0)
     {
-      uint
-        E0 = (std::rotr(a, 2)) ^ (std::rotr(a, 13)) ^ (std::rotr(a, 22)),
-        Ma = (a & b) ^ (a & c) ^ (b & c),
-        t2 = E0 + Ma,
-        E1 = (std::rotr(e, 6)) ^ (std::rotr(e, 11)) ^ (std::rotr(e, 25)),
-        Ch = (e & f) ^ ((~e) & g),
-        t1 = h + E1 + Ch + K[j] + Words[j];
-
-      h = g;
-      g = f;
-      f = e;
-      e = d + t1;
-      d = c;
-      c = b;
-      b = a;
-      a = t1 + t2;
+        std::memcpy(_buffer.data(), bytes, length);
+        _buffered = length;
     }
+}
 
-    // Add variables to hash
-    h0 = h0 + a;
-    h1 = h1 + b;
-    h2 = h2 + c;
-    h3 = h3 + d;
-    h4 = h4 + e;
-    h5 = h5 + f;
-    h6 = h6 + g;
-    h7 = h7 + h;
-  }
+auto Sha256Hasher::final( void ) -> Digest
+{
+    const CompressFn compress = activeCompress.load(std::memory_order_relaxed);
+    const uint64_t bitLength = _length * 8;
 
-  std::string res;
-  char resBuf[65];
+    // Append a single 1 bit, pad with 0's, finish with message length in bits
+    _buffer[_buffered++] = 0x80;
 
-  sprintf(resBuf, "%08X%08X%08X%08X%08X%08X%08X%08X", h0, h1, h2, h3, h4, h5, h6, h7);
-  res = resBuf;
+    if (_buffered > kBlockSize - 8)
+    {
+        std::memset(_buffer.data() + _buffered, 0, kBlockSize - _buffered);
+        compress(_state.data(), _buffer.data(), 1);
+        _buffered = 0;
+    }
+
+    std::memset(_buffer.data() + _buffered, 0, kBlockSize - 8 - _buffered);
+
+    for (int i = 0; i < 8; i++)
+    {
+        _buffer[kBlockSize - 1 - i] = static_cast<uint8_t>(bitLength >> (8 * i));
+    }
 
-  return res;
+    compress(_state.data(), _buffer.data(), 1);
+
+    Digest digest {};
+
+    for (size_t i = 0; i < _state.size(); i++)
+    {
+        digest[4 * i] = static_cast<uint8_t>(_state[i] >> 24);
+        digest[4 * i + 1] = static_cast<uint8_t>(_state[i] >> 16);
+        digest[4 * i + 2] = static_cast<uint8_t>(_state[i] >> 8);
+        digest[4 * i + 3] = static_cast<uint8_t>(_state[i]);
+    }
+
+    init();
+    return digest;
 }
 
-std::string SHA224( const char *Msg, uint64_t length )
+auto Sha256Hasher::getDigestSize( void ) const -> size_t
 {
-  std::vector<uint> Bulk;
-  auto ToBin = []( uint x )
-  {
-    std::vector<uint> Res;
+    return _is224 ? kDigest224Size : kDigestSize;
+}
 
-    while (x > 0)
+auto Sha256Hasher::getKernel( void ) -> Kernel
+{
+    return activeKernel.load();
+}
+
+auto Sha256Hasher::setKernel( const Kernel kernel ) -> bool
+{
+    if (!isKernelSupported(kernel))
     {
-      Res.push_back(x % 2);
-      x /= 2;
+        return false;
     }
-    while (Res.size() < 8)
-      Res.push_back(0);
-    std::reverse(Res.begin(), Res.end());
 
-    return Res;
-  };
+    activeKernel = kernel;
+    activeCompress = compressFor(kernel);
+    return true;
+}
+
+auto Sha256Hasher::isKernelSupported( const Kernel kernel ) -> bool
+{
+    return kernel == Kernel::kScalar || hasShaNi();
+}
 
-  auto ToBin64 = []( uint64_t x )
-  { 
-    std::vector<uint> Res;
+auto SHA256Digest( const void *data, size_t length ) -> Sha256Hasher::Digest
+{
+    Sha256Hasher hasher;
 
-    while (x > 0)
+    hasher.update(data, length);
+    return hasher.final();
+}
+
+auto PBKDF2SHA256( const void *password, size_t passwordLength, const void *salt, size_t saltLength,
+                   uint32_t iterations ) -> Sha256Hasher::Digest
+{
+    std::array<uint8_t, Sha256Hasher::kBlockSize> key {};
+
+    // HMAC hashes keys longer than a block
+    if (passwordLength > key.size())
     {
-      Res.push_back(x % 2);
-      x /= 2;
+        auto digest = SHA256Digest(password, passwordLength);
+
+        std::memcpy(key.data(), digest.data(), digest.size());
     }
-    while (Res.size() < 64)
-      Res.push_back(0);
-    std::reverse(Res.begin(), Res.end());
-
-    return Res;
-  };
-
-  /*
-   * STEP 1 - PREPROCESSING
-   */
-
-  // Convert message to binary
-  while (*Msg != 0)
-  {
-    auto tmp = ToBin(*Msg++);
-
-    Bulk.insert(Bulk.end(), tmp.begin(), tmp.end());
-  }
-
-  // Append a single 1
-  Bulk.push_back(1);
-
-  // Pad with 0's
-  while (Bulk.size() % 512 != 448)
-    Bulk.push_back(0);
-
-  // Add message length in bits
-  auto bitlen = ToBin64(length * 8);
-  Bulk.insert(Bulk.end(), bitlen.begin(), bitlen.end());
-
-  /*
-   * STEP 2 - INITIALIZE CONSTANTS
-   */
-  uint
-    h0 = 0xC1059ED8,
-    h1 = 0x367CD507,
-    h2 = 0x3070DD17,
-    h3 = 0xF70E5939,
-    h4 = 0xFFC00B31,
-    h5 = 0x68581511,
-    h6 = 0x64F98FA7,
-    h7 = 0xBEFA4FA4;
-  uint K[64] = 
-  {
-    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
-    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
-    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
-    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
-    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
-    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
-    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
-    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
-    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
-    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
-    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
-    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
-    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
-    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
-    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
-    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
-  };
-
-  /*
-   * STEP 3 - SHUNK LOOP
-   */
-  for (uint i = 0; i < (uint)Bulk.size(); i += 512)
-  {
-    std::vector<uint> SubBulk;
-
-    SubBulk.insert(SubBulk.end(), Bulk.begin() + i, Bulk.begin() + i + 512);
-
-    // Create words array
-    std::vector<uint> Words(64);
-
-    for (uint j = 0; j < 512; j += 32)
+    else if (passwordLength > 0)
     {
-      std::string BitWord;
-
-      for (uint k = 0; k < 32; k++)
-        BitWord += ('0' + SubBulk[i + j + k]);
-      Words[j / 32] = strtoul(BitWord.c_str(), nullptr, 2);
+        std::memcpy(key.data(), password, passwordLength);
     }
 
-    // Generate additional 48 words
-    for (uint j = 16; j < 64; j++)
+    // Padded keys fill exactly one block, so each iteration copies these states instead of hashing them again
+    Sha256Hasher inner;
+    Sha256Hasher outer;
+    std::array<uint8_t, Sha256Hasher::kBlockSize> pad;
+
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        pad[i] = key[i] ^ 0x36;
+    }
+    inner.update(pad.data(), pad.size());
+    for (size_t i = 0; i < key.size(); i++)
     {
-      uint s0 = (std::rotr(Words[j - 15], 7)) ^ (std::rotr(Words[j - 15], 18)) ^ (Words[j - 15] >> 3);
-      uint s1 = (std::rotr(Words[j - 2], 17)) ^ (std::rotr(Words[j - 2], 19)) ^ (Words[j - 2] >> 10);
+        pad[i] = key[i] ^ 0x5C;
+    }
+    outer.update(pad.data(), pad.size());
+
+    // Turns a copy of the inner state that has seen the message into the HMAC
+    auto finishHmac = [&outer]( Sha256Hasher &hasher ) {
+        auto innerDigest = hasher.final();
+
+        hasher = outer;
+        hasher.update(innerDigest.data(), innerDigest.size());
+        return hasher.final();
+    };
 
-      Words[j] = Words[j - 16] + s0 + Words[j - 7] + s1;
+    // Single output block, its index is big-endian 1
+    const uint8_t blockIndex[] = {0, 0, 0, 1};
+    Sha256Hasher hasher = inner;
+
+    hasher.update(salt, saltLength);
+    hasher.update(blockIndex, sizeof(blockIndex));
+
+    auto block = finishHmac(hasher);
+    auto result = block;
+
+    for (uint32_t i = 1; i < iterations; i++)
+    {
+        hasher = inner;
+        hasher.update(block.data(), block.size());
+        block = finishHmac(hasher);
+
+        for (size_t j = 0; j < result.size(); j++)
+        {
+            result[j] ^= block[j];
+        }
     }
 
-    // Initialize variables
-    uint
-      a = h0,
-      b = h1,
-      c = h2,
-      d = h3,
-      e = h4,
-      f = h5,
-      g = h6,
-      h = h7;
-
-    // Main cycle
-    for (uint j = 0; j < 64; j++)
+    std::memset(key.data(), 0, key.size());
+    std::memset(pad.data(), 0, pad.size());
+    return result;
+}
+
+auto toHex( const uint8_t *data, size_t length ) -> std::string
+{
+    static constexpr char digits[] = "0123456789ABCDEF";
+    std::string res(length * 2, '0');
+
+    for (size_t i = 0; i < length; i++)
     {
-      uint
-        E0 = (std::rotr(a, 2)) ^ (std::rotr(a, 13)) ^ (std::rotr(a, 22)),
-        Ma = (a & b) ^ (a & c) ^ (b & c),
-        t2 = E0 + Ma,
-        E1 = (std::rotr(e, 6)) ^ (std::rotr(e, 11)) ^ (std::rotr(e, 25)),
-        Ch = (e & f) ^ ((~e) & g),
-        t1 = h + E1 + Ch + K[j] + Words[j];
-
-      h = g;
-      g = f;
-      f = e;
-      e = d + t1;
-      d = c;
-      c = b;
-      b = a;
-      a = t1 + t2;
+        res[2 * i] = digits[data[i] >> 4];
+        res[2 * i + 1] = digits[data[i] & 0xF];
     }
 
-    // Add variables to hash
-    h0 = h0 + a;
-    h1 = h1 + b;
-    h2 = h2 + c;
-    h3 = h3 + d;
-    h4 = h4 + e;
-    h5 = h5 + f;
-    h6 = h6 + g;
-    h7 = h7 + h;
-  }
+    return res;
+}
 
-  std::string res;
-  char resBuf[57];
+std::string SHA256( const char *Msg, uint64_t length )
+{
+    auto digest = SHA256Digest(Msg, length);
+    return toHex(digest.data(), Sha256Hasher::kDigestSize);
+}
 
-  sprintf(resBuf, "%08X%08X%08X%08X%08X%08X%08X", h0, h1, h2, h3, h4, h5, h6);
-  res = resBuf;
+std::string SHA224( const char *Msg, uint64_t length )
+{
+    Sha256Hasher hasher(true);
 
-  return res;
+    hasher.update(Msg, length);
+
+    auto digest = hasher.final();
+    return toHex(digest.data(), Sha256Hasher::kDigest224Size);
 }
 
 std::string SHA256( const std::string &msg )
 {
-  return SHA256(msg.c_str(), msg.length());
+    return SHA256(msg.c_str(), msg.length());
 }
 
 std::string SHA224( const std::string &msg )
 {
-  return SHA224(msg.c_str(), msg.length());
-}
\ No newline at end of file
+    return SHA224(msg.c_str(), msg.length());
+}
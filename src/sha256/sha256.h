@@ -1,9 +1,58 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
+/* Incremental SHA-256 / SHA-224 over raw bytes.
+ * Block compression is dispatched once at runtime: SHA-NI when the CPU has it,
+ * portable scalar code otherwise.
+ */
+class Sha256Hasher final
+{
+public:
+    enum struct Kernel
+    {
+        kScalar,
+        kShaNi,
+    };
+
+    static constexpr size_t kBlockSize = 64;
+    static constexpr size_t kDigestSize = 32;
+    static constexpr size_t kDigest224Size = 28;
+
+    using Digest = std::array<uint8_t, kDigestSize>;
+
+    explicit Sha256Hasher( const bool is224 = false );
+
+    void init( void );
+    void update( const void *data, size_t length );
+    auto final( void ) -> Digest;
+
+    auto getDigestSize( void ) const -> size_t;
+
+    static auto getKernel( void ) -> Kernel;
+    static auto setKernel( const Kernel kernel ) -> bool;
+    static auto isKernelSupported( const Kernel kernel ) -> bool;
+
+private:
+    std::array<uint32_t, 8> _state {};
+    std::array<uint8_t, kBlockSize> _buffer {};
+    uint64_t _length {};
+    size_t _buffered {};
+    bool _is224;
+};
+
+auto SHA256Digest( const void *data, size_t length ) -> Sha256Hasher::Digest;
+auto toHex( const uint8_t *data, size_t length ) -> std::string;
+
+// PBKDF2-HMAC-SHA256 (RFC 8018) with a 32-byte output, the only length passwords need
+auto PBKDF2SHA256( const void *password, size_t passwordLength, const void *salt, size_t saltLength,
+                   uint32_t iterations ) -> Sha256Hasher::Digest;
+
 std::string SHA224( const char *Msg, uint64_t length );
 std::string SHA256( const char *Msg, uint64_t length );
 
 std::string SHA224( const std::string &msg );
-std::string SHA256( const std::string &msg );
\ No newline at end of file
+std::string SHA256( const std::string &msg );
@@ -1,17 +1,79 @@
 list( APPEND SERVER_INCLUDES
     ${CMAKE_CURRENT_LIST_DIR}/
     ${CMAKE_CURRENT_LIST_DIR}/database
+    ${CMAKE_CURRENT_LIST_DIR}/database/batch_queue/
+    ${CMAKE_CURRENT_LIST_DIR}/database/session_cache/
+    ${CMAKE_CURRENT_LIST_DIR}/database/statement_cache/
+    ${CMAKE_CURRENT_LIST_DIR}/database/connection_pool/
+    ${CMAKE_CURRENT_LIST_DIR}/database/message_ring/
+    ${CMAKE_CURRENT_LIST_DIR}/database/presence_tracker/
+    ${CMAKE_CURRENT_LIST_DIR}/database/room_partition/
+    ${CMAKE_CURRENT_LIST_DIR}/compression/
+    ${CMAKE_CURRENT_LIST_DIR}/config/
+    ${CMAKE_CURRENT_LIST_DIR}/logging/
+    ${CMAKE_CURRENT_LIST_DIR}/metrics/
+    ${CMAKE_CURRENT_LIST_DIR}/password/
     ${CMAKE_CURRENT_LIST_DIR}/sha256/
     ${CMAKE_CURRENT_LIST_DIR}/server/
     ${CMAKE_CURRENT_LIST_DIR}/server/response_converter/
     ${CMAKE_CURRENT_LIST_DIR}/server/response_error_builder/
+    ${CMAKE_CURRENT_LIST_DIR}/server/message_hub/
+    ${CMAKE_CURRENT_LIST_DIR}/server/static_assets/
+    ${CMAKE_CURRENT_LIST_DIR}/server/worker_pool/
+    ${CMAKE_CURRENT_LIST_DIR}/validation/
 )
 
 list( APPEND SERVER_SOURCES
     ${CMAKE_CURRENT_LIST_DIR}/
     ${CMAKE_CURRENT_LIST_DIR}/database/database.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/database/session_cache/session_cache.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/database/statement_cache/statement_cache.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/database/connection_pool/connection_pool.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/database/message_ring/message_ring.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/database/presence_tracker/presence_tracker.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/database/room_partition/room_partition.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/compression/compression.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/config/config.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/logging/logging.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/metrics/metrics.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/password/password.cpp
     ${CMAKE_CURRENT_LIST_DIR}/sha256/sha256.cpp
     ${CMAKE_CURRENT_LIST_DIR}/server/server.cpp
     ${CMAKE_CURRENT_LIST_DIR}/server/response_converter/response_converter.cpp
     ${CMAKE_CURRENT_LIST_DIR}/server/response_error_builder/response_error_builder.cpp
-)
\ No newline at end of file
+    ${CMAKE_CURRENT_LIST_DIR}/server/message_hub/message_hub.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/server/static_assets/static_assets.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/server/worker_pool/worker_pool.cpp
+)
+
+list( APPEND SERVER_DEFINITIONS
+    CHAT_PUBLIC_DIR="${CMAKE_CURRENT_LIST_DIR}/public"
+)
+
+option( CHAT_EMBED_ASSETS "Compile src/public into the binary instead of reading it at startup" OFF )
+
+if( CHAT_EMBED_ASSETS )
+    set( CHAT_EMBEDDED_ASSETS_SOURCE ${CMAKE_BINARY_DIR}/generated/embedded_assets.cpp )
+    file( GLOB_RECURSE CHAT_PUBLIC_FILES CONFIGURE_DEPENDS ${CMAKE_CURRENT_LIST_DIR}/public/* )
+
+    add_custom_command(
+        OUTPUT ${CHAT_EMBEDDED_ASSETS_SOURCE}
+        COMMAND ${CMAKE_COMMAND}
+            -DINPUT_DIR=${CMAKE_CURRENT_LIST_DIR}/public
+            -DOUTPUT_FILE=${CHAT_EMBEDDED_ASSETS_SOURCE}
+            -P ${PROJECT_SOURCE_DIR}/cmake/embed_assets.cmake
+        DEPENDS ${CHAT_PUBLIC_FILES} ${PROJECT_SOURCE_DIR}/cmake/embed_assets.cmake
+        COMMENT "Embedding static assets"
+    )
+
+    # Server and tests share the generated source, one target generates it for both
+    add_custom_target( embedded_assets DEPENDS ${CHAT_EMBEDDED_ASSETS_SOURCE} )
+
+    list( APPEND SERVER_SOURCES
+        ${CHAT_EMBEDDED_ASSETS_SOURCE}
+    )
+
+    list( APPEND SERVER_DEFINITIONS
+        CHAT_EMBED_ASSETS
+    )
+endif()
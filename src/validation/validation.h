@@ -0,0 +1,221 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/* Input checks for request handlers, run before anything reaches Database.
+ * Character classes are a constexpr table and text is walked once, so a check
+ * costs a pass over the input and never allocates.
+ */
+class Validation final
+{
+public:
+    enum struct Verdict
+    {
+        kValid,
+        kBlank,
+        kTooShort,
+        kTooLong,
+        kBadCharacter,
+        kBadUtf8,
+    };
+
+    static constexpr size_t kMinLogin = 3;
+    static constexpr size_t kMaxLogin = 20;
+    static constexpr size_t kMaxPassword = 128;
+    // Code points
+    static constexpr size_t kMaxName = 50;
+    // Code points, same as maxlength of the message input in chat.html
+    static constexpr size_t kMaxMessage = 1000;
+
+    // 3-20 of [a-zA-Z0-9_]
+    static constexpr auto checkLogin( std::string_view login ) -> Verdict
+    {
+        if (login.size() < kMinLogin)
+        {
+            return Verdict::kTooShort;
+        }
+        if (login.size() > kMaxLogin)
+        {
+            return Verdict::kTooLong;
+        }
+
+        for (char c : login)
+        {
+            if (!(kClasses[static_cast<uint8_t>(c)] & kLoginChar))
+            {
+                return Verdict::kBadCharacter;
+            }
+        }
+
+        return Verdict::kValid;
+    }
+
+    static constexpr auto checkPassword( std::string_view password ) -> Verdict
+    {
+        if (password.empty())
+        {
+            return Verdict::kTooShort;
+        }
+        return password.size() > kMaxPassword ? Verdict::kTooLong : Verdict::kValid;
+    }
+
+    // Any script, no control characters
+    static constexpr auto checkName( std::string_view name ) -> Verdict
+    {
+        return _checkText(name, kMaxName, false);
+    }
+
+    // Line breaks and tabs are kept, other control characters are not
+    static constexpr auto checkMessage( std::string_view text ) -> Verdict
+    {
+        return _checkText(text, kMaxMessage, true);
+    }
+
+    static constexpr auto describe( const Verdict verdict ) -> std::string_view
+    {
+        switch (verdict)
+        {
+        case Verdict::kValid:
+            return "is valid";
+        case Verdict::kBlank:
+            return "is empty";
+        case Verdict::kTooShort:
+            return "is too short";
+        case Verdict::kTooLong:
+            return "is too long";
+        case Verdict::kBadCharacter:
+            return "contains forbidden characters";
+        case Verdict::kBadUtf8:
+        default:
+            return "is not valid UTF-8";
+        }
+    }
+
+private:
+    static constexpr uint8_t kLoginChar = 1 << 0;
+    static constexpr uint8_t kSpace = 1 << 1;
+    static constexpr uint8_t kControl = 1 << 2;
+    // \t, \n and \r, allowed in messages only
+    static constexpr uint8_t kLineControl = 1 << 3;
+
+    static constexpr std::array<uint8_t, 256> kClasses = [] {
+        std::array<uint8_t, 256> classes {};
+
+        for (int c = 0; c < 256; c++)
+        {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')
+            {
+                classes[c] |= kLoginChar;
+            }
+            if (c < 0x20 || c == 0x7F)
+            {
+                classes[c] |= kControl;
+            }
+        }
+        for (int c : {'\t', '\n', '\r'})
+        {
+            classes[c] |= kLineControl;
+        }
+        for (int c : {' ', '\t', '\n', '\r', '\v', '\f'})
+        {
+            classes[c] |= kSpace;
+        }
+
+        return classes;
+    }();
+
+    // Strict UTF-8: no overlong forms, surrogates or code points above U+10FFFF
+    static constexpr auto _checkText( std::string_view text, const size_t maxCodePoints, const bool isMultiline )
+        -> Verdict
+    {
+        // Even all 4-byte sequences can not fit more than this
+        if (text.size() > maxCodePoints * 4)
+        {
+            return Verdict::kTooLong;
+        }
+
+        size_t codePoints = 0;
+        bool isBlank = true;
+
+        for (size_t i = 0; i < text.size(); codePoints++)
+        {
+            uint8_t lead = static_cast<uint8_t>(text[i]);
+
+            if (lead < 0x80)
+            {
+                uint8_t classes = kClasses[lead];
+
+                if ((classes & kControl) && !(isMultiline && (classes & kLineControl)))
+                {
+                    return Verdict::kBadCharacter;
+                }
+                isBlank = isBlank && (classes & kSpace);
+                i++;
+                continue;
+            }
+
+            size_t length = 0;
+            uint8_t min = 0x80;
+            uint8_t max = 0xBF;
+
+            // Second byte range is what rules out overlongs, surrogates and values past U+10FFFF
+            if (lead >= 0xC2 && lead <= 0xDF)
+            {
+                length = 2;
+            }
+            else if (lead >= 0xE0 && lead <= 0xEF)
+            {
+                length = 3;
+                min = lead == 0xE0 ? 0xA0 : 0x80;
+                max = lead == 0xED ? 0x9F : 0xBF;
+            }
+            else if (lead >= 0xF0 && lead <= 0xF4)
+            {
+                length = 4;
+                min = lead == 0xF0 ? 0x90 : 0x80;
+                max = lead == 0xF4 ? 0x8F : 0xBF;
+            }
+            else
+            {
+                return Verdict::kBadUtf8;
+            }
+
+            if (i + length > text.size())
+            {
+                return Verdict::kBadUtf8;
+            }
+
+            uint8_t second = static_cast<uint8_t>(text[i + 1]);
+
+            if (second < min || second > max)
+            {
+                return Verdict::kBadUtf8;
+            }
+            for (size_t j = 2; j < length; j++)
+            {
+                if ((static_cast<uint8_t>(text[i + j]) & 0xC0) != 0x80)
+                {
+                    return Verdict::kBadUtf8;
+                }
+            }
+
+            // C1 controls, U+0080..U+009F
+            if (lead == 0xC2 && second < 0xA0)
+            {
+                return Verdict::kBadCharacter;
+            }
+
+            isBlank = false;
+            i += length;
+        }
+
+        if (isBlank)
+        {
+            return Verdict::kBlank;
+        }
+
+        return codePoints > maxCodePoints ? Verdict::kTooLong : Verdict::kValid;
+    }
+};
@@ -1,8 +1,24 @@
 #include <gtest/gtest.h>
+#include <atomic>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <set>
+#include <thread>
 
+#include "compression.h"
+#include "config.h"
 #include "database.h"
+#include "logging.h"
+#include "message_hub.h"
+#include "metrics.h"
+#include "password.h"
+#include "response_converter.h"
+#include "server.h"
 #include "sha256.h"
+#include "static_assets.h"
+#include "validation.h"
+#include "worker_pool.h"
 
 /* Запланирую че по тестам 
  * 1.1. Добавление юзера (добавляем -> чекаем по логину)
@@ -255,4 +271,1535 @@ TEST(ServiceTests, messages_get_all_ways)
     }
 
     test.clear();
-}
\ No newline at end of file
+}
+
+TEST(ServiceTests, session_cache_test)
+{
+    Database test("test.db");
+
+    test.clear();
+
+    // Generate and login user (without test)
+    User user;
+    user.login = "testUser";
+    user.password = "qwert";
+    auto err = test.addUser(user);
+    auto res = test.loginUser("testUser", "qwert");
+
+    // Login fills the cache, so every lookup is a hit
+    auto before = test.getStats()["session_cache"];
+
+    ASSERT_NE(test.getUserByToken(res.first.token), std::nullopt);
+    ASSERT_EQ(test.isTokenExists(res.first.token), true);
+
+    auto after = test.getStats()["session_cache"];
+
+    ASSERT_EQ(after["hits"].get<int>() - before["hits"].get<int>(), 2);
+    ASSERT_EQ(after["size"].get<int>(), 1);
+
+    // Logout invalidates the session
+    test.logoutUser(res.first.token);
+
+    ASSERT_EQ(test.getUserByToken(res.first.token), std::nullopt);
+    ASSERT_EQ(test.getStats()["session_cache"]["size"].get<int>(), 0);
+
+    test.clear();
+}
+
+TEST(Sha256Tests, nist_vectors_test)
+{
+    const std::string million(1000000, 'a');
+    const std::string twoBlocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    const auto defaultKernel = Sha256Hasher::getKernel();
+
+    for (auto kernel : {Sha256Hasher::Kernel::kScalar, Sha256Hasher::Kernel::kShaNi})
+    {
+        if (!Sha256Hasher::setKernel(kernel))
+        {
+            continue;
+        }
+
+        ASSERT_EQ(SHA256(""), "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855");
+        ASSERT_EQ(SHA256("abc"), "BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD");
+        ASSERT_EQ(SHA256(twoBlocks), "248D6A61D20638B8E5C026930C3E6039A33CE45964FF2167F6ECEDD419DB06C1");
+        ASSERT_EQ(SHA256(million), "CDC76E5C9914FB9281A1C7E284D73E67F1809A48A497200E046D39CCC7112CD0");
+
+        ASSERT_EQ(SHA224(""), "D14A028C2A3A2BC9476102BB288234C415A2B01F828EA62AC5B3E42F");
+        ASSERT_EQ(SHA224("abc"), "23097D223405D8228642A477BDA255B32AADBCE4BDA0B3F7E36C9DA7");
+        ASSERT_EQ(SHA224(twoBlocks), "75388B16512776CC5DBA5DA1FD890150B0C6455CB4F58B1952522525");
+    }
+
+    Sha256Hasher::setKernel(defaultKernel);
+}
+
+TEST(Sha256Tests, streaming_test)
+{
+    std::string msg;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        msg += static_cast<char>(i % 251);
+    }
+
+    // Any split of the input gives the same digest as the one-shot call
+    for (size_t step : {1, 3, 63, 64, 65, 200})
+    {
+        Sha256Hasher hasher;
+
+        for (size_t i = 0; i < msg.size(); i += step)
+        {
+            hasher.update(msg.data() + i, std::min(step, msg.size() - i));
+        }
+
+        auto digest = hasher.final();
+
+        ASSERT_EQ(toHex(digest.data(), digest.size()), SHA256(msg));
+    }
+
+    // Embedded NUL bytes are part of the message
+    ASSERT_NE(SHA256(std::string("a\0b", 3)), SHA256("a"));
+}
+
+TEST(ServiceTests, statement_cache_test)
+{
+    Database test("test.db");
+
+    test.clear();
+
+    User user;
+    user.login = "testUser";
+    user.password = "qwert";
+    test.addUser(user);
+
+    // First lookup prepares the statement, the next ones only rebind it
+    for (int i = 0; i < 5; i++)
+    {
+        ASSERT_NE(test.getUserByLogin("testUser"), std::nullopt);
+        ASSERT_EQ(test.getUserByLogin("dummy"), std::nullopt);
+    }
+
+    auto stats = test.getStats()["statement_cache"];
+
+    ASSERT_EQ(stats["size"].get<int>(), stats["prepared"].get<int>());
+    ASSERT_GE(stats["reused"].get<int>(), 9);
+
+    test.clear();
+}
+
+TEST(ServiceTests, concurrent_access_test)
+{
+    Database test("test.db", DatabaseOptions {.readers = 4, .busyTimeoutMs = 5000});
+
+    test.clear();
+
+    User user;
+    user.login = "testUser";
+    user.password = "qwert";
+    test.addUser(user);
+
+    auto token = test.loginUser("testUser", "qwert").first.token;
+    int userId = test.getUserByLogin("testUser")->id;
+
+    const int writers = 4, readers = 8, N = 100;
+    std::atomic<int> errors {};
+    std::vector<std::thread> threads;
+
+    // Writers and readers hammer the base at the same time, nothing may fail with SQLITE_BUSY
+    for (int i = 0; i < writers; i++)
+    {
+        threads.emplace_back([&] {
+            for (int j = 0; j < N; j++)
+            {
+                if (test.sendMessage(userId, "Concurrent message").second)
+                {
+                    errors++;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < readers; i++)
+    {
+        threads.emplace_back([&] {
+            for (int j = 0; j < N; j++)
+            {
+                if (!test.getUserById(userId) || test.getLastMessages(10).size() > 10)
+                {
+                    errors++;
+                }
+                test.getMessagesAfter(0);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    ASSERT_EQ(errors.load(), 0);
+    ASSERT_EQ(test.getMessageCount(), writers * N);
+    ASSERT_NE(test.getUserByToken(token), std::nullopt);
+
+    test.clear();
+}
+
+TEST(ServiceTests, recent_messages_test)
+{
+    const int capacity = 10, N = 30;
+    Database test("test.db", DatabaseOptions {.recentMessages = capacity});
+
+    test.clear();
+
+    User user;
+    user.login = "testUser";
+    user.password = "qwert";
+    test.addUser(user);
+    int userId = test.getUserByLogin("testUser")->id;
+
+    for (int i = 0; i < N; i++)
+    {
+        test.sendMessage(userId, "Message " + std::to_string(i + 1));
+    }
+
+    // Inside of the window - served from memory
+    auto before = test.getStats()["recent_messages"];
+
+    ASSERT_EQ(test.getLastMessages(capacity / 2).size(), capacity / 2);
+    ASSERT_EQ(test.getMessagesAfter(N - 3).size(), 3);
+    ASSERT_EQ(test.getMessagesAfter(N - capacity).size(), capacity);
+
+    auto after = test.getStats()["recent_messages"];
+
+    ASSERT_EQ(after["hits"].get<int>() - before["hits"].get<int>(), 3);
+    ASSERT_EQ(after["size"].get<int>(), capacity);
+
+    // Deeper history goes to SQL and gives the same answer
+    auto all = test.getMessagesAfter(0);
+
+    ASSERT_EQ(all.size(), N);
+    ASSERT_EQ(test.getLastMessages(N * 2).size(), N);
+
+    for (int i = 0; i < N; i++)
+    {
+        ASSERT_EQ(all[i]->messageText, "Message " + std::to_string(i + 1));
+    }
+
+    auto last = test.getLastMessages(capacity);
+
+    ASSERT_EQ(last.front()->id, all[N - capacity]->id);
+    ASSERT_EQ(last.back()->id, all.back()->id);
+
+    test.clear();
+}
+
+TEST(DatabaseTests, messages_page_test)
+{
+    Database test("test.db");
+    User usr {.login = "Page", .password = "123", .firstName = "Pa\"ge", .lastName = "Тест"};
+
+    test.clear();
+    test.addUser(usr);
+    int userId = test.getUserByLogin(usr.login)->id;
+
+    for (int i = 0; i < 5; i++)
+    {
+        auto [msg, err] = test.sendMessage(userId, "Line\n" + std::to_string(i) + " \"quoted\" юникод");
+
+        ASSERT_FALSE(err);
+        ASSERT_EQ(msg->json, msg->toJson().dump());
+    }
+
+    // Spliced page must be byte-for-byte the old nlohmann envelope
+    for (const auto &messages : {test.getLastMessages(3), test.getMessagesAfter(0), test.getMessagesAfter(100)})
+    {
+        nlohmann::json msgArray = nlohmann::json::array();
+
+        for (const auto &msg : messages)
+        {
+            msgArray.push_back(msg->toJson());
+        }
+
+        nlohmann::json payload = {
+            {"total_count", msgArray.size()},
+            {"messages", msgArray}
+        };
+
+        ASSERT_EQ(ResponseConverter::toMessagesPage(messages), payload.dump());
+    }
+
+    test.clear();
+}
+
+TEST(StaticAssetsTests, public_assets_test)
+{
+    // Whatever the build serves: src/public from disk or the embedded copy
+    StaticAssets assets;
+
+    ASSERT_GT(assets.getStats().count, 0);
+    ASSERT_EQ(assets.find("/"), assets.find("/index.html"));
+    ASSERT_EQ(assets.find("/chat"), assets.find("/chat.html"));
+    ASSERT_EQ(assets.find("/missing.css"), nullptr);
+    ASSERT_EQ(assets.find("/../public/index.html"), nullptr);
+
+    auto script = assets.find("/js/chat.js");
+
+    ASSERT_NE(script, nullptr);
+    ASSERT_EQ(script->contentType, "application/javascript");
+    ASSERT_EQ(script->identity.etag.size(), 34);
+    ASSERT_EQ(script->identity.etag, StaticAssets().find("/js/chat.js")->identity.etag);
+    ASSERT_EQ(!script->gzip.data.empty(), Compression::isSupported(Compression::Encoding::kGzip));
+    ASSERT_EQ(!script->brotli.data.empty(), Compression::isSupported(Compression::Encoding::kBrotli));
+
+    ASSERT_TRUE(Compression::isAccepted("gzip, deflate, br", Compression::Encoding::kBrotli));
+    ASSERT_TRUE(Compression::isAccepted("GZIP;q=0.5", Compression::Encoding::kGzip));
+    ASSERT_TRUE(Compression::isAccepted("*", Compression::Encoding::kGzip));
+    ASSERT_FALSE(Compression::isAccepted("gzip;q=0, deflate", Compression::Encoding::kGzip));
+    ASSERT_FALSE(Compression::isAccepted("deflate", Compression::Encoding::kBrotli));
+
+    // Served variant follows Accept-Encoding, a matching validator gives 304
+    httplib::Request req;
+    httplib::Response res;
+
+    req.path = "/js/chat.js";
+    req.headers.emplace("Accept-Encoding", "gzip");
+    assets.serve(req, res);
+
+    auto etag = res.get_header_value("ETag");
+
+    if (Compression::isSupported(Compression::Encoding::kGzip))
+    {
+        ASSERT_EQ(res.get_header_value("Content-Encoding"), "gzip");
+        ASSERT_EQ(etag, script->gzip.etag);
+    }
+
+    httplib::Response cached;
+
+    req.headers.emplace("If-None-Match", "W/\"0000\", " + etag);
+    assets.serve(req, cached);
+    ASSERT_EQ(cached.status, httplib::StatusCode::NotModified_304);
+    ASSERT_TRUE(cached.body.empty());
+}
+
+TEST(StaticAssetsTests, hot_reload_test)
+{
+    auto root = std::filesystem::temp_directory_path() / "chat_assets_test";
+    auto write = [&]( const std::string &name, const std::string &content ) {
+        std::filesystem::create_directories((root / name).parent_path());
+        std::ofstream(root / name, std::ios::binary) << content;
+    };
+
+    std::filesystem::remove_all(root);
+    write("index.html", "<html>index</html>");
+    write("chat.html", "<html>chat</html>");
+
+    StaticAssets dev(root, true);
+    auto before = dev.find("/chat");
+
+    ASSERT_EQ(dev.find("/")->identity.data, "<html>index</html>");
+    ASSERT_EQ(before->identity.data, "<html>chat</html>");
+
+    write("chat.html", "<html>edited</html>");
+    std::filesystem::last_write_time(root / "chat.html", before->modifiedAt + std::chrono::seconds(1));
+
+    ASSERT_EQ(dev.find("/chat")->identity.data, "<html>edited</html>");
+    ASSERT_NE(dev.find("/chat")->identity.etag, before->identity.etag);
+
+    // New files show up, deleted ones go away
+    write("js/new.js", "let a = 1;");
+    ASSERT_NE(dev.find("/js/new.js"), nullptr);
+
+    std::filesystem::remove(root / "index.html");
+    ASSERT_EQ(dev.find("/"), nullptr);
+
+    std::filesystem::remove_all(root);
+}
+
+TEST(ServiceTests, keyset_pagination_test)
+{
+    const int capacity = 10, N = 50, page = 7;
+    Database test("test.db", DatabaseOptions {.recentMessages = capacity});
+
+    test.clear();
+    test.addUser(User {.login = "pager", .password = "qwert", .firstName = "Pager"});
+    int userId = test.getUserByLogin("pager")->id;
+
+    for (int i = 0; i < N; i++)
+    {
+        test.sendMessage(userId, "Message " + std::to_string(i + 1));
+    }
+
+    auto all = test.getMessagesAfter(0);
+
+    ASSERT_EQ(all.size(), N);
+
+    // Backwards from the newest page, through the window and then SQL
+    std::vector<MessagePtr> backwards = test.getLastMessages(page);
+
+    while (true)
+    {
+        auto older = test.getMessagesBefore(backwards.front()->id, page);
+
+        if (older.empty())
+        {
+            break;
+        }
+        ASSERT_LE(older.size(), page);
+        backwards.insert(backwards.begin(), older.begin(), older.end());
+    }
+
+    // Forwards from the start
+    std::vector<MessagePtr> forwards;
+
+    for (int cursor = 0;;)
+    {
+        auto newer = test.getMessagesAfter(cursor, page);
+
+        if (newer.empty())
+        {
+            break;
+        }
+        ASSERT_LE(newer.size(), page);
+        forwards.insert(forwards.end(), newer.begin(), newer.end());
+        cursor = newer.back()->id;
+    }
+
+    ASSERT_EQ(backwards.size(), N);
+    ASSERT_EQ(forwards.size(), N);
+
+    for (int i = 0; i < N; i++)
+    {
+        ASSERT_EQ(backwards[i]->id, all[i]->id);
+        ASSERT_EQ(forwards[i]->id, all[i]->id);
+    }
+
+    // Pages walk the (room_id, id) index, no sorting step
+    SQLite::Database db("test.db", SQLite::OPEN_READONLY);
+    SQLite::Statement plan(db, R"(
+        EXPLAIN QUERY PLAN
+        SELECT m.* FROM messages m LEFT JOIN users u ON m.user_id = u.id
+        WHERE m.room_id = 1 AND m.id < 100 ORDER BY m.id DESC LIMIT 10
+    )");
+
+    while (plan.executeStep())
+    {
+        ASSERT_EQ(plan.getColumn(3).getString().find("TEMP B-TREE"), std::string::npos);
+    }
+
+    test.clear();
+}
+
+TEST(ServiceTests, counters_test)
+{
+    {
+        Database test("test.db");
+
+        test.clear();
+
+        for (int i = 0; i < 5; i++)
+        {
+            test.addUser(User {.login = "counter" + std::to_string(i), .password = "pass", .firstName = "Counter"});
+        }
+
+        // Duplicate login is rejected and not counted
+        ASSERT_TRUE(test.addUser(User {.login = "counter0", .password = "pass", .firstName = "Counter"}));
+
+        auto first = test.loginUser("counter0", "pass").first;
+        auto second = test.loginUser("counter0", "pass").first;
+        test.loginUser("counter1", "pass");
+
+        ASSERT_EQ(test.getCounts().online, 2);
+
+        test.logoutUser(first.token);
+        ASSERT_EQ(test.getCounts().online, 1);
+        ASSERT_TRUE(test.logoutUser(first.token));
+        ASSERT_EQ(test.getCounts().online, 1);
+
+        int userId = test.getUserByLogin("counter2")->id;
+
+        for (int i = 0; i < 7; i++)
+        {
+            test.sendMessage(userId, "Count me");
+        }
+
+        auto counts = test.getCounts();
+
+        ASSERT_EQ(counts.users, 5);
+        ASSERT_EQ(counts.messages, 7);
+        ASSERT_EQ(counts.messages, test.getMessageCount());
+    }
+
+    // Reopened database starts from the stored rows, everyone is offline
+    Database test("test.db");
+    auto counts = test.getCounts();
+
+    ASSERT_EQ(counts.users, 5);
+    ASSERT_EQ(counts.messages, 7);
+    ASSERT_EQ(counts.online, 0);
+
+    test.clear();
+    ASSERT_EQ(test.getCounts().users, 0);
+    ASSERT_EQ(test.getCounts().messages, 0);
+}
+
+TEST(ServiceTests, presence_test)
+{
+    PresenceTracker presence(4);
+    PresenceTracker::Delta delta;
+    uint64_t start = presence.getVersion();
+
+    ASSERT_TRUE(presence.join(User {.id = 1, .login = "one", .password = "secret"}));
+    ASSERT_FALSE(presence.join(User {.id = 1, .login = "one"}));
+    ASSERT_TRUE(presence.join(User {.id = 2, .login = "two"}));
+    ASSERT_TRUE(presence.leave(1));
+    ASSERT_FALSE(presence.leave(1));
+
+    ASSERT_TRUE(presence.getDelta(start, delta));
+    ASSERT_EQ(delta.version, start + 3);
+    ASSERT_EQ(delta.total, 1);
+    ASSERT_EQ(delta.joined.size(), 1);
+    ASSERT_EQ(delta.joined[0].id, 2);
+    ASSERT_TRUE(delta.joined[0].password.empty());
+    ASSERT_EQ(delta.left, std::vector<int> {1});
+
+    // Up to date, and versions the tracker has never given out
+    PresenceTracker::Delta same;
+
+    ASSERT_TRUE(presence.getDelta(presence.getVersion(), same));
+    ASSERT_TRUE(same.joined.empty() && same.left.empty());
+    ASSERT_FALSE(presence.getDelta(presence.getVersion() + 1, same));
+
+    // Older than the history
+    for (int i = 3; i < 10; i++)
+    {
+        presence.join(User {.id = i});
+    }
+    ASSERT_FALSE(presence.getDelta(start, same));
+
+    // Database keeps the column only as a lazily written copy
+    Database test("test.db", DatabaseOptions {.presenceFlush = std::chrono::hours(1)});
+
+    test.clear();
+    test.addUser(User {.login = "present", .password = "pass", .firstName = "Present"});
+
+    auto isOnlineStored = [&] {
+        SQLite::Database db("test.db", SQLite::OPEN_READONLY);
+        return db.execAndGet("SELECT is_online FROM users WHERE login = 'present'").getInt();
+    };
+
+    auto token = test.loginUser("present", "pass").first;
+
+    ASSERT_TRUE(test.getUserByLogin("present")->isOnline);
+    ASSERT_EQ(test.getOnlineUsers().size(), 1);
+    ASSERT_EQ(isOnlineStored(), 0);
+
+    test.flushPresence();
+    ASSERT_EQ(isOnlineStored(), 1);
+
+    test.logoutUser(token.token);
+    ASSERT_FALSE(test.getUserByLogin("present")->isOnline);
+    ASSERT_EQ(isOnlineStored(), 1);
+
+    test.flushPresence();
+    ASSERT_EQ(isOnlineStored(), 0);
+
+    test.clear();
+}
+
+TEST(ServiceTests, group_commit_test)
+{
+    const int N = 500;
+    Database test("test.db", DatabaseOptions {.maxBatch = 64, .maxBatchLatency = std::chrono::milliseconds(5)});
+
+    test.clear();
+    test.addUser(User {.login = "batcher", .password = "pass", .firstName = "Batcher"});
+    int userId = test.getUserByLogin("batcher")->id;
+
+    std::vector<int> published;
+
+    test.setMessageListener([&]( const MessagePtr &msg ) {
+        published.push_back(msg->id);
+    });
+
+    // Queue everything first, the writer folds it into a few transactions
+    std::vector<std::future<std::pair<MessagePtr, Database::Error>>> futures;
+
+    for (int i = 0; i < N; i++)
+    {
+        futures.push_back(test.queueMessage(userId, "Batched " + std::to_string(i)));
+    }
+
+    // Unknown author fails alone, the rest of its batch is stored
+    auto orphan = test.queueMessage(userId + 1000, "Nobody");
+
+    for (int i = 0; i < N; i++)
+    {
+        auto [msg, err] = futures[i].get();
+
+        ASSERT_FALSE(err);
+        ASSERT_EQ(msg->messageText, "Batched " + std::to_string(i));
+        ASSERT_EQ(msg->user.login, "batcher");
+    }
+    ASSERT_TRUE(orphan.get().second);
+
+    auto stats = test.getStats()["write_queue"];
+
+    ASSERT_EQ(stats["messages"].get<int>(), N + 1);
+    ASSERT_LT(stats["batches"].get<int>(), N / 2);
+    ASSERT_LE(stats["largest_batch"].get<int>(), 64);
+
+    ASSERT_EQ(published.size(), N);
+    ASSERT_TRUE(std::is_sorted(published.begin(), published.end()));
+    ASSERT_EQ(test.getMessageCount(), N);
+    ASSERT_EQ(test.getMessagesAfter(0).size(), N);
+
+    test.setMessageListener(nullptr);
+    test.clear();
+}
+
+TEST(LoggingTests, throttle_test)
+{
+    LogThrottle throttle(std::chrono::milliseconds(50));
+
+    ASSERT_EQ(throttle.acquire(), 0u);
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_FALSE(throttle.acquire());
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    ASSERT_EQ(throttle.acquire(), 3u);
+    ASSERT_FALSE(throttle.acquire());
+
+    ASSERT_TRUE(Logging::setLevel("debug"));
+    ASSERT_EQ(Logging::getLevel(), "debug");
+    ASSERT_FALSE(Logging::setLevel("verbose"));
+    ASSERT_EQ(Logging::getLevel(), "debug");
+    ASSERT_TRUE(Logging::setLevel("err"));
+    ASSERT_EQ(spdlog::get_level(), spdlog::level::err);
+}
+
+TEST(MetricsTests, histogram_test)
+{
+    // Every value lands in a bucket whose limit is at most 12.5% above it
+    for (uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull, 123456ull, 999999999ull, 1ull << 40})
+    {
+        size_t bucket = Histogram::getBucket(value);
+
+        ASSERT_LT(bucket, Histogram::kBuckets);
+        ASSERT_GE(Histogram::getBucketLimit(bucket), value);
+        ASSERT_LE(Histogram::getBucketLimit(bucket), value + value / 8);
+        if (bucket > 0)
+        {
+            ASSERT_LT(Histogram::getBucketLimit(bucket - 1), value);
+        }
+    }
+
+    Histogram histogram;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&histogram] {
+            for (uint64_t i = 1; i <= 1000; i++)
+            {
+                histogram.record(i * 1000);
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    auto snapshot = histogram.getSnapshot();
+
+    ASSERT_EQ(snapshot.count, 4000);
+    ASSERT_EQ(snapshot.sum, 4 * 1000 * 500500ull);
+    ASSERT_NEAR(snapshot.getPercentile(0.5), 500000, 500000 / 8);
+    ASSERT_NEAR(snapshot.getPercentile(0.99), 990000, 990000 / 8);
+    ASSERT_EQ(snapshot.getCountUpTo(1ull << 40), 4000);
+}
+
+TEST(MetricsTests, prometheus_test)
+{
+    Metrics metrics;
+    auto &route = metrics.addRoute("GET", "/api/alive");
+    auto &timer = metrics.addTimer("getUserById");
+
+    for (int i = 0; i < 3; i++)
+    {
+        route.inFlight++;
+        route.finish(200, std::chrono::microseconds(30));
+    }
+    route.inFlight++;
+    route.finish(401, std::chrono::milliseconds(2));
+    timer.record(7'000'000);
+
+    std::string text;
+
+    metrics.write(text);
+
+    ASSERT_NE(text.find("chat_http_requests_total{method=\"GET\",route=\"/api/alive\",code=\"200\"} 3\n"), std::string::npos);
+    ASSERT_NE(text.find("chat_http_requests_total{method=\"GET\",route=\"/api/alive\",code=\"401\"} 1\n"), std::string::npos);
+    ASSERT_NE(text.find("chat_http_requests_in_flight{method=\"GET\",route=\"/api/alive\"} 0\n"), std::string::npos);
+    ASSERT_NE(text.find("chat_http_request_duration_seconds_bucket{method=\"GET\",route=\"/api/alive\",le=\"0.00005\"} 3\n"),
+              std::string::npos);
+    ASSERT_NE(text.find("chat_http_request_duration_seconds_count{method=\"GET\",route=\"/api/alive\"} 4\n"), std::string::npos);
+    ASSERT_NE(text.find("chat_db_query_duration_seconds_bucket{method=\"getUserById\",le=\"0.005\"} 0\n"), std::string::npos);
+    ASSERT_NE(text.find("chat_db_query_duration_seconds_bucket{method=\"getUserById\",le=\"0.01\"} 1\n"), std::string::npos);
+
+    // Database times its own queries
+    Database test("test.db");
+    std::string dbText;
+    User user;
+
+    test.clear();
+    user.login = "timed";
+    user.password = "qwert";
+    test.addUser(user);
+    test.getMetrics().write(dbText);
+
+    ASSERT_NE(dbText.find("chat_db_query_duration_seconds_count{method=\"addUser\"} 1\n"), std::string::npos);
+    test.clear();
+}
+
+TEST(ConfigTests, args_and_file_test)
+{
+    auto path = std::filesystem::temp_directory_path() / "chat_config_test.json";
+
+    std::ofstream(path) << R"({"port": 9000, "database": "file.db", "http": {"threads": 16, "keep_alive_max_count": 50},
+                              "sqlite": {"mmap_bytes": 268435456}})";
+
+    // Flags win over the file even when they come first
+    std::string pathArg = path.string();
+    std::vector<const char *> args = {"server", "--threads", "4", "--config", pathArg.c_str(), "--dev"};
+    auto config = ServerConfig::fromArgs(static_cast<int>(args.size()), const_cast<char **>(args.data()));
+
+    ASSERT_EQ(config.port, 9000);
+    ASSERT_EQ(config.database, "file.db");
+    ASSERT_EQ(config.threads, 4);
+    ASSERT_EQ(config.keepAliveMaxCount, 50);
+    ASSERT_EQ(config.sqliteMmapSize, 268435456);
+    ASSERT_TRUE(config.devMode);
+    ASSERT_EQ(config.toJson()["http"]["threads"], 4);
+
+    auto parse = []( std::vector<const char *> args ) {
+        args.insert(args.begin(), "server");
+        return ServerConfig::fromArgs(static_cast<int>(args.size()), const_cast<char **>(args.data()));
+    };
+
+    ASSERT_THROW(parse({"--port", "70000"}), std::invalid_argument);
+    ASSERT_THROW(parse({"--port", "80a"}), std::invalid_argument);
+    ASSERT_THROW(parse({"--threads", "0"}), std::invalid_argument);
+    ASSERT_THROW(parse({"--max-streams", "0"}), std::invalid_argument);
+    ASSERT_EQ(parse({"--max-streams", "8"}).toJson()["http"]["max_streams"], 8);
+    ASSERT_THROW(parse({"--max-body", "-1"}), std::invalid_argument);
+    ASSERT_THROW(parse({"--log-level", "loud"}), std::invalid_argument);
+    ASSERT_THROW(parse({"--unknown"}), std::invalid_argument);
+    ASSERT_THROW(parse({"--read-timeout"}), std::invalid_argument);
+
+    std::ofstream(path) << R"({"http": {"workers": 4}})";
+    ASSERT_THROW(parse({"--config", pathArg.c_str()}), std::invalid_argument);
+
+    std::ofstream(path) << R"({"port": "8080"})";
+    ASSERT_THROW(parse({"--config", pathArg.c_str()}), std::invalid_argument);
+
+    std::filesystem::remove(path);
+}
+
+// Whole layer is constexpr, so most of it is checked while compiling
+static_assert(Validation::checkLogin("user_42") == Validation::Verdict::kValid);
+static_assert(Validation::checkLogin("ab") == Validation::Verdict::kTooShort);
+static_assert(Validation::checkLogin("bad-login") == Validation::Verdict::kBadCharacter);
+static_assert(Validation::checkName("Мария") == Validation::Verdict::kValid);
+static_assert(Validation::checkMessage("Привет!\nКак дела? 👋") == Validation::Verdict::kValid);
+
+TEST(ValidationTests, text_test)
+{
+    using Verdict = Validation::Verdict;
+
+    ASSERT_EQ(Validation::checkLogin(std::string(20, 'a')), Verdict::kValid);
+    ASSERT_EQ(Validation::checkLogin(std::string(21, 'a')), Verdict::kTooLong);
+    ASSERT_EQ(Validation::checkLogin("логин"), Verdict::kBadCharacter);
+    ASSERT_EQ(Validation::checkPassword(""), Verdict::kTooShort);
+    ASSERT_EQ(Validation::checkPassword(std::string(129, 'p')), Verdict::kTooLong);
+
+    ASSERT_EQ(Validation::checkName("   "), Verdict::kBlank);
+    ASSERT_EQ(Validation::checkName("Ann\nBob"), Verdict::kBadCharacter);
+    ASSERT_EQ(Validation::checkName(std::string(50, 'x')), Verdict::kValid);
+    ASSERT_EQ(Validation::checkName(std::string(51, 'x')), Verdict::kTooLong);
+
+    ASSERT_EQ(Validation::checkMessage(""), Verdict::kBlank);
+    ASSERT_EQ(Validation::checkMessage(" \n\t"), Verdict::kBlank);
+    ASSERT_EQ(Validation::checkMessage("line\r\nline\ttab"), Verdict::kValid);
+    ASSERT_EQ(Validation::checkMessage(std::string("nul\0byte", 8)), Verdict::kBadCharacter);
+    ASSERT_EQ(Validation::checkMessage("bell\x07"), Verdict::kBadCharacter);
+
+    // Length is in code points: 1000 Cyrillic letters are 2000 bytes and still fit
+    std::string cyrillic;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        cyrillic += "ж";
+    }
+    ASSERT_EQ(Validation::checkMessage(cyrillic), Verdict::kValid);
+    ASSERT_EQ(Validation::checkMessage(cyrillic + "ж"), Verdict::kTooLong);
+
+    // Truncated, overlong, surrogate, past U+10FFFF, stray continuation, C1 control
+    for (const char *bad : {"\xD0", "\xE2\x82", "\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80",
+                            "\x80", "\xFF"})
+    {
+        ASSERT_EQ(Validation::checkMessage(bad), Verdict::kBadUtf8) << bad;
+    }
+    ASSERT_EQ(Validation::checkMessage("\xC2\x85"), Verdict::kBadCharacter);
+    ASSERT_EQ(Validation::checkMessage("\xF4\x8F\xBF\xBF"), Verdict::kValid);
+}
+
+TEST(ServiceTests, token_test)
+{
+    Database test("test.db");
+    std::set<std::string> tokens;
+
+    test.clear();
+    test.addUser(User {.login = "holder", .password = "pass", .firstName = "Holder"});
+
+    // Every login is a separate session with its own random token
+    for (int i = 0; i < 100; i++)
+    {
+        auto [token, err] = test.loginUser("holder", "pass");
+
+        ASSERT_FALSE(err);
+        ASSERT_EQ(token.token.size(), 64);
+        ASSERT_EQ(token.token.find_first_not_of("0123456789ABCDEF"), std::string::npos);
+        tokens.insert(token.token);
+    }
+    ASSERT_EQ(tokens.size(), 100);
+
+    const std::string token = *tokens.begin();
+
+    // Logout finds the row by hash of the token
+    ASSERT_FALSE(test.logoutUser(token));
+    ASSERT_TRUE(test.logoutUser(token));
+    ASSERT_FALSE(test.isTokenExists(token));
+    ASSERT_TRUE(test.isTokenExists(*std::next(tokens.begin())));
+
+    test.clear();
+}
+
+TEST(Sha256Tests, pbkdf2_test)
+{
+    auto pbkdf2 = []( const std::string &password, const std::string &salt, const uint32_t iterations ) {
+        auto digest = PBKDF2SHA256(password.data(), password.size(), salt.data(), salt.size(), iterations);
+        return toHex(digest.data(), digest.size());
+    };
+
+    // RFC 7914 and the usual PBKDF2-HMAC-SHA256 vectors, first 32 bytes
+    ASSERT_EQ(pbkdf2("passwd", "salt", 1), "55AC046E56E3089FEC1691C22544B605F94185216DDE0465E68B9D57C20DACBC");
+    ASSERT_EQ(pbkdf2("password", "salt", 1), "120FB6CFFCF8B32C43E7225256C4F837A86548C92CCC35480805987CB70BE17B");
+    ASSERT_EQ(pbkdf2("password", "salt", 2), "AE4D0C95AF6B46D32D0ADFF928F06DD02A303F8EF3C251DFD6E2D85A95474C43");
+    ASSERT_EQ(pbkdf2("password", "salt", 4096), "C5E478D59288C841AA530DB6845C4C8D962893A001CE4E11A4963873AA98134A");
+    // Key longer than a block is hashed first
+    std::string longKey(100, 'k');
+    auto keyDigest = SHA256Digest(longKey.data(), longKey.size());
+
+    ASSERT_EQ(pbkdf2(longKey, "salt", 2), pbkdf2(std::string(keyDigest.begin(), keyDigest.end()), "salt", 2));
+}
+
+TEST(ServiceTests, password_upgrade_test)
+{
+    const uint8_t salt[Password::kSaltBytes] = {1, 2, 3};
+    auto stored = Password::hash("secret", salt, sizeof(salt), 2000);
+
+    ASSERT_TRUE(stored.starts_with("pbkdf2-sha256$2000$"));
+    ASSERT_EQ(Password::verify("secret", stored, 2000), Password::Verdict::kMatch);
+    ASSERT_EQ(Password::verify("secret", stored, 4000), Password::Verdict::kOutdated);
+    ASSERT_EQ(Password::verify("Secret", stored, 2000), Password::Verdict::kMismatch);
+    ASSERT_EQ(Password::verify("secret", "pbkdf2-sha256$2000$zz$00", 2000), Password::Verdict::kMismatch);
+    ASSERT_EQ(Password::verify("secret", SHA256("secret"), 2000), Password::Verdict::kOutdated);
+
+    auto readStored = []( const std::string &login ) {
+        SQLite::Database db("test.db", SQLite::OPEN_READONLY);
+        SQLite::Statement query(db, "SELECT password FROM users WHERE login = ?");
+
+        query.bind(1, login);
+        query.executeStep();
+        return query.getColumn(0).getString();
+    };
+
+    {
+        Database test("test.db", DatabaseOptions {.passwordIterations = 1000});
+
+        test.clear();
+        test.addUser(User {.login = "legacy", .password = "qwert", .firstName = "Old"});
+    }
+    {
+        // Row as written before PBKDF2
+        SQLite::Database db("test.db", SQLite::OPEN_READWRITE);
+
+        db.exec("UPDATE users SET password = '" + SHA256("qwert") + "' WHERE login = 'legacy'");
+    }
+
+    Database test("test.db", DatabaseOptions {.passwordIterations = 2000});
+
+    ASSERT_EQ(test.loginUser("legacy", "qwerty").second.errorId, 401);
+    ASSERT_FALSE(test.loginUser("legacy", "qwert").second);
+    ASSERT_TRUE(readStored("legacy").starts_with("pbkdf2-sha256$2000$"));
+
+    // Already current, stays as it is
+    auto current = readStored("legacy");
+
+    ASSERT_FALSE(test.loginUser("legacy", "qwert").second);
+    ASSERT_EQ(readStored("legacy"), current);
+
+    test.clear();
+}
+
+TEST(WorkerPoolTests, admission_test)
+{
+    WorkerPool pool(2, 1);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<int> done {};
+
+    auto blocked = [&] {
+        released.wait();
+        done++;
+    };
+
+    // Two running, one waiting, the fourth does not fit
+    ASSERT_TRUE(pool.trySubmit(blocked));
+    ASSERT_TRUE(pool.trySubmit(blocked));
+    ASSERT_TRUE(pool.trySubmit(blocked));
+    ASSERT_FALSE(pool.trySubmit(blocked));
+
+    auto stats = pool.getStats();
+
+    ASSERT_EQ(stats.workers, 2);
+    ASSERT_EQ(stats.busy + stats.queued, 3);
+    ASSERT_EQ(stats.rejected, 1);
+
+    release.set_value();
+    while (pool.getStats().completed < 3)
+    {
+        std::this_thread::yield();
+    }
+    ASSERT_EQ(done, 3);
+    ASSERT_TRUE(pool.trySubmit(blocked));
+}
+
+TEST(CompressionTests, negotiation_test)
+{
+    using Encoding = Compression::Encoding;
+
+    auto best = []( const std::initializer_list<Encoding> order ) {
+        for (auto encoding : order)
+        {
+            if (Compression::isSupported(encoding))
+            {
+                return encoding;
+            }
+        }
+        return Encoding::kIdentity;
+    };
+
+    ASSERT_EQ(Compression::choose(""), Encoding::kIdentity);
+    ASSERT_EQ(Compression::choose("identity"), Encoding::kIdentity);
+    ASSERT_EQ(Compression::choose("gzip, deflate, br"), best({Encoding::kBrotli, Encoding::kGzip, Encoding::kDeflate}));
+    ASSERT_EQ(Compression::choose("br;q=0, deflate, gzip"), best({Encoding::kGzip, Encoding::kDeflate}));
+    ASSERT_EQ(Compression::choose("deflate"), best({Encoding::kDeflate}));
+
+    // The coding's own entry beats "*" in either order
+    ASSERT_TRUE(Compression::isAccepted("*;q=0, gzip", Encoding::kGzip));
+    ASSERT_TRUE(Compression::isAccepted("gzip, *;q=0", Encoding::kGzip));
+    ASSERT_FALSE(Compression::isAccepted("*, gzip;q=0", Encoding::kGzip));
+    ASSERT_FALSE(Compression::isAccepted("gzip;q=0, *", Encoding::kGzip));
+    ASSERT_TRUE(Compression::isAccepted("gzip;q=0, *", Encoding::kBrotli));
+    ASSERT_FALSE(Compression::isAccepted("*;q=0, gzip", Encoding::kBrotli));
+
+    if (!Compression::isSupported(Encoding::kDeflate))
+    {
+        return;
+    }
+
+    // A page of messages repeats the user object in every entry
+    std::string page = "[";
+
+    for (int i = 0; i < 100; i++)
+    {
+        page += R"({"id":)" + std::to_string(i) + R"(,"user":{"login":"holder","first_name":"Holder"}},)";
+    }
+    page.back() = ']';
+
+    auto gzip = Compression::compress(page, Encoding::kGzip, 5);
+    auto deflate = Compression::compress(page, Encoding::kDeflate, 5);
+
+    ASSERT_LT(gzip.size(), page.size() / 4);
+    ASSERT_EQ(static_cast<uint8_t>(gzip[0]), 0x1F);
+    ASSERT_EQ(static_cast<uint8_t>(gzip[1]), 0x8B);
+    // zlib wrapper, 32K window and deflate method
+    ASSERT_EQ(static_cast<uint8_t>(deflate[0]), 0x78);
+    ASSERT_LT(deflate.size(), gzip.size());
+}
+
+TEST(StaticAssetsTests, validator_test)
+{
+    // API etags are weak, clients may send them back with or without W/
+    ASSERT_TRUE(StaticAssets::isNotModified("W/\"1a-m5-5\"", "\"1a-m5-5\""));
+    ASSERT_TRUE(StaticAssets::isNotModified("\"x\", \"1a-m5-5\"", "\"1a-m5-5\""));
+    ASSERT_FALSE(StaticAssets::isNotModified("W/\"1a-m5-6\"", "\"1a-m5-5\""));
+    ASSERT_FALSE(StaticAssets::isNotModified("", "\"1a-m5-5\""));
+}
+
+TEST(ServiceTests, rooms_test)
+{
+    const int capacity = 4, N = 12;
+    Database test("test.db", DatabaseOptions {.roomRecentMessages = capacity});
+
+    test.clear();
+    test.addUser(User {.login = "owner", .password = "qwert", .firstName = "Owner"});
+    test.addUser(User {.login = "guest", .password = "qwert", .firstName = "Guest"});
+    int ownerId = test.getUserByLogin("owner")->id;
+    int guestId = test.getUserByLogin("guest")->id;
+
+    auto [room, err] = test.addRoom("cpp", ownerId);
+
+    ASSERT_FALSE(err);
+    ASSERT_NE(room.id, Database::kGeneralRoom);
+    ASSERT_EQ(test.addRoom("cpp", guestId).second.errorId, 409);
+    ASSERT_EQ(test.getRooms(guestId).size(), 2);
+
+    // Membership, the general room has everyone and can not be left
+    ASSERT_TRUE(test.isRoomMember(Database::kGeneralRoom, guestId));
+    ASSERT_TRUE(test.isRoomMember(room.id, ownerId));
+    ASSERT_FALSE(test.isRoomMember(room.id, guestId));
+    ASSERT_FALSE(test.joinRoom(room.id, guestId));
+    ASSERT_TRUE(test.isRoomMember(room.id, guestId));
+    ASSERT_EQ(test.getRoom(room.id, guestId)->membersCount, 2);
+    ASSERT_EQ(test.leaveRoom(Database::kGeneralRoom, guestId).errorId, 400);
+    ASSERT_EQ(test.joinRoom(room.id + 100, guestId).errorId, 404);
+
+    // A missing id is remembered, but a room created with it shows up at once
+    ASSERT_FALSE(test.hasRoom(room.id + 1));
+    auto [next, nextErr] = test.addRoom("next", ownerId);
+
+    ASSERT_FALSE(nextErr);
+    ASSERT_EQ(next.id, room.id + 1);
+    ASSERT_TRUE(test.hasRoom(next.id));
+    ASSERT_FALSE(test.deleteRoom(next.id, ownerId));
+    ASSERT_FALSE(test.hasRoom(next.id));
+
+    // Only the owner changes the room
+    ASSERT_EQ(test.renameRoom(room.id, guestId, "java").errorId, 403);
+    ASSERT_EQ(test.renameRoom(Database::kGeneralRoom, ownerId, "main").errorId, 403);
+    ASSERT_FALSE(test.renameRoom(room.id, ownerId, "cpp20"));
+    ASSERT_EQ(test.getRoom(room.id, ownerId)->name, "cpp20");
+
+    // Rooms interleave ids, so the window of each one sees gaps
+    for (int i = 0; i < N; i++)
+    {
+        test.sendMessage(ownerId, "General " + std::to_string(i), Database::kGeneralRoom);
+        test.sendMessage(guestId, "Room " + std::to_string(i), room.id);
+    }
+
+    auto general = test.getMessagesAfter(0);
+    auto inRoom = test.getMessagesAfter(0, -1, room.id);
+
+    ASSERT_EQ(general.size(), N);
+    ASSERT_EQ(inRoom.size(), N);
+    ASSERT_EQ(test.getRoomLastId(room.id), inRoom.back()->id);
+
+    for (int i = 0; i < N; i++)
+    {
+        ASSERT_EQ(general[i]->roomId, Database::kGeneralRoom);
+        ASSERT_EQ(inRoom[i]->messageText, "Room " + std::to_string(i));
+    }
+
+    // Same pages from the window and from SQL
+    auto last = test.getLastMessages(capacity, room.id);
+    auto older = test.getMessagesBefore(last.front()->id, capacity, room.id);
+
+    ASSERT_EQ(last.size(), capacity);
+    ASSERT_EQ(last.front()->id, inRoom[N - capacity]->id);
+    ASSERT_EQ(older.size(), capacity);
+    ASSERT_EQ(older.back()->id, inRoom[N - capacity - 1]->id);
+    ASSERT_EQ(test.getMessagesAfter(inRoom[N - capacity - 1]->id, -1, room.id).size(), capacity);
+
+    // A room loaded from disk gives the same answers
+    {
+        Database reopened("test.db", DatabaseOptions {.roomRecentMessages = capacity});
+        auto reloaded = reopened.getLastMessages(N, room.id);
+
+        ASSERT_EQ(reloaded.size(), N);
+        ASSERT_EQ(reloaded.back()->id, inRoom.back()->id);
+        ASSERT_TRUE(reopened.isRoomMember(room.id, guestId));
+    }
+
+    // Waiters of a room wake up on its messages only
+    auto waiter = std::async(std::launch::async, [&] {
+        return test.waitForMessages(room.id, inRoom.back()->id, std::chrono::seconds(5));
+    });
+
+    ASSERT_FALSE(test.waitForMessages(room.id, inRoom.back()->id, std::chrono::milliseconds(10)));
+    test.sendMessage(ownerId, "Elsewhere", Database::kGeneralRoom);
+    test.sendMessage(ownerId, "Wake up", room.id);
+    ASSERT_TRUE(waiter.get());
+
+    // Deleted rooms take their messages and refuse new ones
+    int messages = test.getMessageCount();
+
+    ASSERT_EQ(test.deleteRoom(room.id, guestId).errorId, 403);
+    ASSERT_FALSE(test.deleteRoom(room.id, ownerId));
+    ASSERT_FALSE(test.hasRoom(room.id));
+    ASSERT_EQ(test.getMessageCount(), messages - N - 1);
+    ASSERT_EQ(test.sendMessage(ownerId, "Too late", room.id).second.errorId, 404);
+    ASSERT_TRUE(test.getMessagesAfter(0, -1, room.id).empty());
+
+    test.clear();
+}
+
+TEST(ServiceTests, room_load_race_test)
+{
+    int userId = 0, roomId = 0;
+
+    {
+        Database setup("test.db");
+
+        setup.clear();
+        setup.addUser(User {.login = "owner", .password = "qwert", .firstName = "Owner"});
+        userId = setup.getUserByLogin("owner")->id;
+        roomId = setup.addRoom("cpp", userId).first.id;
+        setup.sendMessage(userId, "Before", roomId);
+    }
+
+    // A message committed after the room is read but before it is published still reaches its window
+    Database *db = nullptr;
+    bool isPosted = false;
+    DatabaseOptions options;
+
+    options.roomLoaded = [&]( const int id ) {
+        if (id == roomId && !isPosted)
+        {
+            isPosted = true;
+            ASSERT_FALSE(db->sendMessage(userId, "Between", id).second);
+        }
+    };
+
+    Database test("test.db", options);
+
+    db = &test;
+
+    auto messages = test.getMessagesAfter(0, -1, roomId);
+
+    ASSERT_TRUE(isPosted);
+    ASSERT_EQ(messages.size(), 2);
+    ASSERT_EQ(messages.back()->messageText, "Between");
+    ASSERT_EQ(test.getRoomLastId(roomId), messages.back()->id);
+
+    // And the window keeps taking the ones after it
+    auto [after, err] = test.sendMessage(userId, "After", roomId);
+
+    ASSERT_FALSE(err);
+    ASSERT_EQ(test.getLastMessages(3, roomId).size(), 3);
+    ASSERT_EQ(test.getRoomLastId(roomId), after->id);
+
+    test.clear();
+}
+
+TEST(ServiceTests, search_test)
+{
+    // Long pause, so after its first chunk the background backfill leaves the rest to the test
+    DatabaseOptions options {.searchBackfillChunk = 2, .searchBackfillPause = std::chrono::hours(1)};
+
+    {
+        Database test("test.db", options);
+
+        test.clear();
+        test.addUser(User {.login = "finder", .password = "qwert", .firstName = "Finder"});
+        int userId = test.getUserByLogin("finder")->id;
+
+        test.sendMessage(userId, "Old news about cats");
+        test.sendMessage(userId, "More old news, still about cats");
+        test.sendMessage(userId, "Nothing to see here");
+    }
+
+    // A database from before search: the index is built from what is stored
+    {
+        SQLite::Database db("test.db", SQLite::OPEN_READWRITE);
+
+        db.exec("DROP TABLE messages_fts");
+        db.exec("DROP TABLE search_backfill");
+    }
+
+    Database test("test.db", options);
+    int userId = test.getUserByLogin("finder")->id;
+
+    test.sendMessage(userId, "cat cat cat, all about the cat");
+    test.sendMessage(userId, "A cat and a dog and a bird and a fish");
+    test.sendMessage(userId, "Hello \"world\" (AND) OR *");
+
+    while (test.backfillSearch(2))
+    {
+    }
+    ASSERT_EQ(test.getStats()["search"]["backfill_pending_ids"].get<int>(), 0);
+
+    // Ranked, the last word is a prefix, and nothing typed is query syntax
+    auto [hits, err] = test.searchMessages("cat", Database::kGeneralRoom, 10);
+
+    ASSERT_FALSE(err);
+    ASSERT_EQ(hits.size(), 4);
+    ASSERT_EQ(hits.front().message->messageText, "cat cat cat, all about the cat");
+    ASSERT_NE(hits.front().snippet.find(std::string {Database::kMatchBegin} + "cat" + Database::kMatchEnd),
+              std::string::npos);
+
+    for (size_t i = 1; i < hits.size(); i++)
+    {
+        ASSERT_LE(hits[i - 1].rank, hits[i].rank);
+    }
+
+    ASSERT_EQ(test.searchMessages("old news", Database::kGeneralRoom, 10).first.size(), 2);
+    ASSERT_EQ(test.searchMessages("(AND) \"world", Database::kGeneralRoom, 10).first.size(), 1);
+    ASSERT_TRUE(test.searchMessages("dolphin", Database::kGeneralRoom, 10).first.empty());
+    ASSERT_EQ(test.searchMessages("   ", Database::kGeneralRoom, 10).second.errorId, 400);
+
+    // Keyset pages give every hit once, in the order of a single page
+    std::vector<int> paged;
+    std::optional<Database::SearchCursor> cursor;
+
+    while (true)
+    {
+        auto page = test.searchMessages("cat", Database::kGeneralRoom, 3, cursor).first;
+
+        for (const auto &hit : page)
+        {
+            paged.push_back(hit.message->id);
+        }
+        if (page.size() < 3)
+        {
+            break;
+        }
+        cursor = Database::SearchCursor {page.back().rank, page.back().message->id};
+    }
+
+    ASSERT_EQ(paged.size(), hits.size());
+    for (size_t i = 0; i < hits.size(); i++)
+    {
+        ASSERT_EQ(paged[i], hits[i].message->id);
+    }
+
+    // Rooms search their own messages, and a deleted room leaves the index consistent
+    auto [room, roomErr] = test.addRoom("pets", userId);
+
+    test.sendMessage(userId, "A cat in the pets room", room.id);
+    ASSERT_EQ(test.searchMessages("cat", room.id, 10).first.size(), 1);
+    ASSERT_EQ(test.searchMessages("cat", Database::kGeneralRoom, 10).first.size(), 4);
+    ASSERT_FALSE(test.deleteRoom(room.id, userId));
+
+    SQLite::Database db("test.db", SQLite::OPEN_READWRITE);
+
+    ASSERT_NO_THROW(db.exec("INSERT INTO messages_fts (messages_fts) VALUES ('integrity-check')"));
+
+    test.clear();
+}
+
+TEST(MessageHubTests, fan_out_test)
+{
+    auto makeMessage = []( const int id ) {
+        auto message = std::make_shared<MessageJson>();
+
+        message->id = id;
+        message->json = std::to_string(id);
+        return MessagePtr(message);
+    };
+
+    MessageHub hub(4, 2);
+    std::vector<MessagePtr> events;
+
+    hub.reset(10);
+    ASSERT_EQ(hub.getLastId(), 10);
+    ASSERT_TRUE(hub.eventsAfter(10, events));
+    ASSERT_TRUE(events.empty());
+    // Older than the reset point, the hub can not replay it
+    ASSERT_FALSE(hub.eventsAfter(9, events));
+
+    // Every subscriber is woken and replays the same messages in order
+    auto waiter = [&] {
+        std::vector<MessagePtr> seen;
+        int cursor = 10;
+
+        while (seen.size() < 3 && hub.waitAfter(cursor, std::chrono::seconds(5)))
+        {
+            std::vector<MessagePtr> batch;
+
+            if (!hub.eventsAfter(cursor, batch))
+            {
+                break;
+            }
+            for (auto &event : batch)
+            {
+                cursor = event->id;
+                seen.push_back(std::move(event));
+            }
+        }
+        return seen;
+    };
+
+    ASSERT_TRUE(hub.subscribe());
+    ASSERT_TRUE(hub.subscribe());
+    auto first = std::async(std::launch::async, waiter);
+    auto second = std::async(std::launch::async, waiter);
+
+    ASSERT_FALSE(hub.waitAfter(10, std::chrono::milliseconds(10)));
+    for (int id : {11, 13, 14})
+    {
+        hub.publish(makeMessage(id));
+    }
+
+    for (auto *result : {&first, &second})
+    {
+        auto seen = result->get();
+
+        ASSERT_EQ(seen.size(), 3);
+        ASSERT_EQ(seen[0]->id, 11);
+        ASSERT_EQ(seen[1]->id, 13);
+        ASSERT_EQ(seen[2]->id, 14);
+    }
+
+    // Catch-up from any id still in the backlog, ids in between may be missing
+    events.clear();
+    ASSERT_TRUE(hub.eventsAfter(12, events));
+    ASSERT_EQ(events.size(), 2);
+    ASSERT_EQ(events.front()->id, 13);
+
+    // Past the backlog the oldest messages are dropped and a replay from before them is refused
+    hub.publish(makeMessage(15));
+    hub.publish(makeMessage(16));
+    events.clear();
+    ASSERT_FALSE(hub.eventsAfter(11, events));
+    ASSERT_TRUE(hub.eventsAfter(12, events));
+    ASSERT_EQ(events.size(), 4);
+    ASSERT_EQ(events.back()->id, 16);
+
+    // Both slots are taken, the third subscriber is refused until one is given back
+    ASSERT_EQ(hub.getSubscribersCount(), 2);
+    ASSERT_FALSE(hub.subscribe());
+    hub.unsubscribe();
+    ASSERT_TRUE(hub.subscribe());
+    hub.unsubscribe();
+    hub.unsubscribe();
+    ASSERT_EQ(hub.getSubscribersCount(), 0);
+
+    // Shutdown wakes waiters with false and refuses new subscribers
+    auto parked = std::async(std::launch::async, [&] {
+        return hub.waitAfter(16, std::chrono::seconds(5));
+    });
+
+    hub.shutdown();
+    ASSERT_FALSE(parked.get());
+    ASSERT_TRUE(hub.isStopped());
+    ASSERT_FALSE(hub.subscribe());
+}
+
+TEST(MessageHubTests, subscription_test)
+{
+    MessageHub hub(4, 1);
+
+    {
+        MessageHub::Subscription first(hub);
+        MessageHub::Subscription second(hub);
+
+        ASSERT_TRUE(first);
+        ASSERT_FALSE(second);
+        ASSERT_EQ(hub.getSubscribersCount(), 1);
+    }
+    ASSERT_EQ(hub.getSubscribersCount(), 0);
+
+    // A throw while the slot is held still gives it back
+    try
+    {
+        MessageHub::Subscription slot(hub);
+
+        throw std::runtime_error("Wait failed");
+    }
+    catch ( const std::exception & )
+    {
+    }
+    ASSERT_EQ(hub.getSubscribersCount(), 0);
+}
+
+// Real server on a side thread with a fresh database, stopped and joined even when an assertion returns early
+class TestServer final
+{
+public:
+    static constexpr int kPort = 18181;
+
+    explicit TestServer( ServerConfig config ) : _server(_fresh(std::move(config))), _thread([this] {
+        _server.run();
+    }) {}
+
+    ~TestServer( void )
+    {
+        _server.stop();
+        _thread.join();
+    }
+
+    auto waitUntilReady( void ) -> bool
+    {
+        return _server.waitUntilReady();
+    }
+
+    // Registers and logs in a user, the headers are empty when either fails
+    static auto login( httplib::Client &client, const std::string &name ) -> httplib::Headers
+    {
+        nlohmann::json user = {{"login", name}, {"password", "qwerty"}, {"first_name", "Test"}, {"last_name", "User"}};
+        auto registered = client.Post("/api/auth/register", user.dump(), "application/json");
+        auto result = client.Post("/api/auth/login", user.dump(), "application/json");
+
+        if (!registered || registered->status != 200 || !result || result->status != 200)
+        {
+            return {};
+        }
+        return {{"Authorization-Token", nlohmann::json::parse(result->body)["auth_token"].get<std::string>()}};
+    }
+
+private:
+    static auto _fresh( ServerConfig config ) -> ServerConfig
+    {
+        for (const char *suffix : {"", "-wal", "-shm"})
+        {
+            std::filesystem::remove(config.database + suffix);
+        }
+        config.host = "127.0.0.1";
+        config.port = kPort;
+        config.kdfIterations = Password::kMinIterations;
+        return config;
+    }
+
+    Server _server;
+    std::thread _thread;
+};
+
+TEST(ServerTests, long_poll_test)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // One slot, so a second parked poll is refused
+    TestServer server(ServerConfig {.database = "test_server.db", .maxStreams = 1});
+
+    ASSERT_TRUE(server.waitUntilReady());
+
+    httplib::Client client("127.0.0.1", TestServer::kPort);
+    auto headers = TestServer::login(client, "poller");
+
+    ASSERT_FALSE(headers.empty());
+    auto poll = [&]( const int waitMs, httplib::Headers extra = {} ) {
+        httplib::Client poller("127.0.0.1", TestServer::kPort);
+
+        extra.insert(headers.begin(), headers.end());
+        return poller.Get("/api/messages/new?after_id=0&wait=" + std::to_string(waitMs), extra);
+    };
+    // Spins until the parked poll holds the only slot, then the probe is refused
+    auto waitParked = [&] {
+        auto deadline = Clock::now() + std::chrono::seconds(5);
+
+        while (Clock::now() < deadline)
+        {
+            auto probe = poll(1);
+
+            if (probe && probe->status == 503)
+            {
+                return probe->get_header_value("Retry-After");
+            }
+        }
+        return std::string();
+    };
+    auto send = [&]( const std::string &text ) {
+        nlohmann::json message = {{"message_text", text}};
+
+        return client.Post("/api/messages", headers, message.dump(), "application/json")->status;
+    };
+
+    // Nothing arrives, the poll answers an empty page once the wait is over
+    auto start = Clock::now();
+    auto empty = poll(300);
+
+    ASSERT_EQ(empty->status, 200);
+    ASSERT_GE(Clock::now() - start, std::chrono::milliseconds(300));
+    ASSERT_TRUE(nlohmann::json::parse(empty->body)["messages"].empty());
+
+    std::string etag = empty->get_header_value("ETag");
+
+    ASSERT_FALSE(etag.empty());
+
+    // The validator is checked after the wait, so an unchanged room is a 304 only once it is over
+    start = Clock::now();
+    auto unchanged = poll(300, {{"If-None-Match", etag}});
+
+    ASSERT_EQ(unchanged->status, 304);
+    ASSERT_GE(Clock::now() - start, std::chrono::milliseconds(300));
+
+    // A parked poll takes the slot, another one is told to come back later, a post wakes the first
+    auto parked = std::async(std::launch::async, [&] {
+        // A probe may hold the slot for a moment, so it keeps asking until it is parked
+        auto result = poll(10000, {{"If-None-Match", etag}});
+
+        while (result && result->status == 503)
+        {
+            result = poll(10000, {{"If-None-Match", etag}});
+        }
+        return result;
+    });
+
+    ASSERT_EQ(waitParked(), "2");
+    start = Clock::now();
+    ASSERT_EQ(send("Wake up"), 200);
+
+    auto woken = parked.get();
+
+    ASSERT_LT(Clock::now() - start, std::chrono::seconds(5));
+    ASSERT_EQ(woken->status, 200);
+    ASSERT_NE(woken->get_header_value("ETag"), etag);
+
+    auto messages = nlohmann::json::parse(woken->body)["messages"];
+
+    ASSERT_EQ(messages.size(), 1);
+    ASSERT_EQ(messages[0]["message_text"], "Wake up");
+
+    // The slot is free again
+    ASSERT_EQ(poll(1)->status, 200);
+}
+
+TEST(ServerTests, online_delta_test)
+{
+    TestServer server(ServerConfig {.database = "test_server.db"});
+
+    ASSERT_TRUE(server.waitUntilReady());
+
+    httplib::Client client("127.0.0.1", TestServer::kPort);
+    auto headers = TestServer::login(client, "watcher");
+
+    ASSERT_FALSE(headers.empty());
+
+    auto full = client.Get("/api/users/online", headers);
+
+    ASSERT_EQ(full->status, 200);
+
+    // Nobody came or went, a plain request still gets an empty delta and a validator, not a 304
+    auto version = nlohmann::json::parse(full->body)["version"].get<uint64_t>();
+    auto delta = client.Get("/api/users/online?since_version=" + std::to_string(version), headers);
+
+    ASSERT_EQ(delta->status, 200);
+    ASSERT_FALSE(delta->get_header_value("ETag").empty());
+
+    auto changes = nlohmann::json::parse(delta->body);
+
+    ASSERT_EQ(changes["version"], version);
+    ASSERT_TRUE(changes["joined"].empty());
+    ASSERT_TRUE(changes["left"].empty());
+
+    // The client holding that validator is the one that gets the 304
+    auto conditional = headers;
+
+    conditional.emplace("If-None-Match", delta->get_header_value("ETag"));
+    ASSERT_EQ(client.Get("/api/users/online?since_version=" + std::to_string(version), conditional)->status, 304);
+}
@@ -28,6 +28,11 @@ target_include_directories( test_${PROJECT_NAME}
     ${SERVER_INCLUDES}
 )
 
+target_compile_definitions( test_${PROJECT_NAME}
+    PRIVATE
+    ${SERVER_DEFINITIONS}
+)
+
 target_compile_features( test_${PROJECT_NAME}
     PRIVATE
     cxx_std_20
@@ -40,5 +45,9 @@ target_link_libraries( test_${PROJECT_NAME}
     ${SERVER_LIBS}
 )
 
+if( TARGET embedded_assets )
+    add_dependencies( test_${PROJECT_NAME} embedded_assets )
+endif()
+
 include(GoogleTest)
 gtest_discover_tests(test_${PROJECT_NAME})
\ No newline at end of file